@@ -6,6 +6,41 @@
 #include "areamgr.h"
 #include <string.h>
 
+#if CHECKSUM == CHECKSUM_KEYED
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+uint32_t checksum_key;
+
+/**
+ * Picks new random key for structures' checksums.
+ *
+ * @return				random key
+ */
+
+uint32_t checksum_new_key(void)/*{{{*/
+{
+	uint32_t key;
+
+	if (getrandom(&key, sizeof(key), GRND_NONBLOCK) != sizeof(key))
+		key = ((uint32_t)getpid() << 16) ^ (uint32_t)time(NULL) ^ (uint32_t)(uintptr_t)&key;
+
+	return key;
+}/*}}}*/
+
+/**
+ * Picks random key for structures' checksums before anything is allocated.
+ */
+
+static void __attribute__((constructor)) checksum_key_init(void)/*{{{*/
+{
+	checksum_key = checksum_new_key();
+
+	DEBUG("Checksum key is $%.8x\n", checksum_key);
+}/*}}}*/
+#endif
+
 /**
  * A few words of comment.
  *
@@ -16,6 +51,403 @@
  * When an area is marked as AREA_FLAG_USED then it is on free list.
  */
 
+/* === Tree of large free areas ============================================ */
+
+struct area_key
+{
+	size_t	 size;
+	void	*addr;
+};
+
+typedef struct area_key area_key_t;
+
+static inline area_key_t area_key(area_t *area)/*{{{*/
+{
+	return (area_key_t){ area->size, area_begining(area) };
+}/*}}}*/
+
+static inline bool area_key_lt(area_key_t a, area_key_t b)/*{{{*/
+{
+	return (a.size < b.size) || ((a.size == b.size) && (a.addr < b.addr));
+}/*}}}*/
+
+static inline bool area_key_eq(area_key_t a, area_key_t b)/*{{{*/
+{
+	return (a.size == b.size) && (a.addr == b.addr);
+}/*}}}*/
+
+#define __TREE				areatree
+#define __TREE_T			areatree_t
+#define __NODE				areatree_node
+#define __NODE_T			area_t
+#define __KEY_T				area_key_t
+#define __ROOT(tree)		((tree)->root)
+#define __LEFT(node)		((node)->tree.left)
+#define __RIGHT(node)		((node)->tree.right)
+#define __PARENT(node)		((node)->parent)
+#define __KEY(node)			area_key(node)
+#define __LOCK(tree)		((tree)->lock)
+#define __KEY_LT(a,b)		area_key_lt(a, b)
+#define __KEY_EQ(a,b)		area_key_eq(a, b)
+
+#include "common-splay0.c"
+
+/* === Tables of fixed size records ======================================== */
+
+/*
+ * Area structures and nodes of index of areas are carved from pages taken
+ * from the OS and never given back. Unused records are kept on a list linked
+ * thru a pointer field at <i>link</i> offset.
+ */
+
+#define RECTBL_CHUNK_PAGES	4
+
+struct rectbl
+{
+	void	*unused;
+	size_t	 size;
+	size_t	 link;
+
+	pthread_mutex_t lock;
+};
+
+typedef struct rectbl rectbl_t;
+
+static rectbl_t areatbl = { NULL, sizeof(area_t), offsetof(area_t, global.next), PTHREAD_MUTEX_INITIALIZER };
+static rectbl_t nodetbl = { NULL, sizeof(areaidx_node_t), offsetof(areaidx_node_t, child), PTHREAD_MUTEX_INITIALIZER };
+
+/**
+ * Takes an unused record from the table.
+ *
+ * @param tbl
+ * @return		zeroed record
+ */
+
+static void *rectbl_alloc(rectbl_t *tbl)/*{{{*/
+{
+	pthread_mutex_lock(&tbl->lock);
+
+	if (tbl->unused == NULL) {
+		void *chunk = pm_mmap_alloc(NULL, RECTBL_CHUNK_PAGES);
+
+		if (chunk == NULL)
+			PANIC("Cannot allocate memory for records' table!");
+
+		DEBUG("Created chunk of %zu bytes records at %p\n", tbl->size, chunk);
+
+		uint32_t count = RECTBL_CHUNK_PAGES * PAGE_SIZE / tbl->size;
+
+		while (count-- > 0) {
+			void *record = chunk + count * tbl->size;
+
+			*(void **)(record + tbl->link) = tbl->unused;
+			tbl->unused = record;
+		}
+	}
+
+	void *record = tbl->unused;
+
+	tbl->unused = *(void **)(record + tbl->link);
+
+	pthread_mutex_unlock(&tbl->lock);
+
+	memset(record, 0, tbl->size);
+
+	return record;
+}/*}}}*/
+
+/**
+ * Gives record back to the table.
+ *
+ * @param tbl
+ * @param record
+ */
+
+static void rectbl_free(rectbl_t *tbl, void *record)/*{{{*/
+{
+	memset(record, 0, tbl->size);
+
+	pthread_mutex_lock(&tbl->lock);
+
+	*(void **)(record + tbl->link) = tbl->unused;
+	tbl->unused = record;
+
+	pthread_mutex_unlock(&tbl->lock);
+}/*}}}*/
+
+/* === Index of areas by address ========================================== */
+
+/*
+ * Nodes are never merged - when the last key is removed from a node, the node
+ * is released and detached from its parent. Thus every node in the tree is
+ * nonempty, which is enough to keep lookups logarithmic.
+ */
+
+/**
+ * Counts keys in the node that are not greater than given one.
+ *
+ * @param node
+ * @param key
+ * @return
+ */
+
+static inline uint32_t areaidx_rank(areaidx_node_t *node, void *key)/*{{{*/
+{
+	uint32_t i = 0;
+
+	while ((i < node->count) && (node->key[i] <= key))
+		i++;
+
+	return i;
+}/*}}}*/
+
+/**
+ * Finds an area with the greatest beginning not exceeding given address.
+ *
+ * @param node
+ * @param addr
+ * @return		the area or NULL if all areas in subtree begin above address
+ */
+
+static area_t *areaidx_find(areaidx_node_t *node, void *addr)/*{{{*/
+{
+	if (node == NULL)
+		return NULL;
+
+	int32_t i = areaidx_rank(node, addr);
+
+	if (node->leaf)
+		return (i > 0) ? node->area[i - 1] : NULL;
+
+	/* keys in child[i - 1] are all below key[i - 1] */
+	for (; i >= 0; i--) {
+		area_t *area = areaidx_find(node->child[i], addr);
+
+		if (area != NULL)
+			return area;
+	}
+
+	return NULL;
+}/*}}}*/
+
+/**
+ * Splits full node into halves.
+ *
+ * @param node
+ * @param upkey		key that separates halves
+ * @return			right half
+ */
+
+static areaidx_node_t *areaidx_split(areaidx_node_t *node, void **upkey)/*{{{*/
+{
+	I(node->count == AREAIDX_ORDER);
+
+	areaidx_node_t *right = rectbl_alloc(&nodetbl);
+
+	uint32_t half = AREAIDX_ORDER / 2;
+
+	right->leaf = node->leaf;
+
+	if (node->leaf) {
+		/* leaves share the separating key with their parent */
+		right->count = AREAIDX_ORDER - half;
+
+		memcpy(right->key, &node->key[half], right->count * sizeof(void *));
+		memcpy(right->area, &node->area[half], right->count * sizeof(area_t *));
+
+		*upkey = right->key[0];
+	} else {
+		/* separating key is moved to the parent */
+		right->count = AREAIDX_ORDER - half - 1;
+
+		memcpy(right->key, &node->key[half + 1], right->count * sizeof(void *));
+		memcpy(right->child, &node->child[half + 1], (right->count + 1) * sizeof(areaidx_node_t *));
+
+		*upkey = node->key[half];
+	}
+
+	node->count = half;
+
+	return right;
+}/*}}}*/
+
+/**
+ * Inserts a key into subtree. For a leaf <i>value</i> is an area, for inner
+ * node it is a child that goes right to the key.
+ *
+ * @param node
+ * @param key
+ * @param value
+ * @param upkey		key that separates node from its new sibling
+ * @return			new right sibling of the node if it was split
+ */
+
+static areaidx_node_t *areaidx_insert_node(areaidx_node_t *node, void *key, void *value, void **upkey)/*{{{*/
+{
+	areaidx_node_t *right = NULL;
+
+	uint32_t i = areaidx_rank(node, key);
+
+	if (!node->leaf) {
+		value = areaidx_insert_node(node->child[i], key, value, &key);
+
+		if (value == NULL)
+			return NULL;
+	}
+
+	if (node->count == AREAIDX_ORDER) {
+		right = areaidx_split(node, upkey);
+
+		if (key >= *upkey)
+			node = right;
+
+		i = areaidx_rank(node, key);
+	}
+
+	memmove(&node->key[i + 1], &node->key[i], (node->count - i) * sizeof(void *));
+
+	node->key[i] = key;
+
+	if (node->leaf) {
+		memmove(&node->area[i + 1], &node->area[i], (node->count - i) * sizeof(area_t *));
+		node->area[i] = value;
+	} else {
+		memmove(&node->child[i + 2], &node->child[i + 1], (node->count - i) * sizeof(areaidx_node_t *));
+		node->child[i + 1] = value;
+	}
+
+	node->count++;
+
+	return right;
+}/*}}}*/
+
+/**
+ * Adds an area to the index.
+ *
+ * @param global
+ * @param area
+ */
+
+static void areaidx_insert(arealst_t *global, area_t *area)/*{{{*/
+{
+	void *key = area_begining(area);
+
+	if (global->index == NULL) {
+		global->index = rectbl_alloc(&nodetbl);
+		global->index->leaf = TRUE;
+	}
+
+	void *upkey;
+
+	areaidx_node_t *right = areaidx_insert_node(global->index, key, area, &upkey);
+
+	if (right != NULL) {
+		areaidx_node_t *root = rectbl_alloc(&nodetbl);
+
+		root->count    = 1;
+		root->key[0]   = upkey;
+		root->child[0] = global->index;
+		root->child[1] = right;
+
+		global->index = root;
+	}
+}/*}}}*/
+
+/**
+ * Removes a key from subtree.
+ *
+ * @param node
+ * @param key
+ * @return		TRUE if the node became empty
+ */
+
+static bool areaidx_remove_node(areaidx_node_t *node, void *key)/*{{{*/
+{
+	uint32_t i = areaidx_rank(node, key);
+
+	if (node->leaf) {
+		I((i > 0) && (node->key[i - 1] == key));
+
+		i--;
+
+		memmove(&node->key[i], &node->key[i + 1], (node->count - i - 1) * sizeof(void *));
+		memmove(&node->area[i], &node->area[i + 1], (node->count - i - 1) * sizeof(area_t *));
+
+		node->count--;
+
+		return (node->count == 0);
+	}
+
+	if (!areaidx_remove_node(node->child[i], key))
+		return FALSE;
+
+	rectbl_free(&nodetbl, node->child[i]);
+
+	if (node->count == 0)
+		return TRUE;
+
+	/* range of removed child is taken over by its left (or right) sibling */
+	uint32_t k = (i > 0) ? i - 1 : 0;
+
+	memmove(&node->key[k], &node->key[k + 1], (node->count - k - 1) * sizeof(void *));
+	memmove(&node->child[i], &node->child[i + 1], (node->count - i) * sizeof(areaidx_node_t *));
+
+	node->count--;
+
+	return FALSE;
+}/*}}}*/
+
+/**
+ * Removes an area beginning at given address from the index.
+ *
+ * @param global
+ * @param key
+ */
+
+static void areaidx_remove(arealst_t *global, void *key)/*{{{*/
+{
+	I(global->index != NULL);
+
+	if (areaidx_remove_node(global->index, key)) {
+		rectbl_free(&nodetbl, global->index);
+
+		global->index = NULL;
+	}
+
+	/* drop root that has only one child */
+	while ((global->index != NULL) && !global->index->leaf && (global->index->count == 0)) {
+		areaidx_node_t *root = global->index;
+
+		global->index = root->child[0];
+
+		rectbl_free(&nodetbl, root);
+	}
+}/*}}}*/
+
+/**
+ * Makes the key point to another area.
+ *
+ * @param global
+ * @param key
+ * @param area
+ */
+
+static void areaidx_set(arealst_t *global, void *key, area_t *area)/*{{{*/
+{
+	areaidx_node_t *node = global->index;
+
+	I(node != NULL);
+
+	while (!node->leaf)
+		node = node->child[areaidx_rank(node, key)];
+
+	uint32_t i = areaidx_rank(node, key);
+
+	I((i > 0) && (node->key[i - 1] == key));
+
+	node->area[i - 1] = area;
+}/*}}}*/
+
 /**
  * Gets memory thru a system call and make it a new memory area.
  *
@@ -44,9 +476,9 @@ area_t *area_new(pm_type_t type, uint32_t pages)/*{{{*/
 	if (begining == NULL)
 		return NULL;
 
-	area = area_footer(begining, pages);
+	area = rectbl_alloc(&areatbl);
 
-	memset(area, 0, sizeof(area_t));
+	area->begining = begining;
 
 	/* Here is a little bug (in gcc?) - if this line is moved after switch block,
 	 * checksum is calculated in a strange way */
@@ -66,8 +498,8 @@ area_t *area_new(pm_type_t type, uint32_t pages)/*{{{*/
 			break;
 	}
 
-	DEBUG("Created memory area at $%.8x [$%.8x; %u; $%.2x]\n", (uint32_t)area,
-			(uint32_t)area_begining(area), area->size, area->flags0);
+	DEBUG("Created memory area at %p [%p; %zu; $%.2x]\n", (void *)area,
+			(void *)area_begining(area), area->size, area->flags0);
 
 	area_touch(area);
 
@@ -91,12 +523,14 @@ bool area_delete(area_t *area)/*{{{*/
 	I(area_is_mmap(area));
 
 	if (pm_mmap_free(area_begining(area), SIZE_IN_PAGES(area->size))) {
-		DEBUG("Removed area at $%.8x\n", (uint32_t)area);
+		DEBUG("Removed area at %p\n", (void *)area);
+
+		rectbl_free(&areatbl, area);
 
 		return TRUE;
 	}
 
-	DEBUG("Cannot remove area at $%.8x\n", (uint32_t)area);
+	DEBUG("Cannot remove area at %p\n", (void *)area);
 
 	return FALSE;
 }/*}}}*/
@@ -118,9 +552,7 @@ void arealst_init(arealst_t *arealst)/*{{{*/
 	area_touch((area_t *)arealst);
 
 	/* Initialize locking mechanizm */
-	pthread_rwlockattr_init(&arealst->lock_attr);
-	pthread_rwlockattr_setpshared(&arealst->lock_attr, 1);
-	pthread_rwlock_init(&arealst->lock, &arealst->lock_attr);
+	lock_init(&arealst->lock);
 }/*}}}*/
 
 /**
@@ -133,8 +565,8 @@ void arealst_init(arealst_t *arealst)/*{{{*/
 
 void arealst_global_add_area(arealst_t *arealst, area_t *newarea, locking_t locking)/*{{{*/
 {
-	DEBUG("Will add area at $%.8x to global list at $%.8x %s locking\n",
-			(uint32_t)newarea, (uint32_t)arealst, locking ? "with" : "without");
+	DEBUG("Will add area at %p to global list at %p %s locking\n",
+			(void *)newarea, (void *)arealst, locking ? "with" : "without");
 
 	if (locking)
 		arealst_wrlock(arealst);
@@ -142,23 +574,20 @@ void arealst_global_add_area(arealst_t *arealst, area_t *newarea, locking_t lock
 	area_valid(newarea);
 	I(area_is_global_guard((area_t *)arealst));
 
-	/* search the list for place where new area will be placed */
-	area_t *after = (area_t *)arealst;
+	/* new area will be placed after the one with closest earlier address */
+	area_t *after = areaidx_find(arealst->index, area_begining(newarea));
 
-	/* iterate till successor exists and has earlier address */
-	while (TRUE) {
-		area_valid(after);
+	if (after == NULL)
+		after = (area_t *)arealst;
 
-		if (area_is_global_guard(after->global.next))
-			break;
-		
-		if (area_begining(newarea) < area_begining(after->global.next))
-			break;
+	area_valid(after);
+	area_valid(after->global.next);
 
-		after = after->global.next;
-	}
+	I(area_is_global_guard(after->global.next) || (area_begining(newarea) < area_begining(after->global.next)));
 
-	DEBUG("Will insert after $%.8x at $%.8x\n", (uint32_t)after, (uint32_t)area_begining(after));
+	areaidx_insert(arealst, newarea);
+
+	DEBUG("Will insert after %p at %p\n", (void *)after, (void *)area_begining(after));
 
 	newarea->global.next = after->global.next;
 	newarea->global.prev = after;
@@ -171,6 +600,9 @@ void arealst_global_add_area(arealst_t *arealst, area_t *newarea, locking_t lock
 	area_touch(newarea->global.next);
 	area_touch(newarea);
 
+	/* Make pages of the area point to it */
+	pagemap_set(area_begining(newarea), SIZE_IN_PAGES(newarea->size), newarea);
+
 	/* Increment area counter */
 	arealst->areacnt++;
 
@@ -189,8 +621,8 @@ void arealst_global_add_area(arealst_t *arealst, area_t *newarea, locking_t lock
 
 void arealst_global_remove_area(arealst_t *arealst, area_t *area, locking_t locking)/*{{{*/
 {
-	DEBUG("Will remove area at $%.8x from global list at $%.8x %s locking\n",
-			(uint32_t)area, (uint32_t)arealst, locking ? "with" : "without");
+	DEBUG("Will remove area at %p from global list at %p %s locking\n",
+			(void *)area, (void *)arealst, locking ? "with" : "without");
 
 	if (locking)
 		arealst_wrlock(arealst);
@@ -207,10 +639,15 @@ void arealst_global_remove_area(arealst_t *arealst, area_t *area, locking_t lock
 	area_touch(area->global.prev);
 	area_touch(area->global.next);
 
+	areaidx_remove(arealst, area_begining(area));
+
 	/* clear pointers in block being pulled out */
 	area->global.next = NULL;
 	area->global.prev = NULL;
 
+	/* Remove pages of the area from page map */
+	pagemap_set(area_begining(area), SIZE_IN_PAGES(area->size), NULL);
+
 	/* Decrement area counter */
 	arealst->areacnt--;
 
@@ -220,6 +657,33 @@ void arealst_global_remove_area(arealst_t *arealst, area_t *area, locking_t lock
 		arealst_unlock(arealst);
 }/*}}}*/
 
+/**
+ * Finds an area on global list which covers given address.
+ *
+ * @param arealst	global list of areas
+ * @param addr
+ * @param locking
+ * @return			the area or NULL if address is not managed
+ */
+
+area_t *arealst_global_find_area(arealst_t *arealst, void *addr, locking_t locking)/*{{{*/
+{
+	if (locking)
+		arealst_rdlock(arealst);
+
+	I(area_is_global_guard((area_t *)arealst));
+
+	area_t *area = areaidx_find(arealst->index, addr);
+
+	if ((area != NULL) && (addr >= area_end(area)))
+		area = NULL;
+
+	if (locking)
+		arealst_unlock(arealst);
+
+	return area;
+}/*}}}*/
+
 /**
  * Checks if given area belongs to the list.
  *
@@ -302,7 +766,7 @@ area_t *arealst_find_area_by_addr(arealst_t *arealst, void *addr, locking_t lock
  * @return
  */
 
-area_t *arealst_find_area_by_size(arealst_t *arealst, uint32_t size, locking_t locking)/*{{{*/
+area_t *arealst_find_area_by_size(arealst_t *arealst, size_t size, locking_t locking)/*{{{*/
 {
 	if (locking)
 		arealst_rdlock(arealst);
@@ -373,9 +837,9 @@ void arealst_insert_area(arealst_t *arealst, area_t *after, area_t *newarea, loc
 
 void arealst_insert_area_by_addr(arealst_t *arealst, area_t *newarea, locking_t locking)/*{{{*/
 {
-	DEBUG("Will insert area at $%.8x [$%.8x; %u; $%.2x] to list at $%.8x %s locking\n",
-			(uint32_t)newarea, (uint32_t)area_begining(newarea), newarea->size, newarea->flags0,
-			(uint32_t)arealst, locking ? "with" : "without");
+	DEBUG("Will insert area at %p [%p; %zu; $%.2x] to list at %p %s locking\n",
+			(void *)newarea, (void *)area_begining(newarea), newarea->size, newarea->flags0,
+			(void *)arealst, locking ? "with" : "without");
 
 	if (locking)
 		arealst_wrlock(arealst);
@@ -394,7 +858,7 @@ void arealst_insert_area_by_addr(arealst_t *arealst, area_t *newarea, locking_t
 		after = after->local.next;
 	}
 
-	DEBUG("Will insert after $%.8x at $%.8x\n", (uint32_t)after, (uint32_t)area_begining(after));
+	DEBUG("Will insert after %p at %p\n", (void *)after, (void *)area_begining(after));
 
 	arealst_insert_area(arealst, after, newarea, DONTLOCK);
 
@@ -413,8 +877,8 @@ void arealst_insert_area_by_addr(arealst_t *arealst, area_t *newarea, locking_t
 
 void arealst_insert_area_by_size(arealst_t *arealst, area_t *newarea, locking_t locking)/*{{{*/
 {
-	DEBUG("Will insert area at $%.8x to list at $%.8x %s locking\n",
-			(uint32_t)newarea, (uint32_t)arealst, locking ? "with" : "without");
+	DEBUG("Will insert area at %p to list at %p %s locking\n",
+			(void *)newarea, (void *)arealst, locking ? "with" : "without");
 
 	if (locking)
 		arealst_wrlock(arealst);
@@ -451,8 +915,8 @@ void arealst_insert_area_by_size(arealst_t *arealst, area_t *newarea, locking_t
 
 void arealst_remove_area(arealst_t *arealst, area_t *area, locking_t locking)/*{{{*/
 {
-	DEBUG("Will remove area at $%.8x from list at $%.8x %s locking\n",
-			(uint32_t)area, (uint32_t)arealst, locking ? "with" : "without");
+	DEBUG("Will remove area at %p from list at %p %s locking\n",
+			(void *)area, (void *)arealst, locking ? "with" : "without");
 
 	if (locking)
 		arealst_wrlock(arealst);
@@ -507,7 +971,12 @@ area_t *arealst_join_area(arealst_t *global, area_t *first, area_t *second, lock
 
 	I(area_end(first) == area_begining(second));
 
+	/* Key of first area will refer to joined area */
+	areaidx_remove(global, area_begining(second));
+	areaidx_set(global, area_begining(first), second);
+
 	/* Sum sizes */
+	second->begining = first->begining;
 	second->size += first->size;
 
 	/* Remove first area from global list */
@@ -527,8 +996,11 @@ area_t *arealst_join_area(arealst_t *global, area_t *first, area_t *second, lock
 		second->local.next->local.prev = second;
 	}
 
+	/* Pages of first area belong to second one now */
+	pagemap_set(area_begining(first), SIZE_IN_PAGES(first->size), second);
+
 	/* Invalidate removed area */
-	memset(first, 0, sizeof(area_t));
+	rectbl_free(&areatbl, first);
 
 	global->areacnt--;
 
@@ -561,20 +1033,20 @@ void arealst_split_area(arealst_t *global, area_t **splitted, area_t **remainder
 	area_valid(area);
 	I(area_is_used(area));
 
-	DEBUG("Will split area [$%.8x; %u; $%.2x] at $%.8x with cut point at $%.8x\n",
-		  (uint32_t)area, area->size, area->flags0, (uint32_t)area_begining(area),
-		  (uint32_t)area_begining(area) + pages * PAGE_SIZE);
+	DEBUG("Will split area [%p; %zu; $%.2x] at %p with cut point at %p\n",
+		  (void *)area, area->size, area->flags0, (void *)area_begining(area),
+		  (void *)area_begining(area) + pages * PAGE_SIZE);
 
 	I(pages * PAGE_SIZE < area->size);
 
 	/* Now split point is inside area */
-	area_t *newarea = area_footer(area_begining(area), pages);
-
-	memset(newarea, 0, sizeof(area_t));
+	area_t *newarea = rectbl_alloc(&areatbl);
 
 	/* set up new area */
+	newarea->begining = area->begining;
 	newarea->size	= pages * PAGE_SIZE;
 	newarea->flags0	= area->flags0;
+	newarea->cpu	= area->cpu;
 
 	newarea->global.next = area;
 	newarea->global.prev = area->global.prev;
@@ -588,6 +1060,7 @@ void arealst_split_area(arealst_t *global, area_t **splitted, area_t **remainder
 	}
 
 	/* correct data in splitted area */
+	area->begining = area->begining + pages * PAGE_SIZE;
 	area->size = area->size - pages * PAGE_SIZE;
 	area->global.prev = newarea;
 
@@ -597,19 +1070,26 @@ void arealst_split_area(arealst_t *global, area_t **splitted, area_t **remainder
 	/* correct data in predecessor */
 	newarea->global.prev->global.next = newarea;
 
+	/* lower part takes key of splitted area, remainder gets a new one */
+	areaidx_set(global, area_begining(newarea), newarea);
+	areaidx_insert(global, area);
+
 	area_touch(newarea);
 	area_touch(area);
 
+	/* Cut off pages belong to new area */
+	pagemap_set(area_begining(newarea), pages, newarea);
+
 	global->areacnt++;
 
-	DEBUG("Area splitted to [$%.8x; %u; $%.2x] at $%.8x and [$%.8x; %u; $%.2x] at $%.8x\n",
-		  (uint32_t)newarea, newarea->size, newarea->flags0, (uint32_t)area_begining(newarea),
-		  (uint32_t)area, area->size, area->flags0, (uint32_t)area_begining(area));
+	DEBUG("Area splitted to [%p; %zu; $%.2x] at %p and [%p; %zu; $%.2x] at %p\n",
+		  (void *)newarea, newarea->size, newarea->flags0, (void *)area_begining(newarea),
+		  (void *)area, area->size, area->flags0, (void *)area_begining(area));
 
 	*splitted  = newarea;
 	*remainder = area;
 
-	I(*splitted < *remainder);
+	I(area_begining(*splitted) < area_begining(*remainder));
 
 	if (locking)
 		arealst_unlock(global);
@@ -637,19 +1117,19 @@ static area_t *arealst_pullout_area(arealst_t *arealst, area_t *addr, uint32_t p
 
 	if (arealst->areacnt > 0) {
 		if (addr != NULL) {
-			DEBUG("Seeking area of size %u pages at %.8x in list at %.8x\n",
-				  pages, (uint32_t)addr, (uint32_t)arealst);
+			DEBUG("Seeking area of size %u pages at %p in list at %p\n",
+				  pages, (void *)addr, (void *)arealst);
 
 			area = (arealst_has_area(arealst, addr, DONTLOCK) && (addr->size >= pages * PAGE_SIZE)) ? addr : NULL;
 		} else {
-			DEBUG("Seeking area of size %u pages in list at %.8x\n", pages, (uint32_t)arealst);
+			DEBUG("Seeking area of size %u pages in list at %p\n", pages, (void *)arealst);
 
 			area = arealst_find_area_by_size(arealst, pages * PAGE_SIZE, DONTLOCK);
 		}
 
 		if (area != NULL) {
-			DEBUG("Area found [$%.8x, %u, $%.2x] at $%.8x\n",
-					(uint32_t)area, area->size, area->flags0, (uint32_t)area_begining(area));
+			DEBUG("Area found [%p, %zu, $%.2x] at %p\n",
+					(void *)area, area->size, area->flags0, (void *)area_begining(area));
 
 			arealst_remove_area(arealst, area, DONTLOCK);
 		}
@@ -662,21 +1142,183 @@ static area_t *arealst_pullout_area(arealst_t *arealst, area_t *addr, uint32_t p
 }/*}}}*/
 
 /**
- * Takes an area and use its begining as space for area manager.
+ * Pulls out area from free list of areas of <i>n+1</i> pages and keeps bitmap
+ * of nonempty lists up to date.
  *
- * @param area
+ * @param areamgr
+ * @param n
+ * @param addr
+ * @param pages
  * @return
  */
 
-areamgr_t *areamgr_init(area_t *area)/*{{{*/
+static area_t *areamgr_pullout_from_list(areamgr_t *areamgr, uint32_t n, area_t *addr, uint32_t pages)/*{{{*/
 {
-	DEBUG("Using area at $%.8x [$%.8x; %u; $%.2x]\n", (uint32_t)area,
-			(uint32_t)area_begining(area), area->size, area->flags0);
+	arealst_t *arealst = &areamgr->list[n];
 
-	area_valid(area);
+	arealst_wrlock(arealst);
+
+	area_t *area = arealst_pullout_area(arealst, addr, pages, DONTLOCK);
+
+	if ((area != NULL) && (arealst->areacnt == 0))
+		__sync_fetch_and_and(&areamgr->bitmap, ~(1ULL << n));
+
+	arealst_unlock(arealst);
+
+	return area;
+}/*}}}*/
+
+/**
+ * Pulls out area from tree of large free areas. If <i>addr</i> is not null
+ * then that area is taken, otherwise the smallest area of at least
+ * <i>pages</i> size (with the lowest address amongst equal ones).
+ *
+ * @param areamgr
+ * @param addr
+ * @param pages
+ * @return
+ */
+
+static area_t *areamgr_pullout_from_tree(areamgr_t *areamgr, area_t *addr, uint32_t pages)/*{{{*/
+{
+	areatree_t *tree = &areamgr->tree;
+
+	areatree_wrlock(tree);
+
+	area_t *area = NULL;
+
+	if (tree->areacnt > 0) {
+		if (addr != NULL) {
+			DEBUG("Seeking area of size %u pages at %p in tree\n", pages, (void *)addr);
+
+			area = (areatree_search(tree, area_key(addr)) == addr) ? addr : NULL;
+		} else {
+			DEBUG("Seeking area of size %u pages in tree\n", pages);
+
+			area = areatree_lower_bound(tree, (area_key_t){ pages * PAGE_SIZE, NULL });
+		}
+
+		if (area != NULL) {
+			DEBUG("Area found [%p, %zu, $%.2x] at %p\n",
+					(void *)area, area->size, area->flags0, (void *)area_begining(area));
+
+			areatree_remove(tree, area);
+			tree->areacnt--;
+		}
+	}
+
+	areatree_unlock(tree);
+
+	return area;
+}/*}}}*/
+
+/**
+ * Pulls out a free area of at least <i>pages</i> size. If <i>addr</i> is not
+ * null then returned area will have that address.
+ *
+ * @param areamgr
+ * @param addr
+ * @param pages
+ * @return
+ */
+
+static area_t *areamgr_pullout_free_area(areamgr_t *areamgr, area_t *addr, uint32_t pages)/*{{{*/
+{
+	I(pages > 0);
+
+	area_t *area = NULL;
+
+	if (addr != NULL) {
+		uint32_t n = SIZE_IN_PAGES(addr->size);
+
+		if (addr->size < pages * PAGE_SIZE)
+			return NULL;
+
+		if (n <= AREAMGR_LIST_COUNT)
+			area = areamgr_pullout_from_list(areamgr, n - 1, addr, pages);
+		else
+			area = areamgr_pullout_from_tree(areamgr, addr, pages);
+	} else {
+		if (pages <= AREAMGR_LIST_COUNT) {
+			/* browse through nonempty lists of big enough areas */
+			uint64_t bitmap = areamgr->bitmap & ~((1ULL << (pages - 1)) - 1);
+
+			while ((area == NULL) && (bitmap != 0)) {
+				uint32_t n = __builtin_ctzll(bitmap);
+
+				area = areamgr_pullout_from_list(areamgr, n, NULL, pages);
+
+				bitmap &= ~(1ULL << n);
+			}
+		}
+
+		if (area == NULL)
+			area = areamgr_pullout_from_tree(areamgr, NULL, pages);
+	}
+
+	return area;
+}/*}}}*/
+
+/**
+ * Inserts free area onto list of areas of the same size or into tree of large
+ * areas.
+ *
+ * @param areamgr
+ * @param area
+ */
+
+static void areamgr_insert_free_area(areamgr_t *areamgr, area_t *area)/*{{{*/
+{
+	uint32_t n = SIZE_IN_PAGES(area->size);
+
+	if (n <= AREAMGR_LIST_COUNT) {
+		arealst_t *arealst = &areamgr->list[n - 1];
+
+		arealst_wrlock(arealst);
+		arealst_insert_area(arealst, (area_t *)arealst, area, DONTLOCK);
+		__sync_fetch_and_or(&areamgr->bitmap, 1ULL << (n - 1));
+		arealst_unlock(arealst);
+	} else {
+		areatree_t *tree = &areamgr->tree;
+
+		areatree_wrlock(tree);
+		areatree_insert(tree, area);
+		tree->areacnt++;
+		areatree_unlock(tree);
+	}
+}/*}}}*/
+
+/**
+ * Coarse monotonic clock used to measure windows of page-return policy.
+ *
+ * @return		time in miliseconds
+ */
+
+static inline uint32_t areamgr_clock()/*{{{*/
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+	return now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}/*}}}*/
+
+/**
+ * Takes an area and use its begining as space for area manager.
+ *
+ * @param area
+ * @return
+ */
+
+areamgr_t *areamgr_init(area_t *area)/*{{{*/
+{
+	DEBUG("Using area at %p [%p; %zu; $%.2x]\n", (void *)area,
+			(void *)area_begining(area), area->size, area->flags0);
+
+	area_valid(area);
 
 	/* Check if area has enough space to hold area manager's structure */
-	I(area->size - sizeof(area_t) >= sizeof(areamgr_t));
+	I(area->size >= sizeof(areamgr_t));
 
 	areamgr_t *areamgr = area_begining(area);
 
@@ -686,6 +1328,13 @@ areamgr_t *areamgr_init(area_t *area)/*{{{*/
 	for (i = 0; i < AREAMGR_LIST_COUNT; i++)
 		arealst_init(&areamgr->list[i]);
 
+	areamgr->bitmap = 0;
+
+	/* Initialize tree of large free areas */
+	areatree_init(&areamgr->tree);
+
+	areamgr->tree.areacnt = 0;
+
 	/* Initialize global list */
 	arealst_init(&areamgr->global);
 
@@ -697,7 +1346,25 @@ areamgr_t *areamgr_init(area_t *area)/*{{{*/
 
 	areamgr->pagecnt = 0; /* SIZE_IN_PAGES(area->size); */
 
-	DEBUG("Created area manager at $%.8x\n", (uint32_t)areamgr);
+	/* Initialize page-return policy */
+	areamgr->window   = areamgr_clock();
+	areamgr->acquired = 0;
+	areamgr->inflow   = 0;
+	areamgr->outflow  = 0;
+	areamgr->keep     = AREAMGR_KEEP_MIN;
+	areamgr->limit    = 2 * AREAMGR_KEEP_MIN;
+	areamgr->growing  = FALSE;
+	areamgr->unmapcnt = 0;
+	areamgr->purgecnt = 0;
+
+	/* Scavenger is not started by default */
+	pthread_mutex_init(&areamgr->scavenger_lock, NULL);
+	pthread_cond_init(&areamgr->scavenger_wakeup, NULL);
+	areamgr->scavenger_pending = 0;
+
+	areamgr->scavenging = FALSE;
+
+	DEBUG("Created area manager at %p\n", (void *)areamgr);
 
 	return areamgr;
 }/*}}}*/
@@ -714,14 +1381,14 @@ void areamgr_add_area(areamgr_t *areamgr, area_t *newarea)/*{{{*/
 {
 	area_valid(newarea);
 
-	DEBUG("Will add area [$%.8x; %u; $%.2x] to memory manager\n", (uint32_t)newarea, newarea->size, newarea->flags0);
+	DEBUG("Will add area [%p; %zu; $%.2x] to memory manager\n", (void *)newarea, newarea->size, newarea->flags0);
 
 	/* FIRST STEP: Insert onto all areas' list. */
 	{
 		arealst_wrlock(&areamgr->global);
 
 		arealst_global_add_area(&areamgr->global, newarea, DONTLOCK);
-		areamgr->pagecnt += SIZE_IN_PAGES(newarea->size);
+		__sync_fetch_and_add(&areamgr->pagecnt, SIZE_IN_PAGES(newarea->size));
 
 		arealst_unlock(&areamgr->global);
 	}
@@ -747,14 +1414,14 @@ void areamgr_remove_area(areamgr_t *areamgr, area_t *area)/*{{{*/
 	I(!area_is_guard(area));
 	I(area_is_used(area));
 
-	DEBUG("Remove area [$%.8x, %u, $%.2x] from the global list\n", (uint32_t)area, area->size, area->flags0);
+	DEBUG("Remove area [%p, %zu, $%.2x] from the global list\n", (void *)area, area->size, area->flags0);
 
 	/* Remove it! */
 	{
 		arealst_wrlock(&areamgr->global);
 
 		arealst_global_remove_area(&areamgr->global, area, DONTLOCK);
-		areamgr->pagecnt -= SIZE_IN_PAGES(area->size);
+		__sync_fetch_and_sub(&areamgr->pagecnt, SIZE_IN_PAGES(area->size));
 
 		arealst_unlock(&areamgr->global);
 	}
@@ -776,9 +1443,9 @@ void areamgr_remove_area(areamgr_t *areamgr, area_t *area)/*{{{*/
 
 area_t *areamgr_alloc_adjacent_area(areamgr_t *areamgr, area_t *addr, uint32_t pages, direction_t side)/*{{{*/
 {
-	DEBUG("Seeking area of size %u pages %s-adjacent to area [$%.8x, %u, $%.2x] at %.8x\n",
+	DEBUG("Seeking area of size %u pages %s-adjacent to area [%p, %zu, $%.2x] at %p\n",
 		  pages, (side == LEFT) ? "left" : "right",
-		  (uint32_t)addr, addr->size, addr->flags0, (uint32_t)area_begining(addr));
+		  (void *)addr, addr->size, addr->flags0, (void *)area_begining(addr));
 
 	I((side == LEFT) || (side == RIGHT));
 	I(pages > 0);
@@ -804,29 +1471,28 @@ area_t *areamgr_alloc_adjacent_area(areamgr_t *areamgr, area_t *addr, uint32_t p
 		}
 
 		if (alloc) {
-			uint32_t n = SIZE_IN_PAGES(area->size) - 1;
-
-			if (n > AREAMGR_LIST_COUNT - 1)
-				n = AREAMGR_LIST_COUNT - 1;
-
-			DEBUG("Area found [$%.8x, %u, $%.2x] at $%.8x\n",
-					(uint32_t)area, area->size, area->flags0, (uint32_t)area_begining(area));
+			DEBUG("Area found [%p, %zu, $%.2x] at %p\n",
+					(void *)area, area->size, area->flags0, (void *)area_begining(area));
 
-			area = arealst_pullout_area(&areamgr->list[n], area, pages, LOCK);
+			area = areamgr_pullout_free_area(areamgr, area, pages);
 		} else {
 			area = NULL;
 		}
 
+		if (area != NULL) {
+			__sync_fetch_and_sub(&areamgr->freecnt, SIZE_IN_PAGES(area->size));
+			area->used = TRUE;
+			area_touch(area);
+		}
+
 		arealst_unlock(&areamgr->global);
 	} while (alloc && area == NULL);
 
 	if (area != NULL) {
-		areamgr->freecnt -= SIZE_IN_PAGES(area->size);
-		area->used = TRUE;
-		area_touch(area);
+		__sync_fetch_and_add(&areamgr->inflow, SIZE_IN_PAGES(area->size));
 
-		DEBUG("Found area [$%.8x, %u, $%.2x] at $%.8x\n",
-				(uint32_t)area, area->size, area->flags0, (uint32_t)area_begining(area));
+		DEBUG("Found area [%p, %zu, $%.2x] at %p\n",
+				(void *)area, area->size, area->flags0, (void *)area_begining(area));
 	} else {
 		DEBUG("Area not found!\n");
 	}
@@ -850,29 +1516,21 @@ area_t *areamgr_alloc_area(areamgr_t *areamgr, uint32_t pages)/*{{{*/
 
 	I(pages > 0);
 
-	int32_t n = pages - 1;
-
-	if (n > AREAMGR_LIST_COUNT - 1)
-		n = AREAMGR_LIST_COUNT - 1;
-
-	/* browse through lists till proper area is not found */
-	area_t *area = NULL;
-
-	while (n < AREAMGR_LIST_COUNT) {
-		if ((area = arealst_pullout_area(&areamgr->list[n], NULL, pages, LOCK)))
-			break;
-
-		n++;
-	}
+	/* find best fitting free area */
+	area_t *area = areamgr_pullout_free_area(areamgr, NULL, pages);
 
 	/* If area was found then reserve it */
 	if (area != NULL) {
-		areamgr->freecnt -= SIZE_IN_PAGES(area->size);
+		arealst_rdlock(&areamgr->global);
+
+		__sync_fetch_and_sub(&areamgr->freecnt, SIZE_IN_PAGES(area->size));
 		area->used = TRUE;
 		area_touch(area);
 
-		DEBUG("Found area [$%.8x, %u, $%.2x] at $%.8x\n",
-				(uint32_t)area, area->size, area->flags0, (uint32_t)area_begining(area));
+		arealst_unlock(&areamgr->global);
+
+		DEBUG("Found area [%p, %zu, $%.2x] at %p\n",
+				(void *)area, area->size, area->flags0, (void *)area_begining(area));
 
 		/* If area is too big it should be shrinked */
 		if (area->size > pages * PAGE_SIZE)
@@ -881,11 +1539,77 @@ area_t *areamgr_alloc_area(areamgr_t *areamgr, uint32_t pages)/*{{{*/
 		DEBUG("Area not found - will create one!\n");
 
 		if ((area = area_new(PM_MMAP, pages))) {
-			arealst_global_add_area(&areamgr->global, area, LOCK);
-			areamgr->pagecnt += SIZE_IN_PAGES(area->size);
+			arealst_wrlock(&areamgr->global);
+
+			arealst_global_add_area(&areamgr->global, area, DONTLOCK);
+			__sync_fetch_and_add(&areamgr->pagecnt, SIZE_IN_PAGES(area->size));
+
+			arealst_unlock(&areamgr->global);
+
+			__sync_fetch_and_add(&areamgr->acquired, pages);
 		}
 	}
 
+	if (area != NULL)
+		__sync_fetch_and_add(&areamgr->inflow, pages);
+
+	return area;
+}/*}}}*/
+
+/**
+ * Hands allocated area over to a sub-allocator. Owner of the area is covered
+ * by its checksum, which is verified with global list locked, so it must not
+ * be changed behind the lock.
+ *
+ * @param areamgr
+ * @param area
+ * @param manager
+ * @param cpu
+ * @param ready
+ */
+
+void areamgr_assign_area(areamgr_t *areamgr, area_t *area, uint8_t manager, uint8_t cpu, bool ready)/*{{{*/
+{
+	I(area_is_used(area));
+
+	arealst_wrlock(&areamgr->global);
+
+	area->manager = manager;
+	area->cpu	  = cpu;
+	area->ready	  = ready;
+	area_touch(area);
+
+	arealst_unlock(&areamgr->global);
+}/*}}}*/
+
+/**
+ * Finds an area that contains given address. Page map is consulted without
+ * locking first. The result is validated and if it's stale (area was split or
+ * joined meanwhile) the lookup is repeated with global list locked.
+ *
+ * @param areamgr
+ * @param addr
+ * @return
+ */
+
+area_t *areamgr_find_area(areamgr_t *areamgr, void *addr)/*{{{*/
+{
+	area_t *area = pagemap_get(addr);
+
+	if ((area != NULL) && (area_begining(area) <= addr) && (addr < area_end(area)))
+		return area;
+
+	DEBUG("Page map entry for %p is stale - will look up again with locking\n", (void *)addr);
+
+	arealst_rdlock(&areamgr->global);
+
+	area = pagemap_get(addr);
+
+	if ((area != NULL) && !((area_begining(area) <= addr) && (addr < area_end(area))))
+		area = NULL;
+
+	arealst_unlock(&areamgr->global);
+
 	return area;
 }/*}}}*/
 
@@ -902,36 +1626,81 @@ bool areamgr_prealloc_area(areamgr_t *areamgr, uint32_t pages)/*{{{*/
 	if (areamgr->freecnt == 0) {
 		DEBUG("Will prealloc area of size %u pages.\n", pages);
 
-		if ((newarea = area_new(PM_MMAP, pages)))
+		if ((newarea = area_new(PM_MMAP, pages))) {
 			arealst_global_add_area(&areamgr->global, newarea, DONTLOCK);
 
-		areamgr->freecnt += SIZE_IN_PAGES(newarea->size);
-		areamgr->pagecnt += SIZE_IN_PAGES(newarea->size);
-		newarea->used = FALSE;
-		area_touch(newarea);
+			__sync_fetch_and_add(&areamgr->freecnt, SIZE_IN_PAGES(newarea->size));
+			__sync_fetch_and_add(&areamgr->pagecnt, SIZE_IN_PAGES(newarea->size));
+			newarea->used = FALSE;
+			area_touch(newarea);
+
+			__sync_fetch_and_add(&areamgr->acquired, pages);
+		}
 	}
 
 	arealst_unlock(&areamgr->global);
 
-	if (newarea != NULL) {
-		/* qualify area for insertion into proper free-list */
-		int n = SIZE_IN_PAGES(newarea->size) - 1;
+	if (newarea != NULL)
+		areamgr_insert_free_area(areamgr, newarea);
+
+	return (newarea != NULL);
+}/*}}}*/
+
+/**
+ * Marks used area as free, coalesces it with free neighbours and inserts it
+ * into free lists or tree.
+ *
+ * @param areamgr
+ * @param newarea
+ * @param purged	have pages of the area been purged already ?
+ */
+
+static void areamgr_release_area(areamgr_t *areamgr, area_t *newarea, bool purged)/*{{{*/
+{
+	I(area_is_used(newarea));
 
-		if (n >= AREAMGR_LIST_COUNT - 1)
-			n = AREAMGR_LIST_COUNT - 1;
+	area_t *prev = areamgr_alloc_adjacent_area(areamgr, newarea, 1, LEFT);
+	area_t *next = areamgr_alloc_adjacent_area(areamgr, newarea, 1, RIGHT);
 
-		/* insert area on proper free list */
-		arealst_insert_area_by_size(&areamgr->list[n], newarea, LOCK);
+	arealst_wrlock(&areamgr->global);
+
+	if (prev != NULL) {
+		DEBUG("Coalescing with left neighbour [%p; $%zx; $%.2x]\n",
+				(void *)prev, prev->size, prev->flags0);
+
+		newarea = arealst_join_area(&areamgr->global, prev, newarea, DONTLOCK);
+
+		DEBUG("Coalesced into area [%p; $%zx; $%.2x]\n", (void *)newarea, newarea->size, newarea->flags0);
 	}
 
-	return (newarea != NULL);
+	if (next != NULL) {
+		DEBUG("Coalescing with right neighbour [%p; $%zx; $%.2x]\n",
+				(void *)next, next->size, next->flags0);
+
+		newarea = arealst_join_area(&areamgr->global, newarea, next, DONTLOCK);
+
+		DEBUG("Coalesced into area [%p; $%zx; $%.2x]\n", (void *)newarea, newarea->size, newarea->flags0);
+	}
+
+	/* neighbours could have been resident */
+	newarea->purged = purged && (prev == NULL) && (next == NULL);
+
+	newarea->used = FALSE;
+	newarea->manager = AREA_MGR_UNMANAGED;
+	newarea->cpu = 0;
+	area_touch(newarea);
+
+	__sync_fetch_and_add(&areamgr->freecnt, SIZE_IN_PAGES(newarea->size));
+
+	arealst_unlock(&areamgr->global);
+
+	/* insert area on proper free list or into the tree */
+	areamgr_insert_free_area(areamgr, newarea);
 }/*}}}*/
 
 /**
- * Frees memory area for use by area manager.
- *
- * Idea for caller: After freeing some pages a threshold (unused pages count)
- * can be exceeded triggering a few pages being returned to the OS.
+ * Frees memory area for use by area manager. Its pages are given back to the
+ * OS later, when page-return policy is evaluated at the end of a window.
  *
  * @param areamgr
  * @param newarea
@@ -939,53 +1708,330 @@ bool areamgr_prealloc_area(areamgr_t *areamgr, uint32_t pages)/*{{{*/
 
 void areamgr_free_area(areamgr_t *areamgr, area_t *newarea)/*{{{*/
 {
-	DEBUG("Will try to free area [$%.8x, %u, $%.2x] at $%.8x\n",
-			(uint32_t)newarea, newarea->size, newarea->flags0, (uint32_t)area_begining(newarea));
+	DEBUG("Will try to free area [%p, %zu, $%.2x] at %p\n",
+			(void *)newarea, newarea->size, newarea->flags0, (void *)area_begining(newarea));
 
 	I(area_is_used(newarea));
 
-	/* mark area as free */
-	{
-		area_t *prev = areamgr_alloc_adjacent_area(areamgr, newarea, 1, LEFT);
-		area_t *next = areamgr_alloc_adjacent_area(areamgr, newarea, 1, RIGHT);
+	__sync_fetch_and_add(&areamgr->outflow, SIZE_IN_PAGES(newarea->size));
 
-		arealst_wrlock(&areamgr->global);
+	areamgr_release_area(areamgr, newarea, FALSE);
+}/*}}}*/
+
+/**
+ * Closes the window of page-return policy if it has elapsed and adjusts the
+ * number of free pages to keep.
+ *
+ * @param areamgr
+ * @return			TRUE if the window was closed by this call
+ */
+
+static bool areamgr_adapt(areamgr_t *areamgr)/*{{{*/
+{
+	uint32_t now   = areamgr_clock();
+	uint32_t start = areamgr->window;
+
+	if ((now - start < AREAMGR_WINDOW_MS) || !__sync_bool_compare_and_swap(&areamgr->window, start, now))
+		return FALSE;
+
+	uint32_t acquired = __sync_lock_test_and_set(&areamgr->acquired, 0);
+	uint32_t inflow   = __sync_lock_test_and_set(&areamgr->inflow, 0);
+	uint32_t outflow  = __sync_lock_test_and_set(&areamgr->outflow, 0);
+
+	uint32_t keep = areamgr->keep;
+	uint32_t limit;
+
+	if ((acquired > 0) || (inflow > outflow)) {
+		/* hold pages that were needed recently */
+		if (keep < areamgr->freecnt)
+			keep = areamgr->freecnt;
+
+		keep += acquired;
+
+		if (keep > AREAMGR_KEEP_MAX)
+			keep = AREAMGR_KEEP_MAX;
+
+		limit = 2 * keep;
+
+		areamgr->growing = TRUE;
+	} else if (outflow > inflow) {
+		keep  = (keep / 2 > AREAMGR_KEEP_MIN) ? (keep / 2) : AREAMGR_KEEP_MIN;
+		limit = keep;
+
+		areamgr->growing = FALSE;
+	} else {
+		limit = 2 * keep;
+
+		areamgr->growing = FALSE;
+	}
+
+	DEBUG("Window closed: acquired %u, handed out %u, returned %u pages - will keep %u free pages%s\n",
+		  acquired, inflow, outflow, keep, areamgr->growing ? " (growing)" : "");
+
+	areamgr->keep  = keep;
+	areamgr->limit = limit;
+
+	return TRUE;
+}/*}}}*/
+
+/**
+ * Gives back free areas to the OS, the largest ones first, until number of
+ * free pages drops below limit set by page-return policy.
+ *
+ * @param areamgr
+ * @return			number of unmapped pages
+ */
+
+static uint32_t areamgr_unmap(areamgr_t *areamgr)/*{{{*/
+{
+	uint32_t unmapped = 0;
+
+	while (areamgr->freecnt > areamgr->limit) {
+		arealst_rdlock(&areamgr->global);
+
+		area_t *area = NULL;
 
-		if (prev != NULL) {
-			DEBUG("Coalescing with left neighbour [$%.8x; $%x; $%.2x]\n",
-					(uint32_t)prev, prev->size, prev->flags0);
+		/* take the largest area from the tree... */
+		if (areamgr->tree.areacnt > 0) {
+			areatree_wrlock(&areamgr->tree);
 
-			newarea = arealst_join_area(&areamgr->global, prev, newarea, DONTLOCK);
+			if ((area = areatree_last(&areamgr->tree))) {
+				areatree_remove(&areamgr->tree, area);
+				areamgr->tree.areacnt--;
+			}
 
-			DEBUG("Coalesced into area [$%.8x; $%x; $%.2x]\n", (uint32_t)newarea, newarea->size, newarea->flags0);
+			areatree_unlock(&areamgr->tree);
 		}
 
-		if (next != NULL) {
-			DEBUG("Coalescing with right neighbour [$%.8x; $%x; $%.2x]\n",
-					(uint32_t)next, next->size, next->flags0);
+		/* ...or from the list of the largest areas */
+		while ((area == NULL) && (areamgr->bitmap != 0)) {
+			uint32_t n = 63 - __builtin_clzll(areamgr->bitmap);
 
-			newarea = arealst_join_area(&areamgr->global, newarea, next, DONTLOCK);
+			area = areamgr_pullout_from_list(areamgr, n, NULL, 1);
+		}
+
+		if (area != NULL) {
+			area->used = TRUE;
+			area_touch(area);
 
-			DEBUG("Coalesced into area [$%.8x; $%x; $%.2x]\n", (uint32_t)newarea, newarea->size, newarea->flags0);
+			__sync_fetch_and_sub(&areamgr->freecnt, SIZE_IN_PAGES(area->size));
 		}
 
-		newarea->used = FALSE;
-		newarea->manager = AREA_MGR_UNMANAGED;
-		area_touch(newarea);
+		arealst_unlock(&areamgr->global);
+
+		if (area == NULL)
+			break;
+
+		unmapped += SIZE_IN_PAGES(area->size);
+
+		areamgr_remove_area(areamgr, area);
+
+		I(area_delete(area)); 
+	}
+
+	__sync_fetch_and_add(&areamgr->unmapcnt, unmapped);
+
+	return unmapped;
+}/*}}}*/
+
+/**
+ * Purges resident free areas. Walking in order of addresses the first areas
+ * of total size given by policy are left intact. Areas are taken out of free
+ * lists and tree for the time of purging, so they cannot be handed out
+ * meanwhile.
+ *
+ * @param areamgr
+ * @return			number of purged pages
+ */
+
+static uint32_t areamgr_purge(areamgr_t *areamgr)/*{{{*/
+{
+	area_t  *batch[AREAMGR_PURGE_BATCH];
+	uint32_t i, n, purged = 0;
+
+	do {
+		uint32_t resident = 0;
 
-		areamgr->freecnt += SIZE_IN_PAGES(newarea->size);
+		n = 0;
+
+		arealst_rdlock(&areamgr->global);
+
+		area_t *area = areamgr->global.global.next;
+
+		while (!area_is_global_guard(area) && (n < AREAMGR_PURGE_BATCH)) {
+			uint32_t pages = SIZE_IN_PAGES(area->size);
+
+			if (area_is_used(area) || area->purged || area_is_shm(area)) {
+				/* nothing to do */
+			} else if ((resident < areamgr->keep) || (pages < AREAMGR_PURGE_MIN)) {
+				resident += pages;
+			} else if (areamgr_pullout_free_area(areamgr, area, pages) != NULL) {
+				area->used = TRUE;
+				area_touch(area);
+
+				__sync_fetch_and_sub(&areamgr->freecnt, pages);
+
+				batch[n++] = area;
+			}
+
+			area = area->global.next;
+		}
 
 		arealst_unlock(&areamgr->global);
+
+		for (i = 0; i < n; i++) {
+			uint32_t pages = SIZE_IN_PAGES(batch[i]->size);
+
+			DEBUG("Purging area [%p, %zu, $%.2x] at %p\n",
+					(void *)batch[i], batch[i]->size, batch[i]->flags0, (void *)area_begining(batch[i]));
+
+			bool done = pm_mmap_purge(area_begining(batch[i]), pages);
+
+			if (done)
+				purged += pages;
+
+			areamgr_release_area(areamgr, batch[i], done);
+		}
+	} while (n == AREAMGR_PURGE_BATCH);
+
+	__sync_fetch_and_add(&areamgr->purgecnt, purged);
+
+	return purged;
+}/*}}}*/
+
+/**
+ * Gives back surplus of free pages to the OS. If the scavenger is running it
+ * is only woken up, and it is signalled once until it wakes, so no system
+ * calls are made. Otherwise the work is done by the caller that closes a
+ * window of page-return policy - other callers only read the clock.
+ *
+ * @param areamgr
+ */
+
+void areamgr_trim(areamgr_t *areamgr)/*{{{*/
+{
+	if (areamgr->scavenging) {
+		if ((areamgr->freecnt > areamgr->limit) && __sync_bool_compare_and_swap(&areamgr->scavenger_pending, 0, 1))
+			pthread_cond_signal(&areamgr->scavenger_wakeup);
+	} else if (areamgr_adapt(areamgr)) {
+		uint32_t unmapped = areamgr_unmap(areamgr);
+		uint32_t purged   = 0;
+
+		if (!areamgr->growing && (areamgr->freecnt > areamgr->keep))
+			purged = areamgr_purge(areamgr);
+
+		DEBUG("Window closed with %u pages unmapped and %u purged\n", unmapped, purged);
+	}
+}/*}}}*/
+
+/**
+ * Body of scavenger thread. Wakes up periodically or when there are too
+ * many free pages and gives back the surplus to the OS.
+ *
+ * @param data		area manager
+ * @return
+ */
+
+static void *areamgr_scavenger(void *data)/*{{{*/
+{
+	areamgr_t *areamgr = data;
+
+	pthread_mutex_lock(&areamgr->scavenger_lock);
+
+	while (areamgr->scavenging) {
+		struct timespec deadline;
+
+		clock_gettime(CLOCK_REALTIME, &deadline);
+
+		deadline.tv_sec  += areamgr->scavenger_period / 1000;
+		deadline.tv_nsec += (areamgr->scavenger_period % 1000) * 1000000;
+
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+
+		pthread_cond_timedwait(&areamgr->scavenger_wakeup, &areamgr->scavenger_lock, &deadline);
+
+		if (!areamgr->scavenging)
+			break;
+
+		/* frees from now on may need another pass */
+		areamgr->scavenger_pending = 0;
+
+		pthread_mutex_unlock(&areamgr->scavenger_lock);
+
+		areamgr_adapt(areamgr);
+
+		uint32_t unmapped = areamgr_unmap(areamgr);
+		uint32_t purged   = areamgr->growing ? 0 : areamgr_purge(areamgr);
+
+		DEBUG("Scavenger unmapped %u and purged %u pages\n", unmapped, purged);
+
+		pthread_mutex_lock(&areamgr->scavenger_lock);
 	}
 
-	/* qualify area for insertion into proper free-list */
-	int n = SIZE_IN_PAGES(newarea->size) - 1;
+	pthread_mutex_unlock(&areamgr->scavenger_lock);
 
-	if (n >= AREAMGR_LIST_COUNT - 1)
-		n = AREAMGR_LIST_COUNT - 1;
+	return NULL;
+}/*}}}*/
+
+/**
+ * Starts scavenger thread. From now on free pages are given back to the OS
+ * only in background.
+ *
+ * @param areamgr
+ * @param period	maximal time between scavenger's passes (in miliseconds)
+ * @return			TRUE if the thread is running
+ */
 
-	/* insert area on proper free list */
-	arealst_insert_area_by_size(&areamgr->list[n], newarea, LOCK);
+bool areamgr_scavenger_start(areamgr_t *areamgr, uint32_t period)/*{{{*/
+{
+	I(period > 0);
+
+	bool result = TRUE;
+
+	pthread_mutex_lock(&areamgr->scavenger_lock);
+
+	if (!areamgr->scavenging) {
+		areamgr->scavenger_period = period;
+		areamgr->scavenging = TRUE;
+
+		if (pthread_create(&areamgr->scavenger, NULL, areamgr_scavenger, areamgr) != 0) {
+			areamgr->scavenging = FALSE;
+			result = FALSE;
+		}
+	}
+
+	pthread_mutex_unlock(&areamgr->scavenger_lock);
+
+	DEBUG("Scavenger %s\n", result ? "started" : "cannot be started");
+
+	return result;
+}/*}}}*/
+
+/**
+ * Stops scavenger thread and waits until it exits. Free pages are given back
+ * to the OS synchronously again.
+ *
+ * @param areamgr
+ */
+
+void areamgr_scavenger_stop(areamgr_t *areamgr)/*{{{*/
+{
+	pthread_mutex_lock(&areamgr->scavenger_lock);
+
+	bool running = areamgr->scavenging;
+
+	areamgr->scavenging = FALSE;
+
+	pthread_cond_signal(&areamgr->scavenger_wakeup);
+	pthread_mutex_unlock(&areamgr->scavenger_lock);
+
+	if (running)
+		pthread_join(areamgr->scavenger, NULL);
+
+	DEBUG("Scavenger stopped\n");
 }/*}}}*/
 
 /**
@@ -1004,36 +2050,36 @@ area_t *areamgr_coalesce_area(areamgr_t *areamgr, area_t *area)/*{{{*/
 	area_valid(area);
 	I(area_is_used(area));
 
-	DEBUG("Will try to coalesce area [$%.8x; $%x; $%.2x] with adjacent areas\n",
-		  (uint32_t)area, area->size, area->flags0);
+	DEBUG("Will try to coalesce area [%p; $%zx; $%.2x] with adjacent areas\n",
+		  (void *)area, area->size, area->flags0);
 
 	area_valid(area->global.next);
 	area_valid(area->global.prev);
 
 	/* coalesce with global.next area */
 	while (!area_is_guard(area->global.next) && !area_is_used(area->global.next) &&
-		   ((void *)area + sizeof(area_t) == area_begining(area->global.next)))
+		   (area_end(area) == area_begining(area->global.next)))
 	{
-		DEBUG("Coalescing with right neighbour [$%.8x; $%x; $%.2x]\n",
-			  (uint32_t)area->global.next, area->global.next->size, area->global.next->flags0);
+		DEBUG("Coalescing with right neighbour [%p; $%zx; $%.2x]\n",
+			  (void *)area->global.next, area->global.next->size, area->global.next->flags0);
 
 		area = arealst_join_area(&areamgr->global, area,
 								 areamgr_alloc_adjacent_area(areamgr, area, 1, RIGHT), DONTLOCK);
 
-		DEBUG("Coalesced into area [$%.8x; $%x; $%.2x]\n", (uint32_t)area, area->size, area->flags0);
+		DEBUG("Coalesced into area [%p; $%zx; $%.2x]\n", (void *)area, area->size, area->flags0);
 	}
 
 	/* coalesce with previous area */
 	while (!area_is_guard(area->global.prev) && !area_is_used(area->global.prev) &&
-		((void *)area->global.prev + sizeof(area_t) == area_begining(area)))
+		(area_end(area->global.prev) == area_begining(area)))
 	{
-		DEBUG("Coalescing with left neighbour [$%.8x; $%x; $%.2x]\n",
-			  (uint32_t)area->global.prev, area->global.prev->size, area->global.prev->flags0);
+		DEBUG("Coalescing with left neighbour [%p; $%zx; $%.2x]\n",
+			  (void *)area->global.prev, area->global.prev->size, area->global.prev->flags0);
 
 		area = arealst_join_area(&areamgr->global, areamgr_alloc_adjacent_area(areamgr, area, 1, LEFT),
 								 area, DONTLOCK);
 
-		DEBUG("Coalesced into area [$%.8x; $%x; $%.2x]\n", (uint32_t)area, area->size, area->flags0);
+		DEBUG("Coalesced into area [%p; $%zx; $%.2x]\n", (void *)area, area->size, area->flags0);
 	}
 
 	areamgr_free_area(areamgr, area);
@@ -1065,8 +2111,8 @@ bool areamgr_expand_area(areamgr_t *areamgr, area_t **area, uint32_t pages, dire
 	I(pages > 0);
 	I(area_is_used(newarea));
 
-	DEBUG("Will expand area at $%.8x [$%.8x; %u; $%.2x] by %u pages from %s side.\n",
-		  (uint32_t)newarea, (uint32_t)area_begining(newarea), newarea->size, newarea->flags0,
+	DEBUG("Will expand area at %p [%p; %zu; $%.2x] by %u pages from %s side.\n",
+		  (void *)newarea, (void *)area_begining(newarea), newarea->size, newarea->flags0,
 		  pages, (side == LEFT) ? "left" : "right");
 
 	area_t *expansion = areamgr_alloc_adjacent_area(areamgr, newarea, pages, side);
@@ -1075,6 +2121,7 @@ bool areamgr_expand_area(areamgr_t *areamgr, area_t **area, uint32_t pages, dire
 
 	uint8_t manager = newarea->manager;
 	bool    ready   = newarea->ready;
+	uint8_t cpu     = newarea->cpu;
 
 	if (expansion != NULL) {
 		if (side == RIGHT)
@@ -1085,12 +2132,13 @@ bool areamgr_expand_area(areamgr_t *areamgr, area_t **area, uint32_t pages, dire
 
 	newarea->manager = manager;
 	newarea->ready   = ready;
+	newarea->cpu     = cpu;
 	area_touch(newarea);
 
 	arealst_unlock(&areamgr->global);
 
-	DEBUG("Area at $%.8x expanded to [$%.8x; %u; $%.2x]\n",
-			(uint32_t)newarea, (uint32_t)area_begining(newarea), newarea->size, newarea->flags0);
+	DEBUG("Area at %p expanded to [%p; %zu; $%.2x]\n",
+			(void *)newarea, (void *)area_begining(newarea), newarea->size, newarea->flags0);
 
 	*area = newarea;
 
@@ -1120,8 +2168,8 @@ void areamgr_shrink_area(areamgr_t *areamgr, area_t **area, uint32_t pages, dire
 	I((side == LEFT) || (side == RIGHT));
 	I(area_is_used(newarea));
 
-	DEBUG("Will %s-shrink area at $%.8x [$%.8x; %u; $%.2x] by %u pages\n", (side == LEFT) ? "left" : "right", 
-		  (uint32_t)newarea, (uint32_t)area_begining(newarea), newarea->size, newarea->flags0,
+	DEBUG("Will %s-shrink area at %p [%p; %zu; $%.2x] by %zu pages\n", (side == LEFT) ? "left" : "right", 
+		  (void *)newarea, (void *)area_begining(newarea), newarea->size, newarea->flags0,
 		  SIZE_IN_PAGES(newarea->size) - pages);
 
 	area_t *leftover = newarea;
@@ -1143,15 +2191,80 @@ void areamgr_shrink_area(areamgr_t *areamgr, area_t **area, uint32_t pages, dire
 	
 		newarea->manager = leftover->manager;
 		newarea->ready   = leftover->ready;
+		newarea->cpu     = leftover->cpu;
 
 		arealst_unlock(&areamgr->global);
 	}
 
 	areamgr_free_area(areamgr, leftover);
 
-	DEBUG("Area at $%.8x shrinked to [$%.8x; %u; $%.2x]\n",
-			(uint32_t)newarea, (uint32_t)area_begining(newarea), newarea->size, newarea->flags0);
+	DEBUG("Area at %p shrinked to [%p; %zu; $%.2x]\n",
+			(void *)newarea, (void *)area_begining(newarea), newarea->size, newarea->flags0);
 
 	*area = newarea;
 }/*}}}*/
 
+
+/**
+ * Resizes the area by remapping its pages. If <i>relocate</i> is set the
+ * kernel may move the pages to other place, no data is copied anyway. Only
+ * areas created by mmap can be remapped.
+ *
+ * Area must be marked as used and cannot be linked into any local list.
+ *
+ * @param areamgr
+ * @param area		pointer to an area which will be remapped
+ * @param pages		new size of area
+ * @param relocate
+ * @return			TRUE on success, otherwise the area is left intact
+ */
+
+bool areamgr_remap_area(areamgr_t *areamgr, area_t **area, uint32_t pages, bool relocate)/*{{{*/
+{
+	area_t *oldarea = *area;
+
+	area_valid(oldarea);
+
+	I(pages > 0);
+	I(area_is_used(oldarea));
+	I((oldarea->local.prev == NULL) && (oldarea->local.next == NULL));
+
+	if (!area_is_mmap(oldarea))
+		return FALSE;
+
+	uint32_t oldpages = SIZE_IN_PAGES(oldarea->size);
+
+	DEBUG("Will remap area at %p [%p; %zu; $%.2x] to %u pages%s.\n",
+		  (void *)oldarea, (void *)area_begining(oldarea), oldarea->size, oldarea->flags0,
+		  pages, relocate ? " allowing relocation" : "");
+
+	arealst_wrlock(&areamgr->global);
+
+	/* pages of the area must not be seen at old place */
+	arealst_global_remove_area(&areamgr->global, oldarea, DONTLOCK);
+
+	void *begining = pm_mmap_remap(area_begining(oldarea), oldpages, pages, relocate);
+
+	area_t *newarea = oldarea;
+
+	if (begining != NULL) {
+		newarea->begining = begining;
+		newarea->size = pages * PAGE_SIZE;
+		area_touch(newarea);
+
+		__sync_fetch_and_add(&areamgr->pagecnt, pages - oldpages);
+
+		DEBUG("Area remapped to [%p; %zu; $%.2x] at %p\n",
+			  (void *)newarea, newarea->size, newarea->flags0, (void *)area_begining(newarea));
+	} else {
+		DEBUG("Cannot remap area at %p!\n", (void *)oldarea);
+	}
+
+	arealst_global_add_area(&areamgr->global, newarea, DONTLOCK);
+
+	arealst_unlock(&areamgr->global);
+
+	*area = newarea;
+
+	return (begining != NULL);
+}/*}}}*/
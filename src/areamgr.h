@@ -3,12 +3,20 @@
 
 #include "common.h"
 #include "sysmem.h"
+#include "pagemap.h"
+#include "lock.h"
 #include <stdio.h>
 #include <pthread.h>
 
 /* === Memory area structure definition ==================================== */
 
-struct area				/* size of this structure will be aligned to 8 bytes boundary */
+/*
+ * Area structures are not stored inside areas they describe. They are kept
+ * densely packed in pages dedicated for them, so walking lists and trees of
+ * areas does not touch (and fault in) memory handed out to the user.
+ */
+
+struct area
 {
 	uint16_t checksum;
 
@@ -28,7 +36,12 @@ struct area				/* size of this structure will be aligned to 8 bytes boundary */
 	/* cpu which allocated this area */
 	uint8_t	 cpu;
 
-	uint32_t size;
+	/* pages of free area were given back to the OS with madvise */
+	uint8_t	 purged;
+
+	size_t	 size;
+
+	void	*begining;			/* first byte of memory described by the area */
 
 	struct {
 		/* uint16_t checksum; */
@@ -36,12 +49,21 @@ struct area				/* size of this structure will be aligned to 8 bytes boundary */
 		struct area *next;	/* next area on global list */
 	} global;
 
-	struct {
-		/* uint16_t checksum; */
-		struct area *prev;	/* previous area on size bucket list */
-		struct area *next;	/* next area on size bucket list */
-	} local;
-} __attribute__((aligned(8)));
+	union {
+		struct {
+			/* uint16_t checksum; */
+			struct area *prev;	/* previous area on size bucket list */
+			struct area *next;	/* next area on size bucket list */
+		} local;
+
+		struct {
+			struct area *left;	/* left son in tree of large free areas */
+			struct area *right;	/* right son in tree of large free areas */
+		} tree;
+	};
+
+	struct area *parent;		/* parent in tree of large free areas */
+};
 
 typedef struct area area_t;
 
@@ -71,47 +93,83 @@ static inline uint16_t area_checksum(area_t *area)/*{{{*/
 {
 	uint32_t bytes = offsetof(area_t, global) - sizeof(uint16_t);
 
-	return (uint16_t)(((uint32_t)area) >> 16) ^
-		   (uint16_t)(((uint32_t)area) & 0xFFFF) ^
-		   (uint16_t)checksum((uint16_t *)&area->checksum + 1, bytes >> 1);
+	return checksum(checksum_seed(area, checksum_key), (uint16_t *)&area->checksum + 1, bytes >> 1);
 }/*}}}*/
 
 static inline void area_touch(area_t *area)/*{{{*/
 {
+#if CHECKSUM != CHECKSUM_NONE
 	area->checksum = area_checksum(area);
+#endif
 }/*}}}*/
 
-static inline void area_valid(area_t *area)/*{{{*/
+/* Check area's checksum - used by verification procedures */
+
+static inline void area_check(area_t *area)/*{{{*/
 {
+#if CHECKSUM != CHECKSUM_NONE
 	if (area_checksum(area) != area->checksum) {
-		fprintf(stderr, "invalid area: [$%.8x; %u; $%.2x] [calc:$%.4x != orig:$%.4x]\n",
-				(uint32_t)area, area->size, area->flags0, area_checksum(area), area->checksum);
+		fprintf(stderr, "invalid area: [%p; %zu; $%.2x] [calc:$%.4x != orig:$%.4x]\n",
+				(void *)area, area->size, area->flags0, area_checksum(area), area->checksum);
 		hexdump(area, sizeof(area_t));
 		abort();
 	}
+#endif
 }/*}}}*/
 
-/* Address calculation procedures */
+/* Check area's checksum - used whenever an area is accessed */
 
-static inline area_t *area_footer(void *begining, uint32_t pages)/*{{{*/
+static inline void area_valid(area_t *area)/*{{{*/
 {
-	return (area_t *)(begining + pages * PAGE_SIZE - sizeof(area_t));
+#if CHECKSUM >= CHECKSUM_FULL
+	area_check(area);
+#endif
 }/*}}}*/
 
+/* Address calculation procedures */
+
 static inline void *area_begining(area_t *area)/*{{{*/
 {
-	return (void *)area + sizeof(area_t) - area->size;
+	return area->begining;
 }/*}}}*/
 
 static inline void *area_end(area_t *area)/*{{{*/
 {
-	return (void *)area + sizeof(area_t);
+	return area->begining + area->size;
 }/*}}}*/
 
 /* Contructor and destructor for memory area */
 area_t *area_new(pm_type_t type, uint32_t pages);
 bool area_delete(area_t *area);
 
+/* === Index of areas by address ========================================== */
+
+/*
+ * Areas on global list are also kept in B+tree keyed by their beginnings, so
+ * place of an area on the list or an area covering given address is found in
+ * logarithmic time. Nodes span a few cache lines and keep keys next to each
+ * other, so a lookup does not touch area structures except the one found.
+ * Neighbours of an area are still reached thru global list's links.
+ */
+
+#define AREAIDX_NODE_SIZE	(4 * L2_LINE_SIZE)
+#define AREAIDX_ORDER		((AREAIDX_NODE_SIZE - sizeof(uintptr_t)) / (2 * sizeof(void *)))
+
+struct areaidx_node
+{
+	uint16_t count;							/* number of keys */
+	uint16_t leaf;
+
+	void	*key[AREAIDX_ORDER];
+
+	union {
+		struct areaidx_node *child[AREAIDX_ORDER + 1];	/* child[i] holds keys from key[i-1] up to key[i] */
+		struct area *area[AREAIDX_ORDER + 1];			/* area[i] begins at key[i] */
+	};
+};
+
+typedef struct areaidx_node areaidx_node_t;
+
 /* === Memory areas' list structure ======================================== */
 
 struct arealst
@@ -120,8 +178,10 @@ struct arealst
 
 	uint32_t areacnt;
 
-	pthread_rwlock_t	 lock;
-	pthread_rwlockattr_t lock_attr;
+	/* index of areas - used only by global list */
+	areaidx_node_t *index;
+
+	lock_t lock;
 };
 
 typedef struct arealst arealst_t;
@@ -130,10 +190,12 @@ void arealst_init(arealst_t *arealst);
 void arealst_global_add_area(arealst_t *arealst, area_t *newarea, locking_t locking);
 void arealst_global_remove_area(arealst_t *arealst, area_t *area, locking_t locking);
 
+area_t *arealst_global_find_area(arealst_t *arealst, void *addr, locking_t locking);
+
 bool arealst_has_area(arealst_t *arealst, area_t *addr, locking_t locking);
 
 area_t *arealst_find_area_by_addr(arealst_t *arealst, void *addr, locking_t locking);
-area_t *arealst_find_area_by_size(arealst_t *arealst, uint32_t size, locking_t locking);
+area_t *arealst_find_area_by_size(arealst_t *arealst, size_t size, locking_t locking);
 
 void arealst_insert_area(arealst_t *arealst, area_t *after, area_t *newarea, locking_t locking);
 void arealst_insert_area_by_addr(arealst_t *arealst, area_t *newarea, locking_t locking);
@@ -145,23 +207,96 @@ void arealst_split_area(arealst_t *global, area_t **splitted, area_t **remainder
 
 /* Locking inlines */
 
-static inline void arealst_rdlock(arealst_t *arealst) { pthread_rwlock_rdlock(&arealst->lock); }
-static inline void arealst_wrlock(arealst_t *arealst) { pthread_rwlock_wrlock(&arealst->lock); }
-static inline void arealst_unlock(arealst_t *arealst) { pthread_rwlock_unlock(&arealst->lock); }
+static inline void arealst_rdlock(arealst_t *arealst) { lock_acquire_shared(&arealst->lock); }
+static inline void arealst_wrlock(arealst_t *arealst) { lock_acquire(&arealst->lock); }
+static inline void arealst_unlock(arealst_t *arealst) { lock_release(&arealst->lock); }
+
+/* === Tree of large free areas ============================================ */
+
+/*
+ * Free areas larger than AREAMGR_LIST_COUNT pages are kept in a splay tree
+ * ordered by size and then by address, so the best fitting area is found in
+ * logarithmic time.
+ */
+
+struct areatree
+{
+	area_t	*root;
+
+	uint32_t areacnt;
+
+	lock_t lock;
+};
+
+typedef struct areatree areatree_t;
 
 /* === Memory areas' manager structure ===================================== */
 
+/*
+ * Free areas of up to AREAMGR_LIST_COUNT pages are kept on lists by exact
+ * size (list[n] holds areas of n+1 pages), bitmap marks nonempty lists.
+ */
+
 #define AREAMGR_LIST_COUNT 64
 
+/*
+ * Number of free pages kept for future use is adjusted at the end of each
+ * time window. If pages were taken from the OS or more pages were handed out
+ * than given back the heap grows, so the pages are held. If the heap shrinks
+ * the number is halved and surplus is given back to the OS at once.
+ * Otherwise free areas exceeding the number are purged with madvise, which
+ * keeps their mappings but releases physical memory, and only pages over
+ * twice the number are unmapped. If the scavenger thread is running it does
+ * all of that, otherwise it's done by the thread that happens to close the
+ * window. Either way freeing an area never makes a system call itself.
+ */
+
+#define AREAMGR_WINDOW_MS	100
+#define AREAMGR_KEEP_MIN	64
+#define AREAMGR_KEEP_MAX	4096
+#define AREAMGR_PURGE_MIN	16
+#define AREAMGR_PURGE_BATCH	16
+
 struct areamgr
 {
 	arealst_t	global;
 	arealst_t	list[AREAMGR_LIST_COUNT];
+	areatree_t	tree;
+
+	/* nonempty lists bitmap */
+	uint64_t	bitmap;
 
 	/* all pages counter */
 	uint32_t	pagecnt;
 	/* free pages counter */
 	uint32_t	freecnt;
+
+	/* start of current window (in miliseconds) */
+	uint32_t	window;
+	/* pages taken from the OS, handed out and given back in current window */
+	uint32_t	acquired;
+	uint32_t	inflow;
+	uint32_t	outflow;
+
+	/* number of free pages that are not given back to the OS */
+	uint32_t	keep;
+	/* number of free pages above which areas are unmapped */
+	uint32_t	limit;
+	/* are the pages held due to growth of the heap ? */
+	bool		growing;
+
+	/* pages given back to the OS by unmapping and purging */
+	uint32_t	unmapcnt;
+	uint32_t	purgecnt;
+
+	/* background thread giving back free pages (if it's running) */
+	pthread_t		scavenger;
+	pthread_mutex_t	scavenger_lock;
+	pthread_cond_t	scavenger_wakeup;
+	uint32_t		scavenger_period;
+	/* scavenger was signalled and has not woken up yet */
+	uint32_t		scavenger_pending;
+	bool			scavenging;
 } __attribute__((aligned(L2_LINE_SIZE)));
 
 typedef struct areamgr areamgr_t;
@@ -169,9 +304,16 @@ typedef struct areamgr areamgr_t;
 /* Memory manager procedures */
 areamgr_t *areamgr_init(area_t *area);
 area_t *areamgr_alloc_area(areamgr_t *areamgr, uint32_t pages);
+void areamgr_assign_area(areamgr_t *areamgr, area_t *area, uint8_t manager, uint8_t cpu, bool ready);
 area_t *areamgr_alloc_adjacent_area(areamgr_t *areamgr, area_t *addr, uint32_t pages, direction_t side);
 void areamgr_free_area(areamgr_t *areamgr, area_t *area);
 bool areamgr_prealloc_area(areamgr_t *areamgr, uint32_t pages);
+void areamgr_trim(areamgr_t *areamgr);
+
+bool areamgr_scavenger_start(areamgr_t *areamgr, uint32_t period);
+void areamgr_scavenger_stop(areamgr_t *areamgr);
+
+area_t *areamgr_find_area(areamgr_t *areamgr, void *addr);
 
 void areamgr_add_area(areamgr_t *areamgr, area_t *newarea);
 void areamgr_remove_area(areamgr_t *areamgr, area_t *area);
@@ -180,5 +322,6 @@ area_t *areamgr_coalesce_area(areamgr_t *areamgr, area_t *area);
 
 bool areamgr_expand_area(areamgr_t *areamgr, area_t **area, uint32_t pages, direction_t side);
 void areamgr_shrink_area(areamgr_t *areamgr, area_t **area, uint32_t pages, direction_t side);
+bool areamgr_remap_area(areamgr_t *areamgr, area_t **area, uint32_t pages, bool relocate);
 
 #endif
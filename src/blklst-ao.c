@@ -1,26 +1,381 @@
 /*
  * Author:	Krystian Bacławski <name.surname@gmail.com>
- * Desc:	Block manager implementation - address ordered list
+ * Desc:	Block manager implementation - address ordered list with size bins
+ *			and size tree
  */
 
 #include "blklst-ao.h"
 #include <string.h>
 
 /**
- * Insert block into list of free blocks.
+ * Calculate index of size class for blocks of given size. Blocks of the
+ * same class share a bin or a quick list.
+ * @param size
+ * @return
+ */
+
+static inline uint32_t mb_bin_index(uint32_t size)/*{{{*/
+{
+	if (size < MB_BIN_SMALL)
+		return (size - sizeof(mb_binned_t)) >> MB_GRANULARITY_BITS;
+
+	uint32_t log = 31 - __builtin_clz(size);
+
+	return MB_BIN_EXACT + ((log - 6) << 2) + ((size >> (log - 2)) & 3);
+}/*}}}*/
+
+/* === Size tree of large free blocks ====================================== */
+
+struct memory_block_key
+{
+	uint32_t  size;
+	void	 *addr;
+};
+
+typedef struct memory_block_key mb_key_t;
+
+static inline mb_key_t mb_key(mb_node_t *blk)/*{{{*/
+{
+	return (mb_key_t){ blk->size, blk };
+}/*}}}*/
+
+static inline bool mb_key_lt(mb_key_t a, mb_key_t b)/*{{{*/
+{
+	return (a.size < b.size) || ((a.size == b.size) && (a.addr < b.addr));
+}/*}}}*/
+
+static inline bool mb_key_eq(mb_key_t a, mb_key_t b)/*{{{*/
+{
+	return (a.size == b.size) && (a.addr == b.addr);
+}/*}}}*/
+
+static inline mb_node_t *mb_tree_root(mb_list_t *list)/*{{{*/
+{
+	return mb_deref(list, list->tree);
+}/*}}}*/
+
+static inline mb_node_t *mb_node_left(mb_node_t *node)/*{{{*/
+{
+	return mb_deref(node, node->left);
+}/*}}}*/
+
+static inline mb_node_t *mb_node_right(mb_node_t *node)/*{{{*/
+{
+	return mb_deref(node, node->right);
+}/*}}}*/
+
+static inline mb_node_t *mb_node_parent(mb_node_t *node)/*{{{*/
+{
+	return mb_deref(node, node->parent);
+}/*}}}*/
+
+#define __TREE				mb_tree
+#define __TREE_T			mb_list_t
+#define __NODE				mb_tree_node
+#define __NODE_T			mb_node_t
+#define __KEY_T				mb_key_t
+#define __ROOT(list)			mb_tree_root(list)
+#define __LEFT(node)			mb_node_left(node)
+#define __RIGHT(node)			mb_node_right(node)
+#define __PARENT(node)			mb_node_parent(node)
+#define __SET_ROOT(list,ptr)	(list)->tree = mb_ref((list), (ptr))
+#define __SET_LEFT(node,ptr)	(node)->left = mb_ref((node), (ptr))
+#define __SET_RIGHT(node,ptr)	(node)->right = mb_ref((node), (ptr))
+#define __SET_PARENT(node,ptr)	(node)->parent = mb_ref((node), (ptr))
+#define __KEY(node)			mb_key(node)
+#define __KEY_LT(a,b)		mb_key_lt(a, b)
+#define __KEY_EQ(a,b)		mb_key_eq(a, b)
+
+#include "common-splay0.c"
+
+/* === Size bins =========================================================== */
+
+static inline mb_binned_t *mb_bin_first(mb_list_t *list, uint32_t i)/*{{{*/
+{
+	return mb_deref(list, list->bin[i]);
+}/*}}}*/
+
+static inline mb_binned_t *mb_bin_next(mb_binned_t *blk)/*{{{*/
+{
+	return mb_deref(blk, blk->bin_next);
+}/*}}}*/
+
+static inline mb_binned_t *mb_bin_prev(mb_binned_t *blk)/*{{{*/
+{
+	return mb_deref(blk, blk->bin_prev);
+}/*}}}*/
+
+/* First block of a bin keeps link to the last one, a null link means itself. */
+
+static inline mb_binned_t *mb_bin_last(mb_list_t *list, uint32_t i)/*{{{*/
+{
+	mb_binned_t *first = mb_bin_first(list, i);
+	mb_binned_t *last  = mb_bin_prev(first);
+
+	return last ? last : first;
+}/*}}}*/
+
+/**
+ * Take over bins and the size tree of a list that was moved to other place.
+ * @param list
+ * @param old
+ */
+
+static void mb_bin_move(mb_list_t *list, mb_list_t *old)/*{{{*/
+{
+	uint32_t i;
+
+	for (i = 0; i < MB_BIN_COUNT; i++)
+		list->bin[i] = mb_ref(list, mb_bin_first(old, i));
+
+	list->bitmap = old->bitmap;
+	list->tree	 = mb_ref(list, mb_tree_root(old));
+}/*}}}*/
+
+/**
+ * Join bins and the size tree of other list into bins and the size tree of
+ * given list. Chains of bins are appended as a whole, nodes of the smaller
+ * tree are inserted one by one into the larger one.
+ * @param list
+ * @param other
+ */
+
+static void mb_bin_join(mb_list_t *list, mb_list_t *other)/*{{{*/
+{
+	uint64_t bitmap = other->bitmap;
+
+	while (bitmap != 0) {
+		uint32_t i = __builtin_ctzll(bitmap);
+
+		bitmap &= bitmap - 1;
+
+		mb_binned_t *head = mb_bin_first(other, i);
+		mb_binned_t *tail = mb_bin_last(other, i);
+
+		if (list->bin[i] == 0) {
+			list->bin[i] = mb_ref(list, head);
+		} else {
+			mb_binned_t *first = mb_bin_first(list, i);
+			mb_binned_t *last  = mb_bin_last(list, i);
+
+			last->bin_next  = mb_ref(last, head);
+			head->bin_prev  = mb_ref(head, last);
+			first->bin_prev = mb_ref(first, tail);
+		}
+	}
+
+	list->bitmap |= other->bitmap;
+
+	/* free blocks count is good enough estimate of tree size */
+	mb_node_t *node;
+
+	if (other->blkcnt - other->ublkcnt > list->blkcnt - list->ublkcnt) {
+		node = mb_tree_root(list);
+
+		list->tree  = mb_ref(list, mb_tree_root(other));
+		other->tree = mb_ref(other, node);
+	}
+
+	while ((node = mb_tree_root(other)) != NULL) {
+		mb_tree_remove(other, node);
+		mb_tree_insert(list, node);
+	}
+
+	other->bitmap = 0;
+
+	memset(other->bin, 0, sizeof(other->bin));
+}/*}}}*/
+
+/**
+ * Put free block into a bin or into the size tree unless it is too small.
+ * @param list
+ * @param blk
+ */
+
+static void mb_bin_insert(mb_list_t *list, mb_free_t *blk)/*{{{*/
+{
+	I(!(blk->flags & MB_FLAG_BINNED));
+
+	if (blk->size < sizeof(mb_binned_t))
+		return;
+
+	if (blk->size >= MB_TREE_MIN) {
+		mb_tree_insert(list, (mb_node_t *)blk);
+
+		blk->flags |= MB_FLAG_BINNED;
+
+		mb_touch(list, blk);
+		return;
+	}
+
+	mb_binned_t *bblk = (mb_binned_t *)blk;
+
+	uint32_t i = mb_bin_index(bblk->size);
+
+	mb_binned_t *next = mb_bin_first(list, i);
+
+	bblk->bin_prev = next ? mb_ref(bblk, mb_bin_last(list, i)) : 0;
+	bblk->bin_next = mb_ref(bblk, next);
+
+	if (next)
+		next->bin_prev = mb_ref(next, bblk);
+
+	list->bin[i]  = mb_ref(list, bblk);
+	list->bitmap |= 1ULL << i;
+
+	bblk->flags |= MB_FLAG_BINNED;
+
+	mb_touch(list, bblk);
+}/*}}}*/
+
+/**
+ * Take free block out of its bin or the size tree. Must be called before
+ * block's size changes.
+ * @param list
+ * @param blk
+ */
+
+static void mb_bin_remove(mb_list_t *list, mb_free_t *blk)/*{{{*/
+{
+	if (!(blk->flags & MB_FLAG_BINNED))
+		return;
+
+	if (blk->size >= MB_TREE_MIN) {
+		mb_tree_remove(list, (mb_node_t *)blk);
+
+		blk->flags &= ~MB_FLAG_BINNED;
+
+		mb_touch(list, blk);
+		return;
+	}
+
+	mb_binned_t *bblk = (mb_binned_t *)blk;
+
+	uint32_t i = mb_bin_index(bblk->size);
+
+	mb_binned_t *first = mb_bin_first(list, i);
+	mb_binned_t *prev  = mb_bin_prev(bblk);
+	mb_binned_t *next  = mb_bin_next(bblk);
+
+	if (first == bblk) {
+		/* next block becomes first and takes over link to the last one */
+		list->bin[i] = mb_ref(list, next);
+
+		if (next == NULL)
+			list->bitmap &= ~(1ULL << i);
+		else
+			next->bin_prev = mb_ref(next, prev);
+	} else {
+		prev->bin_next = mb_ref(prev, next);
+
+		if (next)
+			next->bin_prev = mb_ref(next, prev);
+		else
+			first->bin_prev = mb_ref(first, prev);
+	}
+
+	bblk->flags &= ~MB_FLAG_BINNED;
+
+	mb_touch(list, bblk);
+}/*}}}*/
+
+/**
+ * Find free block that is at least of given size. For small sizes first the
+ * bin matching the size is searched, then any block from the first nonempty
+ * larger bin is taken. Otherwise the best fitting block with the lowest
+ * address is looked up in the size tree.
+ * @param list
+ * @param size
+ * @return
+ */
+
+static mb_free_t *mb_bin_find(mb_list_t *list, uint32_t size)/*{{{*/
+{
+	if (size < MB_TREE_MIN) {
+		uint32_t i = mb_bin_index(size);
+
+		if (list->bitmap & (1ULL << i)) {
+			mb_binned_t *blk = mb_bin_first(list, i);
+
+			while (blk != NULL) {
+				if (blk->size >= size)
+					return (mb_free_t *)blk;
+
+				blk = mb_bin_next(blk);
+			}
+		}
+
+		uint64_t larger = list->bitmap & ~((2ULL << i) - 1);
+
+		if (larger != 0)
+			return (mb_free_t *)mb_bin_first(list, __builtin_ctzll(larger));
+	}
+
+	return (mb_free_t *)mb_tree_lower_bound(list, (mb_key_t){ size, NULL });
+}/*}}}*/
+
+/**
+ * Check the size tree and count its nodes. The tree is walked without
+ * splaying, so it is not modified.
+ * @param list
+ * @param error
+ * @return
+ */
+
+static uint32_t mb_tree_verify(mb_list_t *list, bool *error)/*{{{*/
+{
+	mb_node_t *node = mb_tree_root(list);
+
+	if (node == NULL)
+		return 0;
+
+	*error |= (mb_node_parent(node) != NULL);
+
+	while (mb_node_left(node))
+		node = mb_node_left(node);
+
+	uint32_t count = 0;
+
+	mb_node_t *prev = NULL;
+
+	while (node != NULL) {
+		*error |= mb_is_used(node) || !(node->flags & MB_FLAG_BINNED) || (node->size < MB_TREE_MIN);
+		*error |= mb_node_left(node) && (mb_node_parent(mb_node_left(node)) != node);
+		*error |= mb_node_right(node) && (mb_node_parent(mb_node_right(node)) != node);
+		*error |= (prev != NULL) && !mb_key_lt(mb_key(prev), mb_key(node));
+
+		count++;
+
+		prev = node;
+		node = mb_tree_node_next(node);
+	}
+
+	return count;
+}/*}}}*/
+
+/**
+ * Find free block after which given block should be placed on the list. If
+ * any of physical neighbours is free, the place is known immediately,
+ * otherwise the list is searched.
  * @param list
  * @param newblk
+ * @return
  */
 
-static void mb_insert(mb_list_t *list, mb_free_t *newblk)/*{{{*/
+static mb_free_t *mb_find_place(mb_list_t *list, mb_free_t *newblk)/*{{{*/
 {
-	mb_valid(list);
-	mb_valid(newblk);
+	mb_t *prev = mb_prev_block((mb_t *)newblk);
 
-	I(mb_is_guard(list));
-	I(!mb_is_used(newblk) && !mb_is_guard(newblk));
+	if (prev && !mb_is_used(prev))
+		return (mb_free_t *)prev;
+
+	mb_t *next = mb_next_block((mb_t *)newblk);
 
-	DEBUG("will insert block [$%.8x; %u; $%.2x] on free list\n", (uint32_t)newblk, newblk->size, newblk->flags);
+	if (next && !mb_is_used(next)) {
+		mb_valid(list, next);
+
+		return mb_get_prev(next);
+	}
 
 	/* search the list for place where new block will be placed */
 	mb_free_t *blk = (mb_free_t *)list;
@@ -29,33 +384,64 @@ static void mb_insert(mb_list_t *list, mb_free_t *newblk)/*{{{*/
 	while (TRUE) {
 		I(blk != newblk);
 
-		mb_valid(blk);
+		mb_valid(list, blk);
 
-		if (mb_is_guard(blk->next) || (blk->next > newblk))
+		mb_free_t *next = mb_get_next(blk);
+
+		if (mb_is_guard(next) || (next > newblk))
 			break;
 
-		blk = blk->next;
+		blk = next;
 	}
 
+	return blk;
+}/*}}}*/
+
+/**
+ * Insert block into list of free blocks.
+ * @param list
+ * @param newblk
+ */
+
+static void mb_insert(mb_list_t *list, mb_free_t *newblk)/*{{{*/
+{
+	mb_valid(list, list);
+	mb_valid(list, newblk);
+
+	I(mb_is_guard(list));
+	I(!mb_is_used(newblk) && !mb_is_guard(newblk));
+
+	DEBUG("will insert block [%p; %u; $%.2x] on free list\n", (void *)newblk, newblk->size, newblk->flags);
+
+	mb_free_t *blk = mb_find_place(list, newblk);
+
+	mb_valid(list, blk);
+
+	mb_free_t *next = mb_get_next(blk);
+
+	I((mb_is_guard(blk) || (blk < newblk)) && (mb_is_guard(next) || (next > newblk)));
+
 	/* newblk - block being inserted */
-	newblk->next = blk->next;
-	newblk->prev = blk;
+	mb_set_next(newblk, next);
+	mb_set_prev(newblk, blk);
 
-	mb_touch(newblk);
+	mb_touch(list, newblk);
 
-	/* newblk->next - block before which new block is inserted */
-	mb_valid(newblk->next);
+	/* next - block before which new block is inserted */
+	mb_valid(list, next);
 
-	newblk->next->prev = newblk;
+	mb_set_prev(next, newblk);
 
-	mb_touch(blk->next);
+	mb_touch(list, next);
 
 	/* blk - block after which new block is inserted */
-	blk->next = newblk;
+	mb_set_next(blk, newblk);
+
+	mb_touch(list, blk);
 
-	mb_touch(blk);
+	mb_bin_insert(list, newblk);
 
-	DEBUG("inserted after block [$%.8x; %u; $%.2x]\n", (uint32_t)blk, blk->size, blk->flags);
+	DEBUG("inserted after block [%p; %u; $%.2x]\n", (void *)blk, blk->size, blk->flags);
 }/*}}}*/
 
 /**
@@ -68,7 +454,7 @@ static void mb_split(mb_list_t *list, mb_free_t **splitted, uint32_t size, bool
 {
 	mb_free_t *blk = *splitted;
 
-	mb_valid(blk);
+	mb_valid(list, blk);
 
 	I(!mb_is_used(blk) && !mb_is_guard(blk));
 	I((size & MB_GRANULARITY_MASK) == 0);
@@ -77,81 +463,98 @@ static void mb_split(mb_list_t *list, mb_free_t **splitted, uint32_t size, bool
 	if (blk->size - size < sizeof(mb_free_t))
 		return;
 
+	mb_bin_remove(list, blk);
+
 	/* calculate new block address */
-	mb_free_t *newblk = (mb_free_t *)((uint32_t)blk + (second ? (blk->size - size) : size));
+	mb_free_t *newblk = (mb_free_t *)((uintptr_t)blk + (second ? (blk->size - size) : size));
 
 	/* initalize new block */
 	newblk->size  = second ? size : (blk->size - size);
 	newblk->flags = 0;
-	newblk->prev  = blk;
-	newblk->next  = blk->next;
+	mb_set_prev(newblk, blk);
+	mb_set_next(newblk, mb_get_next(blk));
 
 	if (mb_is_last(blk))
 		newblk->flags |= MB_FLAG_LAST;
 
-	mb_touch(newblk);
+	mb_touch(list, newblk);
 
 	/* shrink block and correct pointer */
-	blk->next = newblk;
+	mb_set_next(blk, newblk);
 	blk->size = second ? (blk->size - size) : size;
 
 	if (mb_is_last(blk))
 		blk->flags &= ~MB_FLAG_LAST;
 
-	mb_touch(blk);
+	mb_touch(list, blk);
 
 	/* correct pointer in next block */
-	mb_valid(newblk->next);
+	mb_free_t *next = mb_get_next(newblk);
 
-	newblk->next->prev = newblk;
+	mb_valid(list, next);
 
-	mb_touch(newblk->next);
+	mb_set_prev(next, newblk);
+
+	mb_touch(list, next);
+
+	/* correct sizes of preceding blocks */
+	mb_link(list, blk);
+	mb_link(list, newblk);
+
+	mb_bin_insert(list, blk);
+	mb_bin_insert(list, newblk);
 
 	/* increase blocks' counter */
 	list->blkcnt++;
 	list->fmemcnt -= sizeof(mb_t);
 
-	mb_touch(list);
+	mb_touch(list, list);
 
-	DEBUG("splitted blocks: [$%.8x; %u; $%.2x] [$%.8x; %u; $%.2x]\n",
-		  (uint32_t)blk, blk->size, blk->flags, (uint32_t)newblk, newblk->size, newblk->flags);
+	DEBUG("splitted blocks: [%p; %u; $%.2x] [%p; %u; $%.2x]\n",
+		  (void *)blk, blk->size, blk->flags, (void *)newblk, newblk->size, newblk->flags);
 
 	*splitted = second ? newblk : blk;
 }/*}}}*/
 
 /**
  * Pull out the block from list of free blocks.
+ * @param list
  * @param blk
  */
 
-static void mb_pullout(mb_free_t *blk)/*{{{*/
+static void mb_pullout(mb_list_t *list, mb_free_t *blk)/*{{{*/
 {
-	mb_valid(blk);
+	mb_valid(list, blk);
 
 	I(!mb_is_used(blk) && !mb_is_guard(blk));
 
-	DEBUG("pulling out block [$%.8x; %u; $%.2x] [prev: $%.8x; next: $%.8x] from list\n",
-		  (uint32_t)blk, blk->size, blk->flags, (uint32_t)blk->prev, (uint32_t)blk->next);
+	mb_bin_remove(list, blk);
+
+	DEBUG("pulling out block [%p; %u; $%.2x] [prev: %p; next: %p] from list\n",
+		  (void *)blk, blk->size, blk->flags, (void *)mb_get_prev(blk), (void *)mb_get_next(blk));
+
+	mb_free_t *prev = mb_get_prev(blk);
+	mb_free_t *next = mb_get_next(blk);
 
 	/* correct pointer in previous block */
-	mb_valid(blk->prev);
+	mb_valid(list, prev);
 
-	blk->prev->next = blk->next;
+	mb_set_next(prev, next);
 
-	mb_touch(blk->prev);
+	mb_touch(list, prev);
 
 	/* correct pointer in next block */
-	mb_valid(blk->next);
+	mb_valid(list, next);
 
-	blk->next->prev = blk->prev;
+	mb_set_prev(next, prev);
 
-	mb_touch(blk->next);
+	mb_touch(list, next);
 
 	/* clear pointers in block being pulled out */
-	blk->next = NULL;
-	blk->prev = NULL;
+	blk->next = 0;
+	blk->prev = 0;
 
-	mb_touch(blk);
+	mb_touch(list, blk);
 }/*}}}*/
 
 /**
@@ -162,90 +565,100 @@ static void mb_pullout(mb_free_t *blk)/*{{{*/
 
 static mb_free_t *mb_coalesce(mb_list_t *list, mb_free_t *blk)/*{{{*/
 {
-	mb_valid(blk);
+	mb_valid(list, blk);
 
 	I(!mb_is_used(blk) && !mb_is_guard(blk));
 
+	/* block will change its size */
+	mb_bin_remove(list, blk);
+
 	/* coalesce with next block */
 	while (!mb_is_guard(blk)) {
-		mb_valid(blk->next);
+		mb_valid(list, mb_get_next(blk));
 
 		I(!mb_is_used(blk));
 
-		if ((uint32_t)blk + blk->size != (uint32_t)blk->next) {
-			mb_t *next = (mb_t *)((uint32_t)blk + blk->size);
+		if ((uintptr_t)blk + blk->size != (uintptr_t)mb_get_next(blk)) {
+			mb_t *next = (mb_t *)((uintptr_t)blk + blk->size);
 
 			/* merge with pad block */
-			if (((uint32_t)next < (uint32_t)list + list->size) && (next->flags & MB_FLAG_PAD)) {
-				blk->size += 8;
+			if (((uintptr_t)next < (uintptr_t)list + list->size) && (next->flags & MB_FLAG_PAD)) {
+				blk->size += sizeof(mb_t);
 
 				if (mb_is_last(next))
 					blk->flags |= MB_FLAG_LAST;
 
-				mb_touch(blk);
+				mb_touch(list, blk);
 
 				list->blkcnt--;
 				list->ublkcnt--;
-				list->fmemcnt += 8;
+				list->fmemcnt += sizeof(mb_t);
 
-				mb_touch(list);
+				mb_touch(list, list);
 			}
 
 			break;
 		}
 
 		/* 'next' cannot be guard, because of condition above */
-		mb_free_t *next = blk->next;
+		mb_free_t *next = mb_get_next(blk);
 
-		mb_pullout(next);
+		mb_pullout(list, next);
 
 		blk->size += next->size;
 
 		if (mb_is_last(next))
 			blk->flags |= MB_FLAG_LAST;
 
-		mb_touch(blk);
+		mb_touch(list, blk);
 
 		list->blkcnt--;
 		list->fmemcnt += sizeof(mb_t);
 
-		mb_touch(list);
+		mb_touch(list, list);
 	}
 
 	/* coalesce with previous block */
 	while (!mb_is_guard(blk)) {
-		mb_valid(blk->prev);
+		mb_free_t *prev = mb_get_prev(blk);
 
-		if ((uint32_t)blk->prev + blk->prev->size != (uint32_t)blk)
+		mb_valid(list, prev);
+
+		if ((uintptr_t)prev + prev->size != (uintptr_t)blk)
 			break;
 
 		/* 'blk' nor 'next' cannot be guard, because of condition above */
 		mb_free_t *next = blk;
 
-		blk = blk->prev;
+		blk = prev;
 
-		mb_pullout(next);
+		mb_bin_remove(list, blk);
+		mb_pullout(list, next);
 
 		blk->size += next->size;
 
 		if (mb_is_last(next))
 			blk->flags |= MB_FLAG_LAST;
 
-		mb_touch(blk);
+		mb_touch(list, blk);
 
 		list->blkcnt--;
 		list->fmemcnt += sizeof(mb_t);
 		
-		mb_touch(list);
+		mb_touch(list, list);
 	}
 
 #ifdef DEADMEMORY
-	uint32_t *ptr = (uint32_t *)((uint32_t)blk + sizeof(mb_free_t));
+	uint32_t *ptr = (uint32_t *)((uintptr_t)blk + sizeof(mb_free_t));
 
-	while (ptr < (uint32_t *)((uint32_t)blk + blk->size))
+	while (ptr < (uint32_t *)((uintptr_t)blk + blk->size))
 		*ptr++ = 0xDEADC0DE;
 #endif
 
+	mb_link(list, blk);
+
+	mb_bin_insert(list, blk);
+
 	return blk;
 }/*}}}*/
 
@@ -259,23 +672,33 @@ bool mb_verify(mb_list_t *list, bool verbose)/*{{{*/
 	bool error = FALSE;
 
 	/* check if it is guard block */
-	mb_valid(list);
+	mb_check(list, list);
 	I(mb_is_guard(list));
 
 	/* find first block */
-	mb_t *blk = (mb_t *)((uint32_t)list + sizeof(mb_list_t));
+	mb_t *blk = (mb_t *)((uintptr_t)list + sizeof(mb_list_t));
 
 	if (verbose)
-		fprintf(stderr, "  \033[1;36mblocks in range $%.8x - $%.8x:\033[0m\n", (uint32_t)blk, ((uint32_t)list + list->size));
+		fprintf(stderr, "  \033[1;36mblocks in range %p - %p:\033[0m\n", (void *)blk, (void *)list + list->size);
 
-	uint32_t used = 0, free = 0, largest = 0, free_blocks = 0, used_blocks = 0;
+	uint32_t used = 0, free = 0, largest = 0, free_blocks = 0, used_blocks = 0, binned_blocks = 0;
 
 	mb_free_t *first_free = (mb_free_t *)list, *last_free = (mb_free_t *)list;
 
-	while ((uint32_t)blk < (uint32_t)list + list->size) {
+	uint32_t prev_size = 0;
+
+	while ((uintptr_t)blk < (uintptr_t)list + list->size) {
 		uint8_t errortype = 0;
 
-		mb_valid(blk);
+		mb_check(list, blk);
+
+		/* boundary tag must match size of preceding block */
+		if (blk->prev_size != prev_size) {
+			errortype = 5;
+			error |= TRUE;
+		}
+
+		prev_size = blk->size;
 
 		if (!mb_is_used(blk)) {
 			if (first_free == (mb_free_t *)list)
@@ -284,12 +707,12 @@ bool mb_verify(mb_list_t *list, bool verbose)/*{{{*/
 				last_free = (mb_free_t *)blk;
 		}
 
-		if (mb_is_first(blk) && ((uint32_t)blk != (uint32_t)list + sizeof(mb_list_t))) {
+		if (mb_is_first(blk) && ((uintptr_t)blk != (uintptr_t)list + sizeof(mb_list_t))) {
 			errortype = 1;
 			error |= TRUE;
 		}
 
-		if (mb_is_last(blk) && ((uint32_t)blk + blk->size != (uint32_t)list + list->size)) {
+		if (mb_is_last(blk) && ((uintptr_t)blk + blk->size != (uintptr_t)list + list->size)) {
 			errortype = 2;
 			error |= TRUE;
 		}
@@ -309,10 +732,13 @@ bool mb_verify(mb_list_t *list, bool verbose)/*{{{*/
 			if (largest < blk->size)
 				largest = blk->size;
 
+			if (blk->size >= sizeof(mb_binned_t))
+				binned_blocks++;
+
 			free_blocks++;
 		}
 
-		if (((uint32_t)blk + blk->size == (uint32_t)list + list->size) && !mb_is_last(blk)) {
+		if (((uintptr_t)blk + blk->size == (uintptr_t)list + list->size) && !mb_is_last(blk)) {
 			errortype = 4;
 			error |= TRUE;
 		}
@@ -321,21 +747,23 @@ bool mb_verify(mb_list_t *list, bool verbose)/*{{{*/
 		
 		if (blk->flags & MB_FLAG_PAD)
 			c = '7';
+		else if (blk->flags & MB_FLAG_QUICK)
+			c = '6';
 		else if (mb_is_used(blk))
 			c = '1';
 		else
 			c = '2';
 
 		if (verbose)
-			fprintf(stderr, "\033[1;3%cm   $%.8x - $%.8x : %c%c : %5d",
-					c, (uint32_t)blk, (uint32_t)blk + blk->size,
+			fprintf(stderr, "\033[1;3%cm   %p - %p : %c%c : %5d",
+					c, (void *)blk, (void *)blk + blk->size,
 					mb_is_first(blk) ? 'F' : '-', mb_is_last(blk) ? 'L' : '-', blk->size);
 
 		if (!mb_is_used(blk)) {
 			mb_free_t *fblk = (mb_free_t *)blk;
 
 			if (verbose)
-				fprintf(stderr, " : $%.8x $%8x", (uint32_t)fblk->prev, (uint32_t)fblk->next);
+				fprintf(stderr, " : %p %p", (void *)mb_get_prev(fblk), (void *)mb_get_next(fblk));
 		}
 
 		if (errortype > 0) {
@@ -346,23 +774,58 @@ bool mb_verify(mb_list_t *list, bool verbose)/*{{{*/
 		if (verbose)
 			fprintf(stderr, "\033[0m\n");
 
-		blk = (mb_t *)((uint32_t)blk + blk->size);
+		blk = (mb_t *)((uintptr_t)blk + blk->size);
 	}
 
+	/* guard keeps size of the last block */
+	error |= (list->prev_size != prev_size);
+
+	/* check if bins contain all large enough free blocks */
+	uint32_t i, binned = 0;
+
+	for (i = 0; i < MB_BIN_COUNT; i++) {
+		mb_binned_t *bblk = mb_bin_first(list, i);
+
+		error |= ((bblk != NULL) != ((list->bitmap >> i) & 1));
+
+		mb_binned_t *prev = NULL;
+
+		while (bblk != NULL) {
+			error |= mb_is_used(bblk) || !(bblk->flags & MB_FLAG_BINNED) || (mb_bin_index(bblk->size) != i);
+
+			/* first block links to the last one */
+			if (prev != NULL)
+				error |= (mb_bin_prev(bblk) != prev);
+
+			binned++;
+
+			prev = bblk;
+			bblk = mb_bin_next(bblk);
+		}
+
+		if (prev != NULL)
+			error |= (mb_bin_last(list, i) != prev);
+	}
+
+	binned += mb_tree_verify(list, &error);
+
+	error |= (binned != binned_blocks);
+
 	float fragmentation = (free != 0) ? ((float)(largest - sizeof(mb_t)) / (float)free) * 100.0 : 0.0;
 
 	if (verbose) {
 		fprintf(stderr, "\033[1;36m   Size: %d, Used: %d, Free: %d\033[0m\n", list->size, used, list->fmemcnt);
 		fprintf(stderr, "\033[1;36m   Largest free block: %d, Fragmentation: %.2f%%\033[0m\n", largest, fragmentation);
 		fprintf(stderr, "\033[0;36m   Blocks: %u, free blocks: %u, used blocks: %u.\033[0m\n", list->blkcnt, list->blkcnt - list->ublkcnt, list->ublkcnt);
-		fprintf(stderr, "\033[0;36m   First free block: $%.8x, last free block: $%.8x.\033[0m\n", (uint32_t)list->next, (uint32_t)list->prev);
+		fprintf(stderr, "\033[0;36m   First free block: %p, last free block: %p.\033[0m\n", (void *)mb_get_next(list), (void *)mb_get_prev(list));
+		fprintf(stderr, "\033[0;36m   Binned blocks: %u, bins bitmap: $%.16llx.\033[0m\n", binned, (unsigned long long)list->bitmap);
 	}
 
 	I(list->blkcnt == used_blocks + free_blocks);
 	I(list->ublkcnt == used_blocks);
 	I(list->fmemcnt == free);
-	I(first_free == list->next);
-	I(last_free == list->prev);
+	I(first_free == mb_get_next(list));
+	I(last_free == mb_get_prev(list));
 
 	if (error && verbose)
 		fprintf(stderr, "\033[7m   Invalid!\033[0m\n");
@@ -374,36 +837,49 @@ bool mb_verify(mb_list_t *list, bool verbose)/*{{{*/
  * Create initial block in given memory area.
  * @param list
  * @param size
+ * @param key
  */
 
-void mb_init(mb_list_t *list, uint32_t size)/*{{{*/
+void mb_init(mb_list_t *list, uint32_t size, uint32_t key)/*{{{*/
 {
 	/* first memory block to be managed */
-	mb_free_t *blk = (mb_free_t *)((uint32_t)list + sizeof(mb_list_t));
+	mb_free_t *blk = (mb_free_t *)((uintptr_t)list + sizeof(mb_list_t));
+
+#if CHECKSUM == CHECKSUM_KEYED
+	list->key = key;
+#endif
 
 	/* initialize guard block */
-	list->prev  = blk;
-	list->next  = blk;
+	list->prev_size = size - sizeof(mb_list_t);
+	mb_set_prev(list, blk);
+	mb_set_next(list, blk);
 	list->size  = size;
 	list->flags = MB_FLAG_GUARD;
 
 	list->fmemcnt = list->size - (sizeof(mb_t) + sizeof(mb_list_t));
 	list->blkcnt  = 1;
 	list->ublkcnt = 0;
+	list->bitmap  = 0;
+	list->tree    = 0;
+
+	memset(list->bin, 0, sizeof(list->bin));
 
-	mb_touch(list);
+	mb_touch(list, list);
 
-	DEBUG("list guard [$%.8x; %u; $%.2x]\n", (uint32_t)list, list->size, list->flags);
+	DEBUG("list guard [%p; %u; $%.2x]\n", (void *)list, list->size, list->flags);
 
 	/* initialize first free block */
-	blk->prev  = (mb_free_t *)list;
-	blk->next  = (mb_free_t *)list;
+	blk->prev_size = 0;
+	mb_set_prev(blk, list);
+	mb_set_next(blk, list);
 	blk->size  = list->size - sizeof(mb_list_t);
 	blk->flags = MB_FLAG_FIRST | MB_FLAG_LAST;
 
-	mb_touch(blk);
+	mb_touch(list, blk);
+
+	mb_bin_insert(list, blk);
 
-	DEBUG("first block [$%.8x; %u; $%.2x]\n", (uint32_t)blk, blk->size, blk->flags);
+	DEBUG("first block [%p; %u; $%.2x]\n", (void *)blk, blk->size, blk->flags);
 }/*}}}*/
 
 /**
@@ -417,53 +893,62 @@ void mb_init(mb_list_t *list, uint32_t size)/*{{{*/
 void *mb_alloc(mb_list_t *list, uint32_t size, bool from_last)/*{{{*/
 {
 	/* check if it is guard block */
-	mb_valid(list);
+	mb_valid(list, list);
 
 	I(mb_is_guard(list));
 
 	/* calculate block size */
 	size = ALIGN(size + sizeof(mb_t), MB_GRANULARITY);
 
-	/* browse free blocks list */
-	mb_free_t *blk = (from_last) ? (list->prev) : (list->next);
+	mb_free_t *blk;
 
-	while (TRUE) {
-		mb_valid(blk);
+	if (!from_last && (size >= sizeof(mb_binned_t))) {
+		/* look up bins of free blocks */
+		blk = mb_bin_find(list, size);
 
-		if (mb_is_guard(blk))
+		if (blk == NULL)
 			return NULL;
-		
-		if (blk->size >= size)
-			break;
 
-		blk = blk->next;
-	}
+		mb_valid(list, blk);
+	} else {
+		/* browse free blocks list */
+		blk = (from_last) ? mb_get_prev(list) : mb_get_next(list);
+
+		while (TRUE) {
+			mb_valid(list, blk);
 
-	if (blk == NULL)
-		return blk;
+			if (mb_is_guard(blk))
+				return NULL;
+			
+			if (blk->size >= size)
+				break;
 
-	DEBUG("found block [$%.8x; %u; $%.2x]\n", (uint32_t)blk, blk->size, blk->flags);
+			blk = mb_get_next(blk);
+		}
+	}
+
+	DEBUG("found block [%p; %u; $%.2x]\n", (void *)blk, blk->size, blk->flags);
 	
 	/* try to split block and save the rest on the list */
 	mb_split(list, &blk, size, mb_is_first(blk));
 
 	/* block is ready to be pulled out of list */
-	mb_pullout(blk);
+	mb_pullout(list, blk);
 
 	/* mark block as used */
 	blk->flags |= MB_FLAG_USED;
 
-	mb_touch(blk);
+	mb_touch(list, blk);
 
 	/* increase amount of used blocks */
 	list->ublkcnt++;
 	list->fmemcnt -= blk->size - sizeof(mb_t);
 
-	mb_touch(list);
+	mb_touch(list, list);
 
-	DEBUG("will use block [$%.8x; %u; $%.2x]\n", (uint32_t)blk, blk->size, blk->flags);
+	DEBUG("will use block [%p; %u; $%.2x]\n", (void *)blk, blk->size, blk->flags);
 
-	return (void *)((uint32_t)blk + sizeof(mb_t));
+	return (void *)((uintptr_t)blk + sizeof(mb_t));
 }/*}}}*/
 
 /**
@@ -477,7 +962,7 @@ void *mb_alloc(mb_list_t *list, uint32_t size, bool from_last)/*{{{*/
 void *mb_alloc_aligned(mb_list_t *list, uint32_t size, uint32_t alignment)/*{{{*/
 {
 	/* check if it is guard block */
-	mb_valid(list);
+	mb_valid(list, list);
 	I(mb_is_guard(list));
 
 	if (alignment <= MB_GRANULARITY)
@@ -486,74 +971,76 @@ void *mb_alloc_aligned(mb_list_t *list, uint32_t size, uint32_t alignment)/*{{{*
 	size = ALIGN(size, MB_GRANULARITY);
 
 	/* browse free blocks list */
-	uint32_t start = 0;
-	uint32_t base  = 0;
-	uint32_t end   = 0;
+	uintptr_t start = 0;
+	uintptr_t base  = 0;
+	uintptr_t end   = 0;
 
-	mb_free_t *blk = list->next;
+	mb_free_t *blk = mb_get_next(list);
 
 	while (TRUE) {
-		mb_valid(blk);
+		mb_valid(list, blk);
 
 		if (mb_is_guard(blk))
 			return NULL;
 
-		start = (uint32_t)blk;
+		start = (uintptr_t)blk;
 		base  = ALIGN(start + sizeof(mb_t), alignment);
 		end   = start + blk->size;
 
-		if ((base + size <= end) &&
-			((base - start == sizeof(mb_t)) ||
-			 (base - start >= sizeof(mb_t) + sizeof(mb_free_t))))
+		/* space before aligned block is too small to become a free block */
+		if ((base - start != sizeof(mb_t)) && (base - start < sizeof(mb_t) + sizeof(mb_free_t)))
+			base += alignment;
+
+		if (base + size <= end)
 			break;
 
-		blk = blk->next;
+		blk = mb_get_next(blk);
 	}
 
 	/* now we're sure that we found place for our new aligned block,
 	 * however work is not done, even two new block have to be created */
 
-	DEBUG("will split block [$%.8x; %u; $%.2x] for use by aligned memory\n", (uint32_t)blk, blk->size, blk->flags);
+	DEBUG("will split block [%p; %u; $%.2x] for use by aligned memory\n", (void *)blk, blk->size, blk->flags);
 
 	/* split block to create new block from unused space after aligned block */
 	if (end - (base + size) >= sizeof(mb_free_t)) {
 		mb_split(list, &blk, end - (base + size), TRUE);
 
-		DEBUG("splitted 'after' block: [$%.8x; %u; $%.2x]\n", (uint32_t)blk, blk->size, blk->flags);
+		DEBUG("splitted 'after' block: [%p; %u; $%.2x]\n", (void *)blk, blk->size, blk->flags);
 
-		blk = blk->prev;
+		blk = mb_get_prev(blk);
 	}
 
-	DEBUG("%d\n", (base - sizeof(mb_t)) - start);
+	DEBUG("%zu\n", (base - sizeof(mb_t)) - start);
 
 	/* split block to create new block from unused space before aligned block */
 	if (base - start >= sizeof(mb_t) + sizeof(mb_free_t)) {
 		mb_split(list, &blk, (base - sizeof(mb_t)) - start, FALSE);
 
-		DEBUG("splitted 'before' block: [$%.8x; %u; $%.2x]\n", (uint32_t)blk, blk->size, blk->flags);
+		DEBUG("splitted 'before' block: [%p; %u; $%.2x]\n", (void *)blk, blk->size, blk->flags);
 
-		blk = blk->next;
+		blk = mb_get_next(blk);
 	}
 
-	DEBUG("will use block [$%.8x; %u; $%.2x]\n", (uint32_t)blk, blk->size, blk->flags);
+	DEBUG("will use block [%p; %u; $%.2x]\n", (void *)blk, blk->size, blk->flags);
 
-	I((uint32_t)blk + sizeof(mb_t) == ALIGN((uint32_t)blk + sizeof(mb_t), alignment));
+	I((uintptr_t)blk + sizeof(mb_t) == ALIGN((uintptr_t)blk + sizeof(mb_t), alignment));
 
 	/* block is ready to be pulled out of list */
-	mb_pullout(blk);
+	mb_pullout(list, blk);
 
 	/* mark block as used */
 	blk->flags |= MB_FLAG_USED;
 
-	mb_touch(blk);
+	mb_touch(list, blk);
 
 	/* increase amount of used blocks */
 	list->ublkcnt++;
 	list->fmemcnt -= blk->size - sizeof(mb_t);
 
-	mb_touch(list);
+	mb_touch(list, list);
 
-	return (void *)((uint32_t)blk + sizeof(mb_t));
+	return (void *)((uintptr_t)blk + sizeof(mb_t));
 }/*}}}*/
 
 /**
@@ -567,19 +1054,19 @@ void *mb_alloc_aligned(mb_list_t *list, uint32_t size, uint32_t alignment)/*{{{*
 bool mb_resize(mb_list_t *list, void *memory, uint32_t new_size)/*{{{*/
 {
 	/* check if it is guard block */
-	mb_valid(list);
+	mb_valid(list, list);
 	I(mb_is_guard(list));
 	I(new_size > 0);
 
-	mb_t *blk = (mb_t *)((uint32_t)memory - sizeof(mb_t));
+	mb_t *blk = (mb_t *)((uintptr_t)memory - sizeof(mb_t));
 
-	mb_valid(blk);
+	mb_valid(list, blk);
 
 	uint32_t old_size = blk->size;
 
 	new_size = ALIGN(new_size + sizeof(mb_t), MB_GRANULARITY);
 
-	DEBUG("resizing block at $%.8x from %u to %u.\n", (uint32_t)blk, old_size, new_size);
+	DEBUG("resizing block at %p from %u to %u.\n", (void *)blk, old_size, new_size);
 
 	/* is resizing really needed ? */
 	if (old_size == new_size)
@@ -588,10 +1075,10 @@ bool mb_resize(mb_list_t *list, void *memory, uint32_t new_size)/*{{{*/
 	/* find next block */
 	mb_t *next = NULL;
 
-	if ((uint32_t)blk + blk->size < (uint32_t)list + list->size) {
-		next = (mb_t *)((uint32_t)blk + blk->size);
+	if ((uintptr_t)blk + blk->size < (uintptr_t)list + list->size) {
+		next = (mb_t *)((uintptr_t)blk + blk->size);
 	
-		DEBUG("found next block [$%.8x; %u; $%.2x]\n", (uint32_t)next, next->size, next->flags);
+		DEBUG("found next block [%p; %u; $%.2x]\n", (void *)next, next->size, next->flags);
 	}
 
 	if (old_size > new_size) {
@@ -602,10 +1089,10 @@ bool mb_resize(mb_list_t *list, void *memory, uint32_t new_size)/*{{{*/
 
 		/* resize block */
 		blk->size = new_size;
-		mb_touch(blk);
+		mb_touch(list, blk);
 
 		/* create new free block from leftovers */
-		mb_free_t *new = (mb_free_t *)((uint32_t)blk + new_size);
+		mb_free_t *new = (mb_free_t *)((uintptr_t)blk + new_size);
 
 		new->flags = 0;
 		
@@ -613,19 +1100,22 @@ bool mb_resize(mb_list_t *list, void *memory, uint32_t new_size)/*{{{*/
 			new->flags |= MB_FLAG_LAST;
 			blk->flags &= ~MB_FLAG_LAST;
 			
-			mb_touch(blk);
+			mb_touch(list, blk);
 		}
 
 		new->size  = old_size - new_size;
-		new->prev  = NULL;
-		new->next  = NULL;
-		mb_touch(new);
+		new->prev  = 0;
+		new->next  = 0;
+		mb_touch(list, new);
+
+		mb_link(list, blk);
+		mb_link(list, new);
 
 		mb_insert(list, new);
 
 		list->fmemcnt += new->size - sizeof(mb_t);
 		list->blkcnt  += 1;
-		mb_touch(list);
+		mb_touch(list, list);
 
 		if (next && (!mb_is_used(next) || (next->flags & MB_FLAG_PAD)))
 			mb_coalesce(list, new);
@@ -637,7 +1127,7 @@ bool mb_resize(mb_list_t *list, void *memory, uint32_t new_size)/*{{{*/
 
 		uint32_t diff = new_size - old_size;
 
-		DEBUG("expanding block at $%.8x by %u bytes.\n", (uint32_t)blk, diff);
+		DEBUG("expanding block at %p by %u bytes.\n", (void *)blk, diff);
 
 		DEBUG("next_size %u; diff %u.\n", next->size, diff);
 
@@ -647,42 +1137,54 @@ bool mb_resize(mb_list_t *list, void *memory, uint32_t new_size)/*{{{*/
 
 			blk->size += next->size;
 
-			mb_touch(blk);
+			mb_touch(list, blk);
+
+			mb_pullout(list, (mb_free_t *)next);
 
-			mb_pullout((mb_free_t *)next);
+			mb_link(list, blk);
 
 			list->blkcnt--;
 			list->fmemcnt -= next->size - sizeof(mb_t);
 
-			mb_touch(list);
+			mb_touch(list, list);
 		} else {
-			mb_free_t *moved = (mb_free_t *)((uint32_t)blk + new_size);
+			mb_free_t *moved = (mb_free_t *)((uintptr_t)blk + new_size);
+
+			DEBUG("moving block %p to %p.\n", (void *)next, (void *)moved);
+
+			mb_bin_remove(list, (mb_free_t *)next);
 
-			DEBUG("moving block $%.8x to $%.8x.\n", (uint32_t)next, (uint32_t)moved);
+			mb_free_t *prev = mb_get_prev(next);
+			mb_free_t *succ = mb_get_next(next);
 
-			moved->prev  = ((mb_free_t *)next)->prev;
-			moved->next  = ((mb_free_t *)next)->next;
+			mb_set_prev(moved, prev);
+			mb_set_next(moved, succ);
 
 			moved->size  = next->size - diff;
 			moved->flags = next->flags;
 
-			moved->prev->next = moved;
-			moved->next->prev = moved;
+			mb_set_next(prev, moved);
+			mb_set_prev(succ, moved);
 
-			mb_touch(moved->prev);
-			mb_touch(moved->next);
+			mb_touch(list, prev);
+			mb_touch(list, succ);
 
-			mb_touch(moved);
+			mb_touch(list, moved);
 
-			DEBUG("moved block [$%.8x; %u; $%.2x]\n", (uint32_t)moved, moved->size, moved->flags);
+			mb_bin_insert(list, moved);
+
+			DEBUG("moved block [%p; %u; $%.2x]\n", (void *)moved, moved->size, moved->flags);
 
 			blk->size = new_size;
 
-			mb_touch(blk);
+			mb_touch(list, blk);
+
+			mb_link(list, blk);
+			mb_link(list, moved);
 
 			list->fmemcnt -= diff;
 
-			mb_touch(list);
+			mb_touch(list, list);
 		}
 	}
 
@@ -699,23 +1201,23 @@ bool mb_resize(mb_list_t *list, void *memory, uint32_t new_size)/*{{{*/
 mb_free_t *mb_free(mb_list_t *list, void *memory)/*{{{*/
 {
 	/* check if it is guard block */
-	mb_valid(list);
+	mb_valid(list, list);
 	I(mb_is_guard(list));
 
-	mb_t *blk = (mb_t *)((uint32_t)memory - sizeof(mb_t));
+	mb_t *blk = (mb_t *)((uintptr_t)memory - sizeof(mb_t));
 
-	mb_valid(blk);
+	mb_valid(list, blk);
 
-	DEBUG("requested to free block at $%.8x\n", (uint32_t)blk);
+	DEBUG("requested to free block at %p\n", (void *)blk);
 
 	/* mark block as free */
 	mb_free_t *fblk = (mb_free_t *)blk;
 
 	fblk->flags &= ~MB_FLAG_USED;
-	fblk->prev   = NULL;
-	fblk->next   = NULL;
+	fblk->prev   = 0;
+	fblk->next   = 0;
 
-	mb_touch(fblk);
+	mb_touch(list, fblk);
 
 	/* insert on free list and coalesce */
 	mb_insert(list, fblk);
@@ -724,11 +1226,190 @@ mb_free_t *mb_free(mb_list_t *list, void *memory)/*{{{*/
 	list->ublkcnt--;
 	list->fmemcnt += fblk->size - sizeof(mb_t);
 
-	mb_touch(list);
+	mb_touch(list, list);
 	
 	return mb_coalesce(list, fblk);
 }/*}}}*/
 
+/**
+ * Initialize empty quick lists.
+ * @param quick
+ */
+
+void mb_quick_init(mb_quick_lists_t *quick)/*{{{*/
+{
+	memset(quick->bin, 0, sizeof(quick->bin));
+	memset(quick->cnt, 0, sizeof(quick->cnt));
+
+	quick->memcnt = 0;
+}/*}}}*/
+
+/**
+ * Put block being freed on a quick list instead of returning it to its area.
+ * @param quick
+ * @param memory
+ * @return			FALSE if the block cannot be deferred
+ */
+
+bool mb_quick_push(mb_quick_lists_t *quick, void *memory)/*{{{*/
+{
+	mb_quick_t *blk = (mb_quick_t *)((uintptr_t)memory - sizeof(mb_t));
+
+	mb_valid_private(blk);
+
+	I(mb_is_used(blk) && !(blk->flags & (MB_FLAG_PAD | MB_FLAG_QUICK)));
+
+	if ((blk->size < sizeof(mb_binned_t)) || (blk->size > MB_QUICK_MAX))
+		return FALSE;
+
+	uint32_t i = mb_bin_index(blk->size);
+
+	if ((quick->cnt[i] >= MB_QUICK_DEPTH) || (quick->memcnt + blk->size > MB_QUICK_LIMIT))
+		return FALSE;
+
+	blk->flags |= MB_FLAG_QUICK;
+
+	mb_touch_private(blk);
+
+	blk->next	  = quick->bin[i];
+	quick->bin[i] = blk;
+
+	quick->cnt[i]++;
+	quick->memcnt += blk->size;
+
+	DEBUG("deferred block [%p; %u; $%.2x] on quick list %u\n", (void *)blk, blk->size, blk->flags, i);
+
+	return TRUE;
+}/*}}}*/
+
+/**
+ * Take block from a quick list. Only a block that would be handed out by
+ * mb_alloc for the same request, i.e. one that is too small to be split, is
+ * taken.
+ * @param quick
+ * @param size
+ * @return
+ */
+
+void *mb_quick_pop(mb_quick_lists_t *quick, uint32_t size)/*{{{*/
+{
+	size = ALIGN(size + sizeof(mb_t), MB_GRANULARITY);
+
+	if ((size < sizeof(mb_binned_t)) || (size > MB_QUICK_MAX))
+		return NULL;
+
+	mb_quick_t **link = &quick->bin[mb_bin_index(size)];
+
+	while (*link != NULL) {
+		mb_quick_t *blk = *link;
+
+		mb_valid_private(blk);
+
+		if ((blk->size >= size) && (blk->size - size < sizeof(mb_free_t))) {
+			uint32_t i = mb_bin_index(blk->size);
+
+			*link = blk->next;
+
+			quick->cnt[i]--;
+			quick->memcnt -= blk->size;
+
+			blk->flags &= ~MB_FLAG_QUICK;
+
+			mb_touch_private(blk);
+
+			DEBUG("reused block [%p; %u; $%.2x] from quick list %u\n", (void *)blk, blk->size, blk->flags, i);
+
+			return (void *)((uintptr_t)blk + sizeof(mb_t));
+		}
+
+		link = &blk->next;
+	}
+
+	return NULL;
+}/*}}}*/
+
+/**
+ * Empty all quick lists at once. Blocks are returned as single list, so they
+ * can be freed by the caller.
+ * @param quick
+ * @return
+ */
+
+mb_quick_t *mb_quick_drain(mb_quick_lists_t *quick)/*{{{*/
+{
+	mb_quick_t *first = NULL;
+
+	uint32_t i;
+
+	for (i = 0; i < MB_QUICK_COUNT; i++) {
+		while (quick->bin[i] != NULL) {
+			mb_quick_t *blk = quick->bin[i];
+
+			mb_valid_private(blk);
+
+			quick->bin[i] = blk->next;
+
+			blk->flags &= ~MB_FLAG_QUICK;
+			blk->next	= first;
+
+			mb_touch_private(blk);
+
+			first = blk;
+		}
+
+		quick->cnt[i] = 0;
+	}
+
+	quick->memcnt = 0;
+
+	return first;
+}/*}}}*/
+
+/**
+ * Check quick lists and print statistics.
+ * @param quick
+ * @param verbose
+ * @return
+ */
+
+bool mb_quick_verify(mb_quick_lists_t *quick, bool verbose)/*{{{*/
+{
+	bool error = FALSE;
+
+	uint32_t i, blocks = 0, memory = 0;
+
+	for (i = 0; i < MB_QUICK_COUNT; i++) {
+		mb_quick_t *blk = quick->bin[i];
+
+		uint32_t cnt = 0;
+
+		while (blk != NULL) {
+			mb_check_private(blk);
+
+			error |= !mb_is_used(blk) || !(blk->flags & MB_FLAG_QUICK) || (mb_bin_index(blk->size) != i);
+
+			memory += blk->size;
+			cnt++;
+
+			blk = blk->next;
+		}
+
+		error |= (cnt != quick->cnt[i]) || (cnt > MB_QUICK_DEPTH);
+
+		blocks += cnt;
+	}
+
+	error |= (memory != quick->memcnt);
+
+	if (verbose)
+		fprintf(stderr, "\033[0;36m  Quick lists: %u blocks, %u bytes.\033[0m\n", blocks, memory);
+
+	if (error && verbose)
+		fprintf(stderr, "\033[7m  Invalid!\033[0m\n");
+
+	return error;
+}/*}}}*/
+
 /**
  * Find last block in area managed by block manager.
  * @param guard
@@ -737,27 +1418,18 @@ mb_free_t *mb_free(mb_list_t *list, void *memory)/*{{{*/
 
 static mb_t *mb_list_find_last(mb_list_t *list)/*{{{*/
 {
-	mb_valid(list);
+	mb_valid(list, list);
 
 	I(mb_is_guard(list));
 
-	mb_t *blk = (mb_t *)list->prev;
+	/* guard keeps size of the last block */
+	mb_t *blk = (mb_t *)((uintptr_t)list + list->size - list->prev_size);
 
-	if (!mb_is_last(blk)) {
-		if (mb_is_guard(blk))
-			blk = (mb_t *)((uint32_t)blk + sizeof(mb_list_t));
-
-		/* OPTIMIZE: Unfortunately 'blk' is not last block, it must be found! */
-		while ((uint32_t)blk + blk->size < (uint32_t)list + list->size) {
-			mb_valid(blk);
+	mb_valid(list, blk);
 
-			blk = (mb_t *)((uint32_t)blk + blk->size);
-		}
+	I(mb_is_last(blk));
 
-		I(mb_is_last(blk));
-	}
-
-	DEBUG("last block in list at $%.8x is: [$%.8x; %u; $%.2x]\n", (uint32_t)list, (uint32_t)blk, blk->size, blk->flags);
+	DEBUG("last block in list at %p is: [%p; %u; $%.2x]\n", (void *)list, (void *)blk, blk->size, blk->flags);
 
 	return blk;
 }/*}}}*/
@@ -768,33 +1440,36 @@ static mb_t *mb_list_find_last(mb_list_t *list)/*{{{*/
  * @return
  */
 
-uint32_t mb_list_can_shrink_at_end(mb_list_t *list, uint32_t space)/*{{{*/
+uint32_t mb_list_can_shrink_at_end(mb_list_t *list)/*{{{*/
 {
-	mb_valid(list);
-	mb_valid(list->prev);
+	mb_free_t *last = mb_get_prev(list);
+
+	mb_valid(list, list);
+	mb_valid(list, last);
 
 	I(mb_is_guard(list));
 
-	return (mb_is_last(list->prev)) ? list->prev->size / PAGE_SIZE : 0;
+	return (mb_is_last(last)) ? last->size / PAGE_SIZE : 0;
 }/*}}}*/
 
 /**
  * Check if there is unused room at the beginning of blocks' list.
  * @param list
- * @param space
  * @return
  */
 
-uint32_t mb_list_can_shrink_at_beginning(mb_list_t *list, uint32_t space)/*{{{*/
+uint32_t mb_list_can_shrink_at_beginning(mb_list_t *list)/*{{{*/
 {
-	mb_valid(list);
-	mb_valid(list->next);
+	mb_free_t *first = mb_get_next(list);
+
+	mb_valid(list, list);
+	mb_valid(list, first);
 
-	if (!mb_is_first(list->next))
+	if (!mb_is_first(first))
 		return 0;
 	
-	int32_t pages	 = list->next->size / PAGE_SIZE;
-	int32_t leftover = list->next->size - pages * PAGE_SIZE;
+	int32_t pages	 = first->size / PAGE_SIZE;
+	int32_t leftover = first->size - pages * PAGE_SIZE;
 
 	if (pages == 0)
 		return 0;
@@ -808,56 +1483,60 @@ uint32_t mb_list_can_shrink_at_beginning(mb_list_t *list, uint32_t space)/*{{{*/
  * @param pages
  */
 
-void mb_list_shrink_at_end(mb_list_t *list, uint32_t pages, uint32_t space)/*{{{*/
+void mb_list_shrink_at_end(mb_list_t *list, uint32_t pages)/*{{{*/
 {
-	mb_valid(list);
+	mb_valid(list, list);
 	I(pages > 0);
 	I(mb_is_guard(list));
 
-	DEBUG("will shrink list of blocks at $%.8x from right side by %u pages\n", (uint32_t)list, pages);
+	DEBUG("will shrink list of blocks at %p from right side by %u pages\n", (void *)list, pages);
 
-	mb_valid(list->prev);
-	I(mb_is_last(list->prev));
-	I(list->prev->size >= pages * PAGE_SIZE);
+	/* take care of last block */
+	mb_free_t *blk = mb_get_prev(list);
+
+	mb_valid(list, blk);
+	I(mb_is_last(blk));
+	I(blk->size >= pages * PAGE_SIZE);
 
 	/* shorten list */
 	list->size    -= pages * PAGE_SIZE;
 	list->fmemcnt -= pages * PAGE_SIZE;
-	mb_touch(list);
+	mb_touch(list, list);
 
-	/* take care of last block */
-	mb_free_t *blk = list->prev;
+	mb_bin_remove(list, blk);
 
 	blk->size -= pages * PAGE_SIZE;
-	mb_touch(blk);
+	mb_touch(list, blk);
 
-	if (blk->size <= 8) {
-		mb_pullout(blk);
+	if (blk->size >= sizeof(mb_t))
+		list->prev_size = blk->size;
 
-		if (blk->size == 8) {
+	if (blk->size > sizeof(mb_t)) {
+		mb_bin_insert(list, blk);
+	} else {
+		mb_pullout(list, blk);
+
+		if (blk->size == sizeof(mb_t)) {
 			blk->flags |= (MB_FLAG_PAD | MB_FLAG_USED);
-			mb_touch(blk);
+			mb_touch(list, blk);
 
 			list->ublkcnt++;
-			mb_touch(list);
+			mb_touch(list, list);
 		} else {
-			mb_t *last = (mb_t *)((uint32_t)list + sizeof(mb_list_t));
+			mb_t *last = mb_prev_block((mb_t *)blk);
 
-			while (TRUE) {
-				mb_valid(last);
-				
-				if ((uint32_t)last + last->size >= (uint32_t)list + list->size)
-					break;
+			mb_valid(list, last);
 
-				last = (mb_t *)((uint32_t)last + last->size);
-			}
+			I((uintptr_t)last + last->size == (uintptr_t)list + list->size);
 
 			last->flags |= MB_FLAG_LAST;
-			mb_touch(last);
+			mb_touch(list, last);
+
+			list->prev_size = last->size;
 
 			list->blkcnt--;
 			list->fmemcnt += sizeof(mb_t);
-			mb_touch(list);
+			mb_touch(list, list);
 		}
 	}
 }/*}}}*/
@@ -866,96 +1545,123 @@ void mb_list_shrink_at_end(mb_list_t *list, uint32_t pages, uint32_t space)/*{{{
  * Shrink blocks' list from the beginning.
  * @param to_shrink
  * @param pages
- * @param space
  */
 
-void mb_list_shrink_at_beginning(mb_list_t **to_shrink, uint32_t pages, uint32_t space)/*{{{*/
+void mb_list_shrink_at_beginning(mb_list_t **to_shrink, uint32_t pages)/*{{{*/
 {
 	mb_list_t *list    = *to_shrink;
 	mb_list_t *newlist = NULL;
 
-	mb_valid(list);
+	mb_valid(list, list);
 	I(mb_is_guard(list));
 	I(pages > 0);
 	
-	DEBUG("will shrink list of blocks at $%.8x from left side by %u pages\n", (uint32_t)list, pages);
+	DEBUG("will shrink list of blocks at %p from left side by %u pages\n", (void *)list, pages);
 
-	mb_valid(list->next);
-	I(mb_is_first(list->next));
+	mb_free_t *first = mb_get_next(list);
+	mb_free_t *last  = mb_get_prev(list);
+
+	mb_valid(list, first);
+	I(mb_is_first(first));
 	
 	/* Two posibilities: first free block can be removed or shrinked */
-	I(list->next->size - pages * PAGE_SIZE >= 0);
+	I(first->size >= pages * PAGE_SIZE);
 
-	if (list->next->size - pages * PAGE_SIZE == 0) {
+	if (first->size - pages * PAGE_SIZE == 0) {
 		/* remove first block */
-		mb_pullout(list->next);
+		mb_pullout(list, first);
 
-		newlist = (mb_list_t *)((uint32_t)list + pages * PAGE_SIZE);
+		newlist = (mb_list_t *)((uintptr_t)list + pages * PAGE_SIZE);
 
 		/* copy data to new guard block and correct pointers */
+		newlist->prev_size = list->prev_size;
 		newlist->size    = list->size - pages * PAGE_SIZE;
 		newlist->flags   = list->flags;
 		newlist->blkcnt  = list->blkcnt - 1;
 		newlist->ublkcnt = list->ublkcnt;
 		newlist->fmemcnt = list->fmemcnt - pages * PAGE_SIZE + sizeof(mb_t);
+#if CHECKSUM == CHECKSUM_KEYED
+		newlist->key     = list->key;
+#endif
 
-		if ((mb_free_t *)list == list->next) {
-			newlist->prev = (mb_free_t *)newlist;
-			newlist->next = (mb_free_t *)newlist;
+		mb_bin_move(newlist, list);
+
+		if ((mb_free_t *)list == mb_get_next(list)) {
+			mb_set_prev(newlist, newlist);
+			mb_set_next(newlist, newlist);
 		} else {
-			newlist->prev		= list->prev;
-			newlist->next		= list->next;
-			newlist->prev->next = (mb_free_t *)newlist;
-			newlist->next->prev = (mb_free_t *)newlist;
+			mb_free_t *prev = mb_get_prev(list);
+			mb_free_t *next = mb_get_next(list);
+
+			mb_set_prev(newlist, prev);
+			mb_set_next(newlist, next);
+			mb_set_next(prev, newlist);
+			mb_set_prev(next, newlist);
 
-			mb_touch(newlist->prev);
-			mb_touch(newlist->next);
+			mb_touch(list, prev);
+			mb_touch(list, next);
 		}
 
-		mb_touch(newlist);
+		mb_touch(list, newlist);
 
 		/* mark the block after newlist as MB_FLAG_FIRST */
-		mb_t *blk = (mb_t *)((uint32_t)newlist + sizeof(mb_list_t));
+		mb_t *blk = (mb_t *)((uintptr_t)newlist + sizeof(mb_list_t));
 		blk->flags |= MB_FLAG_FIRST;
-		mb_touch(blk);
+		blk->prev_size = 0;
+		mb_touch(list, blk);
 	} else {
-		newlist = (mb_list_t *)((uint32_t)list + pages * PAGE_SIZE);
+		newlist = (mb_list_t *)((uintptr_t)list + pages * PAGE_SIZE);
+
+		mb_free_t *newfirst = (mb_free_t *)((uintptr_t)first + pages * PAGE_SIZE);
+		mb_free_t *next		= mb_get_next(first);
 
-		mb_free_t *newfirst = (mb_free_t *)((uint32_t)list->next + pages * PAGE_SIZE);
+		/* first block will be moved */
+		mb_bin_remove(list, first);
 
 		/* copy list and first block in new place */
 		memcpy(newlist, list, sizeof(mb_list_t) + sizeof(mb_free_t));
 
+		mb_bin_move(newlist, list);
+
 		/* correct pointers in newlist and its neighbours */
 		newlist->size		-= pages * PAGE_SIZE;
-		newlist->next		 = newfirst;
-		newlist->prev->next  = (mb_free_t *)newlist;
 		newlist->fmemcnt	-= pages * PAGE_SIZE;
 
-		if (list->next == list->prev) {
-			newlist->prev       = newfirst;
-			newlist->next->next = (mb_free_t *)newlist;
+		mb_set_next(newlist, newfirst);
+		mb_set_prev(newfirst, newlist);
+
+		if (first == last) {
+			mb_set_prev(newlist, newfirst);
+			mb_set_next(newfirst, newlist);
+		} else {
+			mb_set_prev(newlist, last);
+			mb_set_next(last, newlist);
+			mb_set_next(newfirst, next);
+			mb_set_prev(next, newfirst);
+
+			mb_touch(list, last);
+			mb_touch(list, next);
 		}
 
-		mb_touch(newlist->prev);
-		mb_touch(newlist);
+		mb_touch(list, newlist);
 
-		/* correct pointers in newfirst and its neighbours */
+		/* correct size of newfirst */
 		newfirst->size		-= pages * PAGE_SIZE;
-		newfirst->prev		 = (mb_free_t *)newlist;
-		newfirst->next->prev = newfirst;
 
-		I(newfirst->size != 8);
+		I(newfirst->size != sizeof(mb_t));
 
-		mb_touch(newfirst);
-		mb_touch(newfirst->next);
+		mb_touch(list, newfirst);
+
+		mb_link(newlist, newfirst);
+
+		mb_bin_insert(newlist, newfirst);
 	}
 
-	DEBUG("new list: [$%.8x; %u; %.2x] [prev: $%.8x; next: $%.8x]\n",
-		  (uint32_t)newlist, newlist->size, newlist->flags, (uint32_t)newlist->prev, (uint32_t)newlist->next);
-	DEBUG("new first block: [$%.8x; %u; $%.2x] [prev: $%.8x; next: $%.8x]\n",
-		  (uint32_t)newlist->next, newlist->next->size, newlist->next->flags,
-		  (uint32_t)newlist->next->prev, (uint32_t)newlist->next->next);
+	DEBUG("new list: [%p; %u; %.2x] [prev: %p; next: %p]\n",
+		  (void *)newlist, newlist->size, newlist->flags, (void *)mb_get_prev(newlist), (void *)mb_get_next(newlist));
+	DEBUG("new first block: [%p; %u; $%.2x] [prev: %p; next: %p]\n",
+		  (void *)mb_get_next(newlist), mb_get_next(newlist)->size, mb_get_next(newlist)->flags,
+		  (void *)mb_get_prev(mb_get_next(newlist)), (void *)mb_get_next(mb_get_next(newlist)));
 
 	*to_shrink = newlist;
 }/*}}}*/
@@ -968,28 +1674,31 @@ void mb_list_shrink_at_beginning(mb_list_t **to_shrink, uint32_t pages, uint32_t
 
 void mb_list_expand(mb_list_t *list, uint32_t pages)/*{{{*/
 {
-	mb_valid(list);
+	mb_valid(list, list);
 	I(mb_is_guard(list));
 	I(pages > 0);
 
-	DEBUG("will expand list of block at $%.8x by %u pages\n", (uint32_t)list, pages);
+	DEBUG("will expand list of block at %p by %u pages\n", (void *)list, pages);
 
 	mb_t *blk = mb_list_find_last(list);
 
 	if (mb_is_used(blk)) {
-		mb_free_t *newblk = (mb_free_t *)((uint32_t)list + list->size);
+		mb_free_t *newblk = (mb_free_t *)((uintptr_t)list + list->size);
 
 		blk->flags &= ~MB_FLAG_LAST;
 
-		mb_touch(blk);
+		mb_touch(list, blk);
 
 		/* setup new block */
+		newblk->prev_size = blk->size;
 		newblk->size	= pages * PAGE_SIZE;
 		newblk->flags	= MB_FLAG_LAST;
-		newblk->prev	= NULL;
-		newblk->next	= NULL;
+		newblk->prev	= 0;
+		newblk->next	= 0;
+
+		mb_touch(list, newblk);
 
-		mb_touch(newblk);
+		list->prev_size = newblk->size;
 
 		/* insert new block into list of free blocks */
 		mb_insert(list, newblk);
@@ -997,100 +1706,102 @@ void mb_list_expand(mb_list_t *list, uint32_t pages)/*{{{*/
 		list->blkcnt  += 1;
 		list->fmemcnt -= sizeof(mb_t);
 	} else {
+		mb_bin_remove(list, (mb_free_t *)blk);
+
 		blk->size += pages * PAGE_SIZE;
 
-		mb_touch(blk);
+		mb_touch(list, blk);
+
+		list->prev_size = blk->size;
+
+		mb_bin_insert(list, (mb_free_t *)blk);
 	}
 
 	list->size    += pages * PAGE_SIZE;
 	list->fmemcnt += pages * PAGE_SIZE;
 
-	mb_touch(list);
+	mb_touch(list, list);
 }/*}}}*/
 
 /**
  * Merge two lists of memory blocks due to coalescing two memory areas.
  * @param first
  * @param second
- * @param space
  */
 
-mb_list_t *mb_list_merge(mb_list_t *first, mb_list_t *second, uint32_t space)/*{{{*/
+mb_list_t *mb_list_merge(mb_list_t *first, mb_list_t *second)/*{{{*/
 {
-	mb_valid(first);
-	mb_valid(second);
+	mb_valid(first, first);
+	mb_valid(first, second);
 
-	DEBUG("will merge following lists: [$%.8x; %u; $%.2x; %u; %u; %u] [$%.8x; %u; $%.2x; %u; %u; %u]\n",
-		  (uint32_t)first, first->size, first->flags, first->blkcnt, first->ublkcnt, first->fmemcnt,
-		  (uint32_t)second, second->size, second->flags, second->blkcnt, second->ublkcnt, second->fmemcnt);
+	DEBUG("will merge following lists: [%p; %u; $%.2x; %u; %u; %u] [%p; %u; $%.2x; %u; %u; %u]\n",
+		  (void *)first, first->size, first->flags, first->blkcnt, first->ublkcnt, first->fmemcnt,
+		  (void *)second, second->size, second->flags, second->blkcnt, second->ublkcnt, second->fmemcnt);
 
 	/* a few checks */
 	I(mb_is_guard(first));
 	I(mb_is_guard(second));
 
-	I(((uint32_t)first + first->size + space) == ((uint32_t)second));
-	I(space >= sizeof(mb_free_t));
+	I(((uintptr_t)first + first->size) == ((uintptr_t)second));
+
+	/* blocks from second list are moved to bins of joined list, only the
+	 * former guard of second list needs to be binned afterwards */
+	mb_bin_join(first, second);
 
 	/* last block in first memory blocks' list is not last in joined list */
 	mb_free_t *blk;
 
 	blk = (mb_free_t *)mb_list_find_last(first);
 	blk->flags &= ~MB_FLAG_LAST;
-	mb_touch(blk);
+	mb_touch(first, blk);
+
+	uint32_t last_size = blk->size;
 
 	/* first block in second memory blocks' list is not first in joined list */
-	blk = (mb_free_t *)((uint32_t)second + sizeof(mb_list_t));
+	blk = (mb_free_t *)((uintptr_t)second + sizeof(mb_list_t));
 	blk->flags &= ~MB_FLAG_FIRST;
-	mb_touch(blk);
+	blk->prev_size = sizeof(mb_list_t);
+	mb_touch(first, blk);
 
 	/* sum size of two lists */
-	first->size	   += second->size + space;
+	first->prev_size = second->prev_size;
+	first->size	   += second->size;
 	first->blkcnt  += second->blkcnt;
 	first->ublkcnt += second->ublkcnt;
 	first->fmemcnt += second->fmemcnt;
 
-	/* turn second guard into ordinary free block and increase its size by 'space' */
-	blk = (mb_free_t *)((uint32_t)second - space);
+	/* turn second guard into ordinary free block */
+	blk = (mb_free_t *)second;
 
+	blk->prev_size = last_size;
 	blk->flags = 0;
-	blk->size  = sizeof(mb_list_t) + space;
+	blk->size  = sizeof(mb_list_t);
 
 	first->blkcnt++;
 	first->fmemcnt += blk->size - sizeof(mb_t);
 	
-	if ((mb_free_t *)second == second->next) {
-		blk->next = blk;
-		blk->prev = blk;
-	} else {
-		blk->prev = second->prev;
-		blk->next = second->next;
+	/* guard's links are already links of the block, as both share address */
+	mb_free_t *last = mb_get_prev(first);
+	mb_free_t *prev = mb_get_prev(blk);
 
-		blk->prev->next = blk;
-		blk->next->prev = blk;
+	mb_set_next(prev, first);
+	mb_set_prev(first, prev);
+	mb_set_prev(blk, last);
+	mb_set_next(last, blk);
 
-		mb_touch(blk->next);
-	}
-
-	mb_free_t *last = first->prev;
-
-	blk->prev->next = (mb_free_t *)first;
-	first->prev 	= blk->prev;
-	blk->prev 		= last;
-	last->next		= blk;
-
-	DEBUG("first: [$%.8x; %u; $%.2x]\n", (uint32_t)first, first->size, first->flags);
-	DEBUG("last:  [$%.8x; %u; $%.2x]\n", (uint32_t)last, last->size, last->flags);
-	DEBUG("blk:   [$%.8x; %u; $%.2x]\n", (uint32_t)blk, blk->size, blk->flags);
+	DEBUG("first: [%p; %u; $%.2x]\n", (void *)first, first->size, first->flags);
+	DEBUG("last:  [%p; %u; $%.2x]\n", (void *)last, last->size, last->flags);
+	DEBUG("blk:   [%p; %u; $%.2x]\n", (void *)blk, blk->size, blk->flags);
 
-	mb_touch(first);
-	mb_touch(first->prev);
-	mb_touch(last);
-	mb_touch(blk);
+	mb_touch(first, first);
+	mb_touch(first, prev);
+	mb_touch(first, last);
+	mb_touch(first, blk);
 
 	mb_coalesce(first, blk);
 
-	DEBUG("merged into: [$%.8x; %u; $%.2x; %u; %u]\n",
-		  (uint32_t)first, first->size, first->flags, first->blkcnt, first->ublkcnt);
+	DEBUG("merged into: [%p; %u; $%.2x; %u; %u]\n",
+		  (void *)first, first->size, first->flags, first->blkcnt, first->ublkcnt);
 
 	return first;
 }/*}}}*/
@@ -1101,37 +1812,36 @@ mb_list_t *mb_list_merge(mb_list_t *first, mb_list_t *second, uint32_t space)/*{
  * @param list
  * @param to_split
  * @param cut
- * @param space
  * @return
  */
 
-uint32_t mb_list_find_split(mb_list_t *list, mb_free_t **to_split, void **cut, uint32_t space)/*{{{*/
+uint32_t mb_list_find_split(mb_list_t *list, mb_free_t **to_split, void **cut)/*{{{*/
 {
-	mb_valid(list);
+	mb_valid(list, list);
 	I(mb_is_guard(list));
 	I(to_split != NULL && cut != NULL);
 
-	mb_free_t *blk  = list->next;
+	mb_free_t *blk  = mb_get_next(list);
 
-	DEBUG("start searching for split-block from: [$%.8x; %u; $%.2x]\n", (uint32_t)blk, blk->size, blk->flags);
+	DEBUG("start searching for split-block from: [%p; %u; $%.2x]\n", (void *)blk, blk->size, blk->flags);
 
 	uint32_t pages	   = 0;
-	uint32_t end	   = 0;
-	uint32_t cut_point = 0;
-	uint32_t end_point = 0;
+	uintptr_t end	    = 0;
+	uintptr_t cut_point = 0;
+	uintptr_t end_point = 0;
 
 	*to_split = NULL;
 
 	/* browse free blocks list */
 	while (TRUE) {
-		mb_valid(blk);
+		mb_valid(list, blk);
 
 		if (mb_is_guard(blk))
 			break;
 
 		if (!mb_is_first(blk)) {
-			end       = (uint32_t)blk + blk->size;
-			cut_point = ALIGN_UP((uint32_t)blk + space, PAGE_SIZE);
+			end       = (uintptr_t)blk + blk->size;
+			cut_point = ALIGN_UP((uintptr_t)blk, PAGE_SIZE);
 			end_point = ALIGN_DOWN(end, PAGE_SIZE);
 
 			if (cut_point < end_point) {
@@ -1148,16 +1858,6 @@ uint32_t mb_list_find_split(mb_list_t *list, mb_free_t **to_split, void **cut, u
 				if (leftover < sizeof(mb_list_t))
 					pages--;
 
-				/* check if enough space at the begining */
-				leftover = cut_point - (uint32_t)blk;
-
-				I(leftover >= 0);
-
-				if (leftover < space) {
-					cut_point += PAGE_SIZE;
-					pages--;
-				}
-
 				/* and now everything is clean */
 				if (pages > 0) {
 					*to_split = blk;
@@ -1168,12 +1868,12 @@ uint32_t mb_list_find_split(mb_list_t *list, mb_free_t **to_split, void **cut, u
 			}
 		}
 
-		blk = blk->next;
+		blk = mb_get_next(blk);
 	}
 
 	if (pages > 0) {
-		DEBUG("split-block found: [$%.8x; %u; $%.2x], will cut [$%.8x; $%x]\n",
-			  (uint32_t)blk, blk->size, blk->flags, (uint32_t)cut_point, pages * PAGE_SIZE);
+		DEBUG("split-block found: [%p; %u; $%.2x], will cut [%p; $%zx]\n",
+			  (void *)blk, blk->size, blk->flags, (void *)cut_point, pages * PAGE_SIZE);
 	} else {
 		DEBUG("split-block not found\n");
 	}
@@ -1182,39 +1882,39 @@ uint32_t mb_list_find_split(mb_list_t *list, mb_free_t **to_split, void **cut, u
 }/*}}}*/
 
 /**
- * Recalculate statistics.
- * @param list
+ * Count blocks in given range and move free ones from bins of one list
+ * into bins of another list.
+ * @param from
+ * @param to
+ * @param blk
+ * @param end
+ * @param blocks
+ * @param used
+ * @param free
  */
 
-static void mb_list_recalculate_statistics(mb_list_t *list)/*{{{*/
+static void mb_list_move_blocks(mb_list_t *from, mb_list_t *to, mb_t *blk, mb_t *end, uint32_t *blocks, uint32_t *used, uint32_t *free)/*{{{*/
 {
-	/* check if it is guard block */
-	mb_valid(list);
-	I(mb_is_guard(list));
+	*blocks = 0;
+	*used   = 0;
+	*free   = 0;
 
-	/* find first block */
-	mb_t *blk = (mb_t *)((uint32_t)list + sizeof(mb_list_t));
-
-	uint32_t used_blocks = 0, blocks = 0, free = 0;
+	while (blk < end) {
+		mb_valid(from, blk);
 
-	while ((uint32_t)blk < (uint32_t)list + list->size) {
-		mb_valid(blk);
+		if (mb_is_used(blk)) {
+			(*used)++;
+		} else {
+			*free += blk->size - sizeof(mb_t);
 
-		if (mb_is_used(blk))
-			used_blocks++;
-		else
-			free += blk->size - sizeof(mb_t);
+			mb_bin_remove(from, (mb_free_t *)blk);
+			mb_bin_insert(to, (mb_free_t *)blk);
+		}
 
-		blocks++;
+		(*blocks)++;
 
-		blk = (mb_t *)((uint32_t)blk + blk->size);
+		blk = (mb_t *)((uintptr_t)blk + blk->size);
 	}
-
-	list->fmemcnt = free;
-	list->ublkcnt = used_blocks;
-	list->blkcnt  = blocks;
-
-	mb_touch(list);
 }/*}}}*/
 
 /**
@@ -1222,104 +1922,177 @@ static void mb_list_recalculate_statistics(mb_list_t *list)/*{{{*/
  * @param first
  * @param to_split
  * @param pages
- * @param space
  * @return
  */
 
-mb_list_t *mb_list_split(mb_list_t *first, mb_free_t *to_split, uint32_t pages, uint32_t space)/*{{{*/
+mb_list_t *mb_list_split(mb_list_t *first, mb_free_t *to_split, uint32_t pages)/*{{{*/
 {
-	mb_valid(first);
+	mb_valid(first, first);
 	I(mb_is_guard(first));
 
-	mb_valid(to_split);
+	mb_valid(first, to_split);
 	I(!mb_is_guard(to_split) && !mb_is_used(to_split));
 
-	DEBUG("split block's list [$%.8x; %u; $%.2x] at block [$%.8x; %u; $%.2x] removing %u pages\n",
-		  (uint32_t)first, first->size, first->flags, (uint32_t)to_split, to_split->size, to_split->flags, pages);
+	DEBUG("split block's list [%p; %u; $%.2x] at block [%p; %u; $%.2x] removing %u pages\n",
+		  (void *)first, first->size, first->flags, (void *)to_split, to_split->size, to_split->flags, pages);
+
+	uintptr_t cut_start = ALIGN_UP((uintptr_t)to_split, PAGE_SIZE);
+	uintptr_t cut_end   = cut_start + pages * PAGE_SIZE;
+
+	/* blocks before and after the block being split */
+	mb_t *head_start = (mb_t *)((uintptr_t)first + sizeof(mb_list_t));
+	mb_t *tail_start = (mb_t *)((uintptr_t)to_split + to_split->size);
+	mb_t *tail_end   = (mb_t *)((uintptr_t)first + first->size);
+
+	/* statistics of both parts without the block being split */
+	uint32_t blocks = first->blkcnt - 1;
+	uint32_t used   = first->ublkcnt;
+	uint32_t free   = first->fmemcnt - (to_split->size - sizeof(mb_t));
 
-	uint32_t cut_start = ALIGN_UP((uint32_t)to_split + space, PAGE_SIZE);
-	uint32_t cut_end   = cut_start + pages * PAGE_SIZE;
+	mb_bin_remove(first, to_split);
 
 	/* set up guard of second list */
 	mb_list_t *second = (mb_list_t *)cut_end;
 
-	second->flags = MB_FLAG_GUARD;
-	second->size  = ((uint32_t)first + first->size) - cut_end;
-	second->next  = mb_is_guard(to_split->next) ? (mb_free_t *)second : to_split->next;
-	second->prev  = (first->prev == to_split) ? (mb_free_t *)second : first->prev;
-	mb_touch(second);
+	second->prev_size = first->prev_size;
+	second->flags  = MB_FLAG_GUARD;
+	second->size   = ((uintptr_t)first + first->size) - cut_end;
+	second->bitmap = 0;
+	second->tree   = 0;
+#if CHECKSUM == CHECKSUM_KEYED
+	second->key    = first->key;
+#endif
+
+	mb_free_t *next = mb_get_next(to_split);
+	mb_free_t *last = mb_get_prev(first);
+
+	mb_set_next(second, mb_is_guard(next) ? (mb_free_t *)second : next);
+	mb_set_prev(second, (last == to_split) ? (mb_free_t *)second : last);
+
+	memset(second->bin, 0, sizeof(second->bin));
+
+	/* only blocks of the shorter part are moved between bins and counted */
+	bool head = ((uintptr_t)to_split - (uintptr_t)head_start) < ((uintptr_t)tail_end - (uintptr_t)tail_start);
+
+	uint32_t part_blocks, part_used, part_free;
+
+	if (head) {
+		mb_bin_move(second, first);
+
+		first->bitmap = 0;
+		memset(first->bin, 0, sizeof(first->bin));
+		mb_tree_init(first);
+
+		mb_list_move_blocks(second, first, head_start, (mb_t *)to_split, &part_blocks, &part_used, &part_free);
+	} else {
+		mb_list_move_blocks(first, second, tail_start, tail_end, &part_blocks, &part_used, &part_free);
+	}
+
+	mb_list_t *part = head ? first : second;
+	mb_list_t *rest = head ? second : first;
+
+	part->blkcnt  = part_blocks;
+	part->ublkcnt = part_used;
+	part->fmemcnt = part_free;
+
+	rest->blkcnt  = blocks - part_blocks;
+	rest->ublkcnt = used - part_used;
+	rest->fmemcnt = free - part_free;
+
+	mb_touch(second, second);
 
 	/* correct pointers in second guard neighbours */
-	second->next->prev = (mb_free_t *)second;
-	second->prev->next = (mb_free_t *)second;
+	mb_set_prev(mb_get_next(second), second);
+	mb_set_next(mb_get_prev(second), second);
 
-	mb_touch(second->next);
-	mb_touch(second->prev);
+	mb_touch(second, mb_get_next(second));
+	mb_touch(second, mb_get_prev(second));
 
 	/* check if there should be a leftover at the beginning of second */
-	mb_free_t *blk = (mb_free_t *)((uint32_t)second + sizeof(mb_list_t));
+	mb_free_t *blk = (mb_free_t *)((uintptr_t)second + sizeof(mb_list_t));
 
-	uint32_t size = (uint32_t)to_split + to_split->size - (uint32_t)blk;
+	uint32_t size = (uintptr_t)to_split + to_split->size - (uintptr_t)blk;
 
 	if (size > 0) {
+		blk->prev_size = 0;
 		blk->size  = size;
 		blk->flags = MB_FLAG_FIRST;
 
-		if (blk->size == 8)
+		if (blk->size == sizeof(mb_t))
 			blk->flags |= (MB_FLAG_PAD | MB_FLAG_USED);
 
-		mb_touch(blk);
+		mb_touch(second, blk);
+
+		mb_link(second, blk);
 
-		if (blk->size > 8)
+		if (blk->size > sizeof(mb_t))
 			mb_insert(second, blk);
+
+		second->blkcnt++;
+
+		if (blk->size == sizeof(mb_t))
+			second->ublkcnt++;
+		else
+			second->fmemcnt += blk->size - sizeof(mb_t);
+
+		mb_touch(second, second);
 	} else {
 		/* mark first block of second list with MB_FLAG_FIRST */
 		blk->flags |= MB_FLAG_FIRST;
+		blk->prev_size = 0;
 
-		mb_touch(blk);
+		mb_touch(second, blk);
 	}
 
 	/* now correct first list */
-	to_split->size = (cut_start - space) - (uint32_t)to_split;
-	mb_touch(to_split);
+	to_split->size = cut_start - (uintptr_t)to_split;
+	mb_touch(first, to_split);
+
+	DEBUG("cut_start = %p, to_split->size = %d\n", (void *)cut_start, to_split->size);
 
-	DEBUG("cut_start = $%.8x, space = %d, to_split->size = %d\n", cut_start, space, to_split->size);
+	if (to_split->size <= sizeof(mb_t)) {
+		mb_free_t *prev = mb_get_prev(to_split);
 
-	if (to_split->size <= 8) {
-		first->prev = to_split->prev;
-		first->prev->next = (mb_free_t *)first;
-		mb_touch(first->prev);
+		mb_set_prev(first, prev);
+		mb_set_next(prev, first);
+		mb_touch(first, prev);
 	} else {
-		first->prev = to_split;
+		mb_set_prev(first, to_split);
 	}
 
-	first->size = (cut_start - space) - (uint32_t)first;
-	mb_touch(first);
+	first->size = cut_start - (uintptr_t)first;
+	mb_touch(first, first);
 
 	/* propely finish first list */
 	if (to_split->size == 0) {
-		mb_t *last = (mb_t *)((uint32_t)first + sizeof(mb_list_t));
+		mb_t *last = mb_prev_block((mb_t *)to_split);
 
-		while ((uint32_t)last + last->size < (uint32_t)first + first->size) {
-			mb_valid(last);
-
-			last = (mb_t *)((uint32_t)last + last->size);
-		}
+		mb_valid(first, last);
 
 		last->flags |= MB_FLAG_LAST;
-		mb_touch(last);
-	} else if (to_split->size == 8) {
+		mb_touch(first, last);
+
+		first->prev_size = last->size;
+	} else if (to_split->size == sizeof(mb_t)) {
 		to_split->flags |= (MB_FLAG_LAST | MB_FLAG_PAD | MB_FLAG_USED);
-		mb_touch(to_split);
+		mb_touch(first, to_split);
+
+		first->prev_size = to_split->size;
+		first->blkcnt++;
+		first->ublkcnt++;
 	} else {
 		to_split->flags |= MB_FLAG_LAST;
-		to_split->next = (mb_free_t *)first;
-		mb_touch(to_split);
+		mb_set_next(to_split, first);
+		mb_touch(first, to_split);
+
+		mb_bin_insert(first, to_split);
+
+		first->prev_size = to_split->size;
+		first->blkcnt++;
+		first->fmemcnt += to_split->size - sizeof(mb_t);
 	}
 
-	/* recalculate statistics */
-	mb_list_recalculate_statistics(first);
-	mb_list_recalculate_statistics(second);
+	mb_touch(first, first);
 
 	return second;
 }/*}}}*/
@@ -5,7 +5,11 @@
 #include "areamgr.h"
 #include <stdio.h>
 
-#define MB_GRANULARITY_BITS		3
+/*
+ * Blocks must be aligned to MIN_ALIGNMENT. Header of a block takes 16 bytes on
+ * all architectures, so granularity cannot be any smaller.
+ */
+#define MB_GRANULARITY_BITS		4
 #define MB_GRANULARITY			(1 << MB_GRANULARITY_BITS)
 #define MB_GRANULARITY_MASK		(MB_GRANULARITY - 1)
 
@@ -14,11 +18,20 @@
 #define MB_FLAG_FIRST	4
 #define MB_FLAG_LAST	8
 #define MB_FLAG_GUARD	16
+#define MB_FLAG_BINNED	32
+#define MB_FLAG_QUICK	64
 
-/* Memory block structure */
+/*
+ * Memory block structure. Each block knows size of block preceding it, while
+ * guard of the list keeps size of the last block, so neighbours of any block
+ * are reachable in constant time.
+ */
 
 struct memory_block
 {
+	/* size of preceding block - not covered by checksum */
+	uint32_t prev_size;
+
 	uint16_t checksum;
 	uint16_t flags;
 	uint32_t size;
@@ -26,31 +39,130 @@ struct memory_block
 
 typedef struct memory_block mb_t;
 
+/*
+ * Links between blocks are kept as offsets relative to the structure holding
+ * the link, so a list of blocks stays valid wherever it is mapped. Null link
+ * is stored as zero. Links of free blocks' list are never null, so there zero
+ * means a block linked to itself.
+ */
+
 /* Free memory block structure */
 
 struct memory_block_free
 {
 	struct memory_block;
 
-	struct memory_block_free *next;
-	struct memory_block_free *prev;
+	int32_t next;
+	int32_t prev;
 } __attribute__((aligned(MB_GRANULARITY)));
 
 typedef struct memory_block_free mb_free_t;
 
+/* Free memory block large enough to be kept in a size bin */
+
+struct memory_block_binned
+{
+	struct memory_block_free;
+
+	/* links of size bin - not covered by checksum */
+	int32_t bin_next;
+	int32_t bin_prev;
+} __attribute__((aligned(MB_GRANULARITY)));
+
+typedef struct memory_block_binned mb_binned_t;
+
+/* Free memory block large enough to be kept in a size tree */
+
+struct memory_block_node
+{
+	struct memory_block_free;
+
+	/* links of size tree - not covered by checksum */
+	int32_t left;
+	int32_t right;
+	int32_t parent;
+} __attribute__((aligned(MB_GRANULARITY)));
+
+typedef struct memory_block_node mb_node_t;
+
+/*
+ * Free blocks are indexed by size. Blocks shorter than 64 bytes have a bin
+ * for each size, starting with the smallest binned block, larger blocks have
+ * four bins per power of two. Blocks of MB_TREE_MIN bytes and more are kept
+ * in a splay tree ordered by size and address instead, so the best fitting
+ * one can be found in logarithmic time.
+ */
+
+#define MB_BIN_SMALL	64
+#define MB_BIN_EXACT	((MB_BIN_SMALL - sizeof(mb_binned_t)) >> MB_GRANULARITY_BITS)
+#define MB_BIN_COUNT	13
+#define MB_TREE_MIN		512
+
 /* Memory blocks' list */
 
 struct memory_block_list
 {
 	struct memory_block_free;
 
-	uint16_t blkcnt;
-	uint16_t ublkcnt;
+	uint32_t blkcnt;
+	uint32_t ublkcnt;
 	uint32_t fmemcnt;
+
+	/* bitmap of nonempty bins, bins' heads and root of size tree - not
+	 * covered by checksum */
+	uint64_t bitmap;
+	int32_t	 bin[MB_BIN_COUNT];
+	int32_t	 tree;
+
+#if CHECKSUM == CHECKSUM_KEYED
+	/* key of checksums of blocks in the list */
+	uint32_t key;
+#endif
 } __attribute__((aligned(MB_GRANULARITY)));
 
 typedef struct memory_block_list mb_list_t;
 
+#if CHECKSUM == CHECKSUM_KEYED
+#define mb_list_key(list) ((list)->key)
+#else
+#define mb_list_key(list) 0
+#endif
+
+/*
+ * Recently freed blocks are kept on quick lists, indexed like size bins,
+ * before they are returned to their areas. They stay marked as used, so
+ * neither coalescing nor shrinking of areas takes place, and a block of the
+ * same size can be handed out again straight away. Lists are bounded both
+ * in length and in total size of kept blocks.
+ */
+
+#define MB_QUICK_MAX	32768
+#define MB_QUICK_COUNT	38
+#define MB_QUICK_DEPTH	16
+#define MB_QUICK_LIMIT	262144
+
+/* Block kept on quick list - linked through its first word */
+
+struct memory_block_quick
+{
+	struct memory_block;
+
+	struct memory_block_quick *next;
+};
+
+typedef struct memory_block_quick mb_quick_t;
+
+/* Quick lists */
+
+struct memory_block_quick_lists
+{
+	mb_quick_t *bin[MB_QUICK_COUNT];
+	uint8_t		cnt[MB_QUICK_COUNT];
+	uint32_t	memcnt;
+};
+
+typedef struct memory_block_quick_lists mb_quick_lists_t;
+
 /* Few inlines to make code more readable :) */
 
 #define mb_is_guard(blk) mb_is_guard_internal((mb_t *)(blk))
@@ -77,48 +189,123 @@ static inline bool mb_is_last_internal(mb_t *blk) {
 	return (blk->flags & MB_FLAG_LAST);
 }
 
+/* Follow a link stored in given structure or make one pointing to ptr */
+
+static inline void *mb_deref(void *self, int32_t link) {
+	return (link == 0) ? NULL : (void *)((intptr_t)self + link);
+}
+
+static inline int32_t mb_ref(void *self, void *ptr) {
+	return (ptr == NULL) ? 0 : (int32_t)((intptr_t)ptr - (intptr_t)self);
+}
+
+/* Neighbours of a block on list of free blocks */
+
+#define mb_get_next(blk) mb_get_next_internal((mb_free_t *)(blk))
+
+static inline mb_free_t *mb_get_next_internal(mb_free_t *blk) {
+	return (mb_free_t *)((intptr_t)blk + blk->next);
+}
+
+#define mb_get_prev(blk) mb_get_prev_internal((mb_free_t *)(blk))
+
+static inline mb_free_t *mb_get_prev_internal(mb_free_t *blk) {
+	return (mb_free_t *)((intptr_t)blk + blk->prev);
+}
+
+#define mb_set_next(blk, next) mb_set_next_internal((mb_free_t *)(blk), (mb_free_t *)(next))
+
+static inline void mb_set_next_internal(mb_free_t *blk, mb_free_t *next) {
+	blk->next = (int32_t)((intptr_t)next - (intptr_t)blk);
+}
+
+#define mb_set_prev(blk, prev) mb_set_prev_internal((mb_free_t *)(blk), (mb_free_t *)(prev))
+
+static inline void mb_set_prev_internal(mb_free_t *blk, mb_free_t *prev) {
+	blk->prev = (int32_t)((intptr_t)prev - (intptr_t)blk);
+}
+
+/* Physical neighbours of a block - NULL at the ends of the list */
+
+static inline mb_t *mb_prev_block(mb_t *blk) {
+	return mb_is_first(blk) ? NULL : (mb_t *)((uintptr_t)blk - blk->prev_size);
+}
+
+static inline mb_t *mb_next_block(mb_t *blk) {
+	return mb_is_last(blk) ? NULL : (mb_t *)((uintptr_t)blk + blk->size);
+}
+
+/* Propagate size of a block to its successor, or to the guard if it is last */
+
+#define mb_link(list, blk) mb_link_internal((list), (mb_t *)(blk))
+
+static inline void mb_link_internal(mb_list_t *list, mb_t *blk) {
+	mb_t *next = mb_next_block(blk);
+
+	if (next)
+		next->prev_size = blk->size;
+	else
+		list->prev_size = blk->size;
+}
+
 static inline mb_list_t *mb_list_from_area(area_t *area) {
 	return (mb_list_t *)area_begining(area);
 }
 
-/* Calculate checksum of memory block structure. */
+/*
+ * Calculate checksum of memory block structure. It is seeded with offset of
+ * the block within its page and key of the list only, so it does not change
+ * when the list is mapped at another address by another process.
+ */
 
-static uint16_t mb_checksum(mb_t *blk)
+static inline uint16_t mb_checksum(mb_t *blk, uint32_t key)
 {
 	int bytes;
 
 	if (mb_is_used(blk))
-		bytes = sizeof(mb_t) - sizeof(uint16_t);
+		bytes = sizeof(mb_t) - offsetof(mb_t, flags);
 	else if (mb_is_guard(blk))
-		bytes = sizeof(mb_list_t) - sizeof(uint16_t);
+		bytes = offsetof(mb_list_t, bitmap) - offsetof(mb_t, flags);
 	else
-		bytes = sizeof(mb_free_t) - sizeof(uint16_t);
+		bytes = offsetof(mb_free_t, prev) + sizeof(int32_t) - offsetof(mb_t, flags);
 
-	return (((uint32_t)blk) >> 16) ^ (((uint32_t)blk) & 0xFFFF) ^ checksum((uint16_t *)&blk->flags, bytes >> 1);
+	return checksum(checksum_seed((void *)((uintptr_t)blk & (PAGE_SIZE - 1)), key), (uint16_t *)&blk->flags, bytes >> 1);
 }
 
-/* Recalculate memory block checksum. */
+/*
+ * Blocks are checksummed with key of the list they belong to. Blocks kept
+ * privately (i.e. on quick lists) come from process' own lists.
+ */
+
+#define mb_touch(list, blk) mb_touch_internal((mb_t *)(blk), mb_list_key(list))
+#define mb_check(list, blk) mb_check_internal((mb_t *)(blk), mb_list_key(list))
+#define mb_valid(list, blk) mb_valid_internal((mb_t *)(blk), mb_list_key(list))
 
-#define mb_touch(blk) mb_touch_internal((mb_t *)(blk))
+#define mb_touch_private(blk) mb_touch_internal((mb_t *)(blk), checksum_key)
+#define mb_check_private(blk) mb_check_internal((mb_t *)(blk), checksum_key)
+#define mb_valid_private(blk) mb_valid_internal((mb_t *)(blk), checksum_key)
+
+/* Recalculate memory block checksum. */
 
-static inline void mb_touch_internal(mb_t *blk)
+static inline void mb_touch_internal(mb_t *blk, uint32_t key)
 {
-	blk->checksum = mb_checksum(blk);
+#if CHECKSUM != CHECKSUM_NONE
+	blk->checksum = mb_checksum(blk, key);
+#endif
 }
 
-/* Check corectness of memory block checksum. */
-
-#define mb_valid(blk) mb_valid_internal((mb_t *)(blk))
+/* Check corectness of memory block checksum - used by verification. */
 
-static inline void mb_valid_internal(mb_t *blk)
+static inline void mb_check_internal(mb_t *blk, uint32_t key)
 {
-	if (mb_checksum(blk) != blk->checksum) {
-		fprintf(stderr, "invalid block: [$%.8x; %u; $%.2x]", (uint32_t)blk, blk->size, blk->flags);
+#if CHECKSUM != CHECKSUM_NONE
+	if (mb_checksum(blk, key) != blk->checksum) {
+		fprintf(stderr, "invalid block: [%p; %u; $%.2x]", (void *)blk, blk->size, blk->flags);
 
 		if (!mb_is_used(blk)) {
 			mb_free_t *fblk = (mb_free_t *)blk;
 
-			fprintf(stderr, " [prev: $%.8x; next: $%.8x]", (uint32_t)fblk->prev, (uint32_t)fblk->next);
+			fprintf(stderr, " [prev: %p; next: %p]", (void *)mb_get_prev(fblk), (void *)mb_get_next(fblk));
 		}
 
 		if (mb_is_guard(blk)) {
@@ -132,27 +319,44 @@ static inline void mb_valid_internal(mb_t *blk)
 
 		abort();
 	}
+#endif
+}
+
+/* Check corectness of memory block checksum - used on each access. */
+
+static inline void mb_valid_internal(mb_t *blk, uint32_t key)
+{
+#if CHECKSUM >= CHECKSUM_FULL
+	mb_check_internal(blk, key);
+#endif
 }
 
 /* Function prototypes */
 bool mb_verify(mb_list_t *list, bool verbose);
-void mb_init(mb_list_t *list, uint32_t size);
+void mb_init(mb_list_t *list, uint32_t size, uint32_t key);
 void *mb_alloc(mb_list_t *list, uint32_t size, bool from_last);
 void *mb_alloc_aligned(mb_list_t *list, uint32_t size, uint32_t alignment);
 bool mb_resize(mb_list_t *list, void *memory, uint32_t new_size);
 mb_free_t *mb_free(mb_list_t *list, void *memory);
 
+/* Procedures operating on quick lists */
+void mb_quick_init(mb_quick_lists_t *quick);
+bool mb_quick_push(mb_quick_lists_t *quick, void *memory);
+void *mb_quick_pop(mb_quick_lists_t *quick, uint32_t size);
+mb_quick_t *mb_quick_drain(mb_quick_lists_t *quick);
+bool mb_quick_verify(mb_quick_lists_t *quick, bool verbose);
+
 /* Procedures used in conjuction with operations on memory areas */
-uint32_t mb_list_can_shrink_at_beginning(mb_list_t *list, uint32_t space);
-uint32_t mb_list_can_shrink_at_end(mb_list_t *list, uint32_t space);
+uint32_t mb_list_can_shrink_at_beginning(mb_list_t *list);
+uint32_t mb_list_can_shrink_at_end(mb_list_t *list);
 
-void mb_list_shrink_at_beginning(mb_list_t **list, uint32_t pages, uint32_t space);
-void mb_list_shrink_at_end(mb_list_t *list, uint32_t pages, uint32_t space);
+void mb_list_shrink_at_beginning(mb_list_t **list, uint32_t pages);
+void mb_list_shrink_at_end(mb_list_t *list, uint32_t pages);
 
-uint32_t mb_list_find_split(mb_list_t *list, mb_free_t **to_split, void **cut, uint32_t space);
-mb_list_t *mb_list_split(mb_list_t *first, mb_free_t *to_split, uint32_t pages, uint32_t space);
+uint32_t mb_list_find_split(mb_list_t *list, mb_free_t **to_split, void **cut);
+mb_list_t *mb_list_split(mb_list_t *first, mb_free_t *to_split, uint32_t pages);
 
 void mb_list_expand(mb_list_t *guard, uint32_t pages);
-mb_list_t *mb_list_merge(mb_list_t *first, mb_list_t *second, uint32_t space);
+mb_list_t *mb_list_merge(mb_list_t *first, mb_list_t *second);
 
 #endif
@@ -10,59 +10,161 @@
  * Memory manager initialization.
  * @param blkmgr
  * @param areamgr
+ * @param cpu
  */
 
-void blkmgr_init(blkmgr_t *blkmgr, areamgr_t *areamgr)/*{{{*/
+void blkmgr_init(blkmgr_t *blkmgr, areamgr_t *areamgr, uint8_t cpu)/*{{{*/
 {
 	arealst_init(&blkmgr->blklst);
 
-	blkmgr->areamgr = areamgr;
+	blkmgr->areamgr   = areamgr;
+	blkmgr->cpu       = cpu;
+	blkmgr->remote    = NULL;
+	blkmgr->remotecnt = 0;
+
+	mb_quick_init(&blkmgr->quick);
 }/*}}}*/
 
 /**
- * Memory block allocation procedure.
- * @param mm
+ * Find area managed by this manager that contains given block.
+ * @param self
+ * @param memory
+ * @return			NULL if the block does not belong to the manager
+ */
+
+static area_t *blkmgr_find_area(blkmgr_t *self, void *memory)/*{{{*/
+{
+	area_t *area = areamgr_find_area(self->areamgr, memory);
+
+	if ((area != NULL) && ((area->manager != AREA_MGR_BLKMGR) || (area->cpu != self->cpu)))
+		area = NULL;
+
+	return area;
+}/*}}}*/
+
+static bool blkmgr_free_internal(blkmgr_t *blkmgr, void *memory);
+static bool blkmgr_defer(blkmgr_t *blkmgr, void *memory);
+
+/**
+ * Free blocks that were handed over by other processors. Whole list is taken
+ * at once, so pushers never see a block being removed.
+ *
+ * Manager must be locked for writing.
+ *
+ * @param self
+ */
+
+static void blkmgr_reclaim(blkmgr_t *self)/*{{{*/
+{
+	void *memory = __sync_lock_test_and_set(&self->remote, NULL);
+
+	if (memory == NULL)
+		return;
+
+	uint32_t n = 0;
+
+	while (memory != NULL) {
+		void *next = *(void **)memory;
+
+		blkmgr_defer(self, memory);
+
+		memory = next;
+		n++;
+	}
+
+	DEBUG("Reclaimed %u blocks freed remotely.\n", n);
+
+	__sync_sub_and_fetch(&self->remotecnt, n);
+}/*}}}*/
+
+/**
+ * Return all blocks kept on quick lists to their areas. Manager must be locked
+ * for writing.
+ *
+ * @param self
+ * @return			TRUE if any block was released
+ */
+
+static bool blkmgr_consolidate(blkmgr_t *self)/*{{{*/
+{
+	mb_quick_t *blk = mb_quick_drain(&self->quick);
+
+	if (blk == NULL)
+		return FALSE;
+
+	uint32_t n = 0;
+
+	while (blk != NULL) {
+		mb_quick_t *next = blk->next;
+
+		blkmgr_free_internal(self, (void *)((uintptr_t)blk + sizeof(mb_t)));
+
+		blk = next;
+		n++;
+	}
+
+	DEBUG("Consolidated %u blocks from quick lists.\n", n);
+
+	return TRUE;
+}/*}}}*/
+
+/**
+ * Memory block allocation procedure. Manager must be locked for writing.
+ *
+ * Quick lists are looked up first. Areas preceding <i>from</i> are not
+ * searched for free space. On return it points to the area the block was
+ * taken from, so consecutive allocations of the same size can continue from
+ * there. If no area has enough free space, blocks kept on quick lists are
+ * released before the heap is extended.
+ *
+ * @param self
  * @param size
  * @param alignment
+ * @param from
  * @return
  */
 
-void *blkmgr_alloc(blkmgr_t *self, uint32_t size, uint32_t alignment)/*{{{*/
+static void *blkmgr_alloc_internal(blkmgr_t *self, uint32_t size, uint32_t alignment, area_t **from)/*{{{*/
 {
-	void *memory = NULL;
+	void *memory = (alignment > 0) ? NULL : mb_quick_pop(&self->quick, size);
 
-	if (alignment) {
-		DEBUG("\033[37;1mRequested block of size %u aligned to %u bytes boundary.\033[0m\n", size, alignment);
-	} else {
-		DEBUG("\033[37;1mRequested block of size %u.\033[0m\n", size);
-	}
-
-	arealst_wrlock(&self->blklst);
+	if (memory)
+		return memory;
 
 	/* looking for an area with free space */
-	area_t    *area = (area_t *)self->blklst.local.next;
+	area_t    *area = *from;
 	mb_list_t *list = NULL;
 
-	while (!area_is_guard(area)) {
-		I(area_is_ready(area));
+	while (TRUE) {
+		while (!area_is_guard(area)) {
+			I(area_is_ready(area));
+
+			DEBUG("searching for free block in [%p; %zu; $%.2x]\n", (void *)area, area->size, area->flags0);
+
+			list   = mb_list_from_area(area);
+			memory = (alignment > 0) ? mb_alloc_aligned(list, size, alignment) : mb_alloc(list, size, FALSE);
 
-		DEBUG("searching for free block in [$%.8x; %u; $%.2x]\n", (uint32_t)area, area->size, area->flags0);
+			if (memory) {
+				*from = area;
+				break;
+			}
 
-		list   = mb_list_from_area(area);
-		memory = (alignment > 0) ? mb_alloc_aligned(list, size, alignment) : mb_alloc(list, size, FALSE);
+			area = area->local.next;
+		}
 
-		if (memory)
+		/* released blocks could be coalesced and areas rearranged */
+		if ((memory != NULL) || !blkmgr_consolidate(self))
 			break;
 
-		area = area->local.next;
+		area = (area_t *)self->blklst.local.next;
 	}
 
 	/* the area was not found - we must make some space */
 	if (memory == NULL) {
-		uint32_t area_size = size + sizeof(area_t) + sizeof(mb_list_t) + sizeof(mb_t);
+		uint32_t area_size = size + sizeof(mb_list_t) + sizeof(mb_t);
 
 		if (alignment > 0)
-			area_size += alignment;
+			area_size += alignment + sizeof(mb_free_t);
 
 		DEBUG("Trying to merge adjacent pages to managed areas.\n");
 
@@ -75,22 +177,22 @@ void *blkmgr_alloc(blkmgr_t *self, uint32_t size, uint32_t alignment)/*{{{*/
 		while (!area_is_guard(area)) {
 			mb_list_t *list = mb_list_from_area(area);
 
-			uint32_t oldsize = area->size;
+			size_t oldsize = area->size;
 			
 			if (areamgr_expand_area(self->areamgr, &area, SIZE_IN_PAGES(area_size), LEFT)) {
 				mb_list_t *to_merge = mb_list_from_area(area);
 
-				mb_init(to_merge, area->size - oldsize - sizeof(area_t));
+				mb_init(to_merge, area->size - oldsize, checksum_key);
 
-				list = mb_list_merge(to_merge, list, sizeof(area_t));
+				list = mb_list_merge(to_merge, list);
 
 				merged = TRUE;
 			} else if (areamgr_expand_area(self->areamgr, &area, SIZE_IN_PAGES(area_size), RIGHT)) {
-				mb_list_t *to_merge = (mb_list_t *)((uint32_t)area_end(area) - (area->size - oldsize));
+				mb_list_t *to_merge = (mb_list_t *)(area_end(area) - (area->size - oldsize));
 
-				mb_init(to_merge, area->size - oldsize - sizeof(area_t));
+				mb_init(to_merge, area->size - oldsize, checksum_key);
 
-				list = mb_list_merge(list, to_merge, sizeof(area_t));
+				list = mb_list_merge(list, to_merge);
 
 				merged = TRUE;
 			}
@@ -104,7 +206,7 @@ void *blkmgr_alloc(blkmgr_t *self, uint32_t size, uint32_t alignment)/*{{{*/
 					arealst_remove_area(&self->blklst, area->local.next, DONTLOCK);
 					arealst_join_area(&self->areamgr->global, area, area->global.next, LOCK);
 
-					list = mb_list_merge(list, to_merge, sizeof(area_t));
+					list = mb_list_merge(list, to_merge);
 				}
 
 				memory = alignment ? mb_alloc_aligned(list, size, alignment) : mb_alloc(list, size, FALSE);
@@ -122,23 +224,87 @@ void *blkmgr_alloc(blkmgr_t *self, uint32_t size, uint32_t alignment)/*{{{*/
 			if (newarea != NULL) {
 				mb_list_t *list = mb_list_from_area(newarea);
 
-				mb_init(list, newarea->size - sizeof(area_t));
-				newarea->ready = TRUE;
-				newarea->manager = AREA_MGR_BLKMGR;
-				area_touch(newarea);
+				mb_init(list, newarea->size, checksum_key);
+				areamgr_assign_area(self->areamgr, newarea, AREA_MGR_BLKMGR, self->cpu, TRUE);
 
 				arealst_insert_area_by_addr(&self->blklst, (void *)newarea, DONTLOCK);
 
 				memory = alignment ? mb_alloc_aligned(list, size, alignment) : mb_alloc(list, size, FALSE);
 			}
 		}
+
+		/* areas could be merged - search from the begining next time */
+		*from = (area_t *)self->blklst.local.next;
 	}
 
+	return memory;
+}/*}}}*/
+
+/**
+ * Memory block allocation procedure.
+ * @param mm
+ * @param size
+ * @param alignment
+ * @return
+ */
+
+void *blkmgr_alloc(blkmgr_t *self, uint32_t size, uint32_t alignment)/*{{{*/
+{
+	if (alignment) {
+		DEBUG("\033[37;1mRequested block of size %u aligned to %u bytes boundary.\033[0m\n", size, alignment);
+	} else {
+		DEBUG("\033[37;1mRequested block of size %u.\033[0m\n", size);
+	}
+
+	arealst_wrlock(&self->blklst);
+
+	blkmgr_reclaim(self);
+
+	area_t *from = (area_t *)self->blklst.local.next;
+
+	void *memory = blkmgr_alloc_internal(self, size, alignment, &from);
+
 	arealst_unlock(&self->blklst);
 
 	return memory;
 }/*}}}*/
 
+/**
+ * Allocate a number of blocks of the same size with manager locked once.
+ *
+ * @param self
+ * @param size
+ * @param blocks	array to be filled with addresses of allocated blocks
+ * @param count		number of requested blocks
+ * @return			number of allocated blocks
+ */
+
+uint32_t blkmgr_alloc_batch(blkmgr_t *self, uint32_t size, void **blocks, uint32_t count)/*{{{*/
+{
+	DEBUG("\033[37;1mRequested %u blocks of size %u.\033[0m\n", count, size);
+
+	uint32_t n = 0;
+
+	arealst_wrlock(&self->blklst);
+
+	blkmgr_reclaim(self);
+
+	area_t *from = (area_t *)self->blklst.local.next;
+
+	while (n < count) {
+		void *memory = blkmgr_alloc_internal(self, size, 0, &from);
+
+		if (memory == NULL)
+			break;
+
+		blocks[n++] = memory;
+	}
+
+	arealst_unlock(&self->blklst);
+
+	return n;
+}/*}}}*/
+
 /**
  * Resizing allocated block procedure.
  * @param
@@ -148,13 +314,13 @@ void *blkmgr_alloc(blkmgr_t *self, uint32_t size, uint32_t alignment)/*{{{*/
 
 bool blkmgr_realloc(blkmgr_t *blkmgr, void *memory, uint32_t new_size)/*{{{*/
 {
-	DEBUG("\033[37;1mResizing block at $%.8x to %u bytes.\033[0m\n", (uint32_t)memory, new_size);
+	DEBUG("\033[37;1mResizing block at %p to %u bytes.\033[0m\n", (void *)memory, new_size);
 
 	bool result = FALSE;
 
 	arealst_wrlock(&blkmgr->blklst);
 
-	area_t *area = arealst_find_area_by_addr(&blkmgr->blklst, memory, DONTLOCK);
+	area_t *area = blkmgr_find_area(blkmgr, memory);
 
 	if (area)
 		result = mb_resize(mb_list_from_area(area), memory, new_size);
@@ -165,15 +331,31 @@ bool blkmgr_realloc(blkmgr_t *blkmgr, void *memory, uint32_t new_size)/*{{{*/
 }/*}}}*/
 
 /**
- * Memory block deallocation procedure.
+ * Get number of bytes that can be used in allocated block. As long as the
+ * block is in use its header does not change, so no locking is needed.
+ *
+ * @param memory	address of allocated block
+ * @return			size of the block in bytes
+ */
+
+uint32_t blkmgr_get_size(void *memory)/*{{{*/
+{
+	mb_t *blk = (mb_t *)((uintptr_t)memory - sizeof(mb_t));
+
+	mb_valid_private(blk);
+	I(mb_is_used(blk));
+
+	return blk->size - sizeof(mb_t);
+}/*}}}*/
+
+/**
+ * Memory block deallocation procedure. Manager must be locked for writing.
  * @param mm
  * @param memory
  */
 
-bool blkmgr_free(blkmgr_t *blkmgr, void *memory)/*{{{*/
+static bool blkmgr_free_internal(blkmgr_t *blkmgr, void *memory)/*{{{*/
 {
-	DEBUG("\033[37;1mRequested to free block at $%.8x.\033[0m\n", (uint32_t)memory);
-
 	/* define actions on area */
 	void     *cut_addr = NULL;
 	uint32_t cut_pages = 0;
@@ -182,9 +364,7 @@ bool blkmgr_free(blkmgr_t *blkmgr, void *memory)/*{{{*/
 
 	bool result = FALSE;
 
-	arealst_wrlock(&blkmgr->blklst);
-	
-	area_t *area = arealst_find_area_by_addr(&blkmgr->blklst, memory, DONTLOCK);
+	area_t *area = blkmgr_find_area(blkmgr, memory);
 
 	if (area) {
 		mb_list_t *list = mb_list_from_area(area);
@@ -194,34 +374,34 @@ bool blkmgr_free(blkmgr_t *blkmgr, void *memory)/*{{{*/
 		result = TRUE;
 
 		/* is area completely empty (has exactly one block and it's free) */
-		if ((blkmgr->blklst.areacnt > 1) && mb_is_first(list->next) && mb_is_last(list->next)) {
+		if ((blkmgr->blklst.areacnt > 1) && mb_is_first(mb_get_next(list)) && mb_is_last(mb_get_next(list))) {
 			arealst_remove_area(&blkmgr->blklst, (void *)area, DONTLOCK);
 			areamgr_free_area(blkmgr->areamgr, area);
 		} else {
 			/* can area be shrinked at the end ? */
 
-			shrink_right_pages = mb_list_can_shrink_at_end(list, sizeof(area_t));
+			shrink_right_pages = mb_list_can_shrink_at_end(list);
 
 			if (shrink_right_pages > 0) {
-				mb_list_shrink_at_end(list, shrink_right_pages, sizeof(area_t));
+				mb_list_shrink_at_end(list, shrink_right_pages);
 				areamgr_shrink_area(blkmgr->areamgr, &area, SIZE_IN_PAGES(area->size) - shrink_right_pages, RIGHT);
 			}
 
 			/* can area be shrinked at the beginning ? */
-			shrink_left_pages = mb_list_can_shrink_at_beginning(list, sizeof(area_t));
+			shrink_left_pages = mb_list_can_shrink_at_beginning(list);
 
 			if (shrink_left_pages > 0) {
-				mb_list_shrink_at_beginning(&list, shrink_left_pages, sizeof(area_t));
+				mb_list_shrink_at_beginning(&list, shrink_left_pages);
 				areamgr_shrink_area(blkmgr->areamgr, &area, SIZE_IN_PAGES(area->size) - shrink_left_pages, LEFT);
 			}
 
 			/* can area be splitted ? */
-			cut_pages = mb_list_find_split(list, &free, &cut_addr, sizeof(area_t));
+			cut_pages = mb_list_find_split(list, &free, &cut_addr);
 
 			if (cut_pages > 1) {
 				area_t *leftover = NULL;
 
-				mb_list_split(mb_list_from_area(area), free, cut_pages, sizeof(area_t));
+				mb_list_split(mb_list_from_area(area), free, cut_pages);
 				arealst_split_area(&blkmgr->areamgr->global, &area, &leftover, SIZE_IN_PAGES(cut_addr - area_begining(area)), LOCK);
 				areamgr_shrink_area(blkmgr->areamgr, &leftover, SIZE_IN_PAGES(leftover->size) - cut_pages, LEFT);
 				arealst_insert_area_by_addr(&blkmgr->blklst, leftover, DONTLOCK);
@@ -229,11 +409,112 @@ bool blkmgr_free(blkmgr_t *blkmgr, void *memory)/*{{{*/
 		}
 	}
 
+	return result;
+}/*}}}*/
+
+/**
+ * Deferred memory block deallocation. The block is put on a quick list if
+ * there is room for it, otherwise it is released immediately. When quick
+ * lists hold too much memory, they are consolidated first. Manager must be
+ * locked for writing.
+ *
+ * @param blkmgr
+ * @param memory
+ * @return
+ */
+
+static bool blkmgr_defer(blkmgr_t *blkmgr, void *memory)/*{{{*/
+{
+	if (blkmgr_find_area(blkmgr, memory) == NULL)
+		return FALSE;
+
+	if (blkmgr->quick.memcnt + blkmgr_get_size(memory) + sizeof(mb_t) > MB_QUICK_LIMIT)
+		blkmgr_consolidate(blkmgr);
+
+	return mb_quick_push(&blkmgr->quick, memory) || blkmgr_free_internal(blkmgr, memory);
+}/*}}}*/
+
+/**
+ * Memory block deallocation procedure.
+ * @param mm
+ * @param memory
+ */
+
+bool blkmgr_free(blkmgr_t *blkmgr, void *memory)/*{{{*/
+{
+	DEBUG("\033[37;1mRequested to free block at %p.\033[0m\n", (void *)memory);
+
+	arealst_wrlock(&blkmgr->blklst);
+
+	blkmgr_reclaim(blkmgr);
+
+	bool result = blkmgr_defer(blkmgr, memory);
+
 	arealst_unlock(&blkmgr->blklst);
 
 	return result;
 }/*}}}*/
 
+/**
+ * Free a number of blocks with manager locked once.
+ *
+ * @param blkmgr
+ * @param blocks	addresses of blocks to be freed
+ * @param count		number of blocks
+ * @return			number of blocks that were managed by this manager
+ */
+
+uint32_t blkmgr_free_batch(blkmgr_t *blkmgr, void **blocks, uint32_t count)/*{{{*/
+{
+	DEBUG("\033[37;1mRequested to free %u blocks.\033[0m\n", count);
+
+	uint32_t i, n = 0;
+
+	arealst_wrlock(&blkmgr->blklst);
+
+	blkmgr_reclaim(blkmgr);
+
+	for (i = 0; i < count; i++)
+		if (blkmgr_defer(blkmgr, blocks[i]))
+			n++;
+
+	arealst_unlock(&blkmgr->blklst);
+
+	return n;
+}/*}}}*/
+
+/**
+ * Deallocation of a block by a processor that does not own the manager. The
+ * block is pushed onto lock-free list and actually freed by the owner when it
+ * allocates or frees next time. If too many blocks are waiting then the
+ * caller reclaims them on its own.
+ *
+ * @param blkmgr
+ * @param memory
+ * @return
+ */
+
+bool blkmgr_free_remote(blkmgr_t *blkmgr, void *memory)/*{{{*/
+{
+	DEBUG("\033[37;1mRequested to free block at %p remotely.\033[0m\n", (void *)memory);
+
+	void *first;
+
+	do {
+		first = blkmgr->remote;
+
+		*(void **)memory = first;
+	} while (!__sync_bool_compare_and_swap(&blkmgr->remote, first, memory));
+
+	if (__sync_add_and_fetch(&blkmgr->remotecnt, 1) >= BLKMGR_REMOTE_LIMIT) {
+		arealst_wrlock(&blkmgr->blklst);
+		blkmgr_reclaim(blkmgr);
+		arealst_unlock(&blkmgr->blklst);
+	}
+
+	return TRUE;
+}/*}}}*/
+
 /*
  * Print memory areas contents in given memory manager.
  */
@@ -247,31 +528,31 @@ bool blkmgr_verify(blkmgr_t *blkmgr, bool verbose)/*{{{*/
 	area_t *area = (area_t *)&blkmgr->blklst;
 
 	if (verbose)
-		fprintf(stderr, "\033[1;36m blkmgr at $%.8x [%d areas]:\033[0m\n",
-				(uint32_t)blkmgr, blkmgr->blklst.areacnt);
+		fprintf(stderr, "\033[1;36m blkmgr at %p [%d areas]:\033[0m\n",
+				(void *)blkmgr, blkmgr->blklst.areacnt);
 
 	uint32_t areacnt = 0;
 
 	while (TRUE) {
-		area_valid(area);
+		area_check(area);
 
 		if (!area_is_guard(area)) {
 			if (verbose)
-				fprintf(stderr, "\033[1;31m  $%.8x - $%.8x: %8d : $%.8x : $%.8x\033[0m\n",
-						(uint32_t)area_begining(area), (uint32_t)area_end(area), area->size,
-						(uint32_t)area->local.prev, (uint32_t)area->local.next);
+				fprintf(stderr, "\033[1;31m  %p - %p: %8zu : %p : %p\033[0m\n",
+						(void *)area_begining(area), (void *)area_end(area), area->size,
+						(void *)area->local.prev, (void *)area->local.next);
 
 			error |= mb_verify(mb_list_from_area(area), verbose);
 		} else {
 			if (verbose)
-				fprintf(stderr, "\033[1;33m  $%.8x %11s: %8s : $%.8x : $%.8x\033[0m\n",
-						(uint32_t)area, "", "guard", (uint32_t)area->local.prev, (uint32_t)area->local.next);
+				fprintf(stderr, "\033[1;33m  %p %11s: %8s : %p : %p\033[0m\n",
+						(void *)area, "", "guard", (void *)area->local.prev, (void *)area->local.next);
 		}
 
 		if (area_is_guard(area->local.next))
 			break;
 
-		error |= (!area_is_guard(area) && (area >= area->local.next));
+		error |= (!area_is_guard(area) && (area_begining(area) >= area_begining(area->local.next)));
 
 		area = area->local.next;
 
@@ -280,6 +561,8 @@ bool blkmgr_verify(blkmgr_t *blkmgr, bool verbose)/*{{{*/
 
 	error |= (areacnt != blkmgr->blklst.areacnt);
 
+	error |= mb_quick_verify(&blkmgr->quick, verbose);
+
 	if (error && verbose)
 		fprintf(stderr, "\033[7m  Invalid!\033[0m\n");
 
@@ -3,23 +3,41 @@
 
 #include "common.h"
 #include "areamgr.h"
+#include "blklst-ao.h"
 
 #define AREA_MGR_BLKMGR	2
 
+/* Number of blocks freed by other instances that forces them to be reclaimed */
+#define BLKMGR_REMOTE_LIMIT	32
+
 struct blkmgr
 {
 	arealst_t blklst;
 
 	areamgr_t *areamgr;
+
+	/* index of this instance - stored in managed areas */
+	uint8_t cpu;
+
+	/* blocks freed from other processors - linked through their first word */
+	void *remote;
+	uint32_t remotecnt;
+
+	/* recently freed blocks whose release is deferred */
+	mb_quick_lists_t quick;
 };
 
 typedef struct blkmgr blkmgr_t;
 
 /* function prototypes */
-void blkmgr_init(blkmgr_t *blkmgr, areamgr_t *areamgr);
+void blkmgr_init(blkmgr_t *blkmgr, areamgr_t *areamgr, uint8_t cpu);
 void *blkmgr_alloc(blkmgr_t *blkmgr, uint32_t size, uint32_t alignment);
+uint32_t blkmgr_alloc_batch(blkmgr_t *blkmgr, uint32_t size, void **blocks, uint32_t count);
 bool blkmgr_realloc(blkmgr_t *blkmgr, void *memory, uint32_t new_size);
 bool blkmgr_free(blkmgr_t *blkmgr, void *memory);
+uint32_t blkmgr_free_batch(blkmgr_t *blkmgr, void **blocks, uint32_t count);
+bool blkmgr_free_remote(blkmgr_t *blkmgr, void *memory);
+uint32_t blkmgr_get_size(void *memory);
 bool blkmgr_verify(blkmgr_t *blkmgr, bool verbose);
 
 #endif
@@ -6,8 +6,8 @@
 #if 0 /* === BEGIN: example usage ========================================== */
 
 #include <stdint.h>
-#include <pthread.h>
 #include "common.h"
+#include "lock.h"
 
 struct myList;
 struct myItem;
@@ -25,8 +25,7 @@ struct myList
 	uint32_t	itemcnt;
 
 	/* list lock */
-	pthread_rwlock_t	 lock;
-	pthread_rwlockattr_t lock_attr;
+	lock_t lock;
 };
 
 struct myItem
@@ -57,7 +56,6 @@ static inline myItem_t *myItem_set_next(myItem_t *self, myItem_t *next) { self->
 #define __SET_NEXT(item,n)	myItem_set_next(item, n)
 #define __KEY(item)			item->size
 #define __LOCK(item)		item->lock
-#define __LOCK_ATTR(item)	item->lock_attr
 #define __KEY_LT(a,b)		(a) < (b)
 #define __KEY_EQ(a,b)		(a) == (b)
 
@@ -77,9 +75,9 @@ static inline myItem_t *myItem_set_next(myItem_t *self, myItem_t *next) { self->
 
 /* template code */
 
-static inline void __METHOD(__LIST_DECL, rdlock) { pthread_rwlock_rdlock(&__LOCK(self)); }
-static inline void __METHOD(__LIST_DECL, wrlock) { pthread_rwlock_wrlock(&__LOCK(self)); }
-static inline void __METHOD(__LIST_DECL, unlock) { pthread_rwlock_unlock(&__LOCK(self)); }
+static inline void __METHOD(__LIST_DECL, rdlock) { lock_acquire_shared(&__LOCK(self)); }
+static inline void __METHOD(__LIST_DECL, wrlock) { lock_acquire(&__LOCK(self)); }
+static inline void __METHOD(__LIST_DECL, unlock) { lock_release(&__LOCK(self)); }
 
 /**
  * Initializer.
@@ -94,9 +92,7 @@ void __METHOD(__LIST_DECL, init)
 	__COUNTER(self) = 0;
 
 	/* Initialize locking mechanizm */
-	pthread_rwlockattr_init(&__LOCK_ATTR(self));
-	pthread_rwlockattr_setpshared(&__LOCK_ATTR(self), 1);
-	pthread_rwlock_init(&__LOCK(self), &__LOCK_ATTR(self));
+	lock_init(&__LOCK(self));
 }
 
 /**
@@ -403,7 +399,6 @@ void __METHOD_ARGS(__LIST_DECL, join, __LIST_T *list, locking_t lock)
 #undef __NEXT
 #undef __KEY
 #undef __LOCK
-#undef __LOCK_ATTR
 #undef __KEY_LT
 #undef __KEY_EQ
 
@@ -1,13 +1,13 @@
 /*
  * Author:	Krystian Bacławski <name.surname@gmail.com>
- * Desc:	Semi-template for splay tree with locking
+ * Desc:	Semi-template for splay tree with optional locking
  */
 
-#if 1 /* === BEGIN: example usage ========================================== */
+#if 0 /* === BEGIN: example usage ========================================== */
 
 #include <stdint.h>
-#include <pthread.h>
 #include "common.h"
+#include "lock.h"
 
 struct myTree;
 struct myItem;
@@ -21,8 +21,7 @@ struct myTree
 	myNode_t *root;
 
 	/* tree lock */
-	pthread_rwlock_t	 lock;
-	pthread_rwlockattr_t lock_attr;
+	lock_t lock;
 };
 
 struct myNode
@@ -47,16 +46,33 @@ struct myNode
 #define __PARENT(node)		node->parent
 #define __KEY(node)			node->size
 #define __LOCK(tree)		tree->lock
-#define __LOCK_ATTR(tree)	tree->lock_attr
 #define __KEY_LT(a,b)		a < b
 #define __KEY_EQ(a,b)		a == b
 
+/* __LOCK can be left undefined if tree needs no locking */
+
+/* __SET_ROOT, __SET_LEFT, __SET_RIGHT and __SET_PARENT can be defined if
+ * links are not plain pointers, i.e. cannot be assigned to directly */
+
 #endif /* === END: example usage =========================================== */
 
 /* internal macros */
 #define __TREE_DECL			__TREE, __TREE_T
 #define __NODE_DECL			__NODE, __NODE_T
 
+#ifndef __SET_ROOT
+#define __SET_ROOT(tree,ptr)	__ROOT(tree) = (ptr)
+#endif
+#ifndef __SET_LEFT
+#define __SET_LEFT(node,ptr)	__LEFT(node) = (ptr)
+#endif
+#ifndef __SET_RIGHT
+#define __SET_RIGHT(node,ptr)	__RIGHT(node) = (ptr)
+#endif
+#ifndef __SET_PARENT
+#define __SET_PARENT(node,ptr)	__PARENT(node) = (ptr)
+#endif
+
 /* function-like internal macros */
 #define __CONCAT3(A, B, C)						A ## B ## C
 #define __METHOD_0(OBJ, TYPE, NAME)				__CONCAT3(OBJ, _, NAME)(TYPE *self)
@@ -67,9 +83,50 @@ struct myNode
 
 /* template code */
 
-static inline void __METHOD(__TREE_DECL, rdlock) { pthread_rwlock_rdlock(&__LOCK(self)); }
-static inline void __METHOD(__TREE_DECL, wrlock) { pthread_rwlock_wrlock(&__LOCK(self)); }
-static inline void __METHOD(__TREE_DECL, unlock) { pthread_rwlock_unlock(&__LOCK(self)); }
+#ifdef __LOCK
+static inline void __METHOD(__TREE_DECL, rdlock) { lock_acquire_shared(&__LOCK(self)); }
+static inline void __METHOD(__TREE_DECL, wrlock) { lock_acquire(&__LOCK(self)); }
+static inline void __METHOD(__TREE_DECL, unlock) { lock_release(&__LOCK(self)); }
+#endif
+
+/**
+ * Rotate the node with its parent.
+ *
+ * @param self
+ * @param x
+ */
+
+static inline void __METHOD_ARGS(__TREE_DECL, rotate, __NODE_T *x)
+{
+	__NODE_T *p = __PARENT(x);
+	__NODE_T *g = __PARENT(p);
+
+	if (__LEFT(p) == x) {
+		__SET_LEFT(p, __RIGHT(x));
+
+		if (__LEFT(p))
+			__SET_PARENT(__LEFT(p), p);
+
+		__SET_RIGHT(x, p);
+	} else {
+		__SET_RIGHT(p, __LEFT(x));
+
+		if (__RIGHT(p))
+			__SET_PARENT(__RIGHT(p), p);
+
+		__SET_LEFT(x, p);
+	}
+
+	__SET_PARENT(p, x);
+	__SET_PARENT(x, g);
+
+	if (g == NULL)
+		__SET_ROOT(self, x);
+	else if (__LEFT(g) == p)
+		__SET_LEFT(g, x);
+	else
+		__SET_RIGHT(g, x);
+}
 
 /**
  * Splay operation for given node.
@@ -85,79 +142,20 @@ static void __METHOD_ARGS(__TREE_DECL, splay, __NODE_T *x)
 	__NODE_T *p;
 	__NODE_T *g;
 
-	while (TRUE) {
-		p = __PARENT(x);
-		
-		if (p == NULL)
-			break;
-
+	while ((p = __PARENT(x)) != NULL) {
 		g = __PARENT(p);
 
-		if (g == NULL) {
-			__ROOT(self) = x;
-			__PARENT(x)  = NULL;
-			__PARENT(p)  = x;
-
-			if (__LEFT(p) == x) {
-				/* left zig */
-				__LEFT(p)  = __RIGHT(x);
-				__RIGHT(x) = p;
-			} else {
-				/* right zig */
-				__RIGHT(p) = __LEFT(x);
-				__LEFT(x)  = p;
-			}
-		} else {
-			if (__PARENT(g)) {
-				if (__LEFT(__PARENT(g)) == g)
-					__LEFT(__PARENT(g)) = x;
-				else
-					__RIGHT(__PARENT(g)) = x;
-			} else {
-				__ROOT(self) = x;
-			}
-
-			__PARENT(x) = __PARENT(g);
-			__PARENT(p) = x;
-
-			if (__LEFT(p) == x) {
-				if (__LEFT(g) == p) {
-					/* left zig-zig */
-					__PARENT(g) = p;
-
-					__LEFT(g)  = __RIGHT(p);
-					__LEFT(p)  = __RIGHT(x);
-					__RIGHT(p) = g;
-					__RIGHT(x) = p;
-				} else {
-					/* left zig-zag */
-					__PARENT(g) = x;
-
-					__RIGHT(p) = __LEFT(x);
-					__LEFT(g)  = __RIGHT(x);
-					__LEFT(x)  = p;
-					__RIGHT(x) = g;
-				}
-			} else {
-				if (__RIGHT(g) == p) {
-					/* right zig-zig */
-					__PARENT(g) = p;
-
-					__RIGHT(g) = __LEFT(p);
-					__RIGHT(p) = __LEFT(x);
-					__LEFT(p)  = g;
-					__LEFT(x)  = p;
-				} else {
-					/* right zig-zag */
-					__PARENT(g) = x;
-
-					__LEFT(p)  = __RIGHT(x);
-					__RIGHT(g) = __LEFT(x);
-					__LEFT(x)  = g;
-					__RIGHT(x) = p;
-				}
-			}
+		if (g != NULL) {
+			if ((__LEFT(g) == p) == (__LEFT(p) == x))
+				/* zig-zig */
+				__CALL(__TREE, rotate, self, p);
+			else
+				/* zig-zag */
+				__CALL(__TREE, rotate, self, x);
 		}
+
+		/* zig */
+		__CALL(__TREE, rotate, self, x);
 	}
 }
 
@@ -173,12 +171,14 @@ __NODE_T *__METHOD(__NODE_DECL, next)
 		while (__LEFT(next) != NULL)
 			next = __LEFT(next);
 	} else {
-		__NODE_T *son;
+		__NODE_T *son = self;
+
+		next = __PARENT(self);
 
-		do {
+		while ((next != NULL) && (__RIGHT(next) == son)) {
 			son  = next;
 			next = __PARENT(next);
-		} while ((next != NULL) && (__RIGHT(next) == son));
+		}
 	}
 
 	return next;
@@ -193,26 +193,31 @@ __NODE_T *__METHOD(__NODE_DECL, prev)
 	__NODE_T *prev = __LEFT(self);
 
 	if (prev != NULL) {
-		while (__RIGHT(next) != NULL)
-			prev = __RIGHT(next);
+		while (__RIGHT(prev) != NULL)
+			prev = __RIGHT(prev);
 	} else {
-		__NODE_T *son;
+		__NODE_T *son = self;
+
+		prev = __PARENT(self);
 
-		do {
+		while ((prev != NULL) && (__LEFT(prev) == son)) {
 			son  = prev;
 			prev = __PARENT(prev);
-		} while ((prev != NULL) && (__LEFT(prev) == son));
+		}
 	}
 
 	return prev;
 }
 
 /**
- * Split the splay tree with given node.
+ * Split the splay tree with given node. Nodes lesser than the node stay in
+ * the tree, the node and greater ones are moved to the second tree.
  */
 
 void __METHOD_ARGS(__TREE_DECL, split, __TREE_T *tree, __NODE_T *node)
 {
+	__SET_ROOT(tree, NULL);
+
 	if (__ROOT(self)) {
 		/* splay at the node */
 		__CALL(__TREE, splay, self, node);
@@ -220,24 +225,32 @@ void __METHOD_ARGS(__TREE_DECL, split, __TREE_T *tree, __NODE_T *node)
 		I(__ROOT(self) == node);
 
 		/* left subtree will be first tree */
-		__ROOT(tree) = __ROOT(self);
-		__ROOT(self) = __LEFT(__ROOT(self));
+		__SET_ROOT(tree, __ROOT(self));
+		__SET_ROOT(self, __LEFT(__ROOT(self)));
 
 		if (__ROOT(self)) {
-			__PARENT(__ROOT(self)) = NULL;
+			__SET_PARENT(__ROOT(self), NULL);
 		}
 
-		__LEFT(__ROOT(tree)) = NULL;
+		__SET_LEFT(__ROOT(tree), NULL);
 	}
 }
 
 /**
- * Merge two splay trees.
+ * Merge two splay trees. All nodes of the second tree must be greater than
+ * nodes of the first one.
  */
 
-void __METHOD_ARGS(__TREE_DECL, merge, __TREE_T *tree);
+void __METHOD_ARGS(__TREE_DECL, merge, __TREE_T *tree)
 {
-	I(__ROOT(self) && __ROOT(root));
+	if (__ROOT(tree) == NULL)
+		return;
+
+	if (__ROOT(self) == NULL) {
+		__SET_ROOT(self, __ROOT(tree));
+		__SET_ROOT(tree, NULL);
+		return;
+	}
 
 	/* find last node in first tree */
 	__NODE_T *last = __ROOT(self);
@@ -247,19 +260,11 @@ void __METHOD_ARGS(__TREE_DECL, merge, __TREE_T *tree);
 
 	__CALL(__TREE, splay, self, last);
 
-	/* find first node in the second tree */
-	__NODE_T *first = __ROOT(tree);
-
-	while (__LEFT(first))
-		first = __LEFT(first);
-
-	__CALL(__TREE, splay, tree, first);
-
 	/* make second tree a right subtree of first tree */
-	__RIGHT(__ROOT(self)) = __ROOT(tree);
-	__PARENT(__RIGHT(__ROOT(self))) = __ROOT(self);
+	__SET_RIGHT(__ROOT(self), __ROOT(tree));
+	__SET_PARENT(__RIGHT(__ROOT(self)), __ROOT(self));
 
-	__ROOT(tree) = NULL;
+	__SET_ROOT(tree, NULL);
 }
 
 /**
@@ -270,12 +275,12 @@ void __METHOD_ARGS(__TREE_DECL, merge, __TREE_T *tree);
 
 void __METHOD(__TREE_DECL, init)
 {
-	__ROOT(self)	= NULL;
+	__SET_ROOT(self, NULL);
 
+#ifdef __LOCK
 	/* Initialize locking mechanizm */
-	pthread_rwlockattr_init(&__LOCK_ATTR(self));
-	pthread_rwlockattr_setpshared(&__LOCK_ATTR(self), 1);
-	pthread_rwlock_init(&__LOCK(self), &__LOCK_ATTR(self));
+	lock_init(&__LOCK(self));
+#endif
 }
 
 /**
@@ -289,13 +294,22 @@ void __METHOD_ARGS(__TREE_DECL, insert, __NODE_T *node)
 {
 	__NODE_T *iter = __ROOT(self);
 
+	__SET_LEFT(node, NULL);
+	__SET_RIGHT(node, NULL);
+	__SET_PARENT(node, NULL);
+
+	if (iter == NULL) {
+		__SET_ROOT(self, node);
+		return;
+	}
+
 	while (TRUE) {
 		if (__KEY_LT(__KEY(node), __KEY(iter))) {
 			if (__LEFT(iter)) {
 				iter = __LEFT(iter);
 			} else {
-				__LEFT(iter) = node;
-				__PARENT(node) = iter;
+				__SET_LEFT(iter, node);
+				__SET_PARENT(node, iter);
 
 				break;
 			}
@@ -303,8 +317,8 @@ void __METHOD_ARGS(__TREE_DECL, insert, __NODE_T *node)
 			if (__RIGHT(iter)) {
 				iter = __RIGHT(iter);
 			} else {
-				__RIGHT(iter) = node;
-				__PARENT(node) = iter;
+				__SET_RIGHT(iter, node);
+				__SET_PARENT(node, iter);
 
 				break;
 			}
@@ -345,6 +359,81 @@ __NODE_T *__METHOD_ARGS(__TREE_DECL, search, __KEY_T key)
 	return iter;
 }
 
+/**
+ * Search the tree for the least node not lesser than given key.
+ *
+ * @param self
+ * @param key
+ * @return
+ */
+
+__NODE_T *__METHOD_ARGS(__TREE_DECL, lower_bound, __KEY_T key)
+{
+	__NODE_T *iter  = __ROOT(self);
+	__NODE_T *last  = NULL;
+	__NODE_T *found = NULL;
+
+	while (iter) {
+		last = iter;
+
+		if (__KEY_LT(__KEY(iter), key)) {
+			iter = __RIGHT(iter);
+		} else {
+			found = iter;
+			iter  = __LEFT(iter);
+		}
+	}
+
+	if (found)
+		__CALL(__TREE, splay, self, found);
+	else if (last)
+		__CALL(__TREE, splay, self, last);
+
+	return found;
+}
+
+/**
+ * Find the least node in the tree.
+ *
+ * @param self
+ * @return
+ */
+
+__NODE_T *__METHOD(__TREE_DECL, first)
+{
+	__NODE_T *first = __ROOT(self);
+
+	if (first != NULL) {
+		while (__LEFT(first))
+			first = __LEFT(first);
+
+		__CALL(__TREE, splay, self, first);
+	}
+
+	return first;
+}
+
+/**
+ * Find the greatest node in the tree.
+ *
+ * @param self
+ * @return
+ */
+
+__NODE_T *__METHOD(__TREE_DECL, last)
+{
+	__NODE_T *last = __ROOT(self);
+
+	if (last != NULL) {
+		while (__RIGHT(last))
+			last = __RIGHT(last);
+
+		__CALL(__TREE, splay, self, last);
+	}
+
+	return last;
+}
+
 /**
  * Remove a node from the tree.
  *
@@ -360,25 +449,33 @@ void __METHOD_ARGS(__TREE_DECL, remove, __NODE_T *node)
 	I(__ROOT(self) == node);
 
 	/* get left and right subtree */
-	__NODE_T *left  = __LEFT(__ROOT(self));
-	__NODE_T *right = __RIGHT(__ROOT(self));
-
-	if ((left != NULL) && (right != NULL)) {
-		__LEFT(right)   = left;
-		__PARENT(right) = NULL;
-		__PARENT(left)  = right;
-		__ROOT(self)    = right;
-	} else if (left != NULL) {
-		__ROOT(self)    = left;
-		__PARENT(left)  = NULL;
-	} else if (right != NULL) {
-		__ROOT(self)    = right;
-		__PARENT(right) = NULL;
+	__NODE_T *left  = __LEFT(node);
+	__NODE_T *right = __RIGHT(node);
+
+	if (left != NULL) {
+		/* the greatest node of left subtree becomes new root */
+		__SET_PARENT(left, NULL);
+		__SET_ROOT(self, left);
+
+		while (__RIGHT(left))
+			left = __RIGHT(left);
+
+		__CALL(__TREE, splay, self, left);
+
+		__SET_RIGHT(left, right);
+
+		if (right != NULL)
+			__SET_PARENT(right, left);
+	} else {
+		__SET_ROOT(self, right);
+
+		if (right != NULL)
+			__SET_PARENT(right, NULL);
 	}
 
-	__LEFT(node)   = NULL;
-	__RIGHT(node)  = NULL;
-	__PARENT(node) = NULL;
+	__SET_LEFT(node, NULL);
+	__SET_RIGHT(node, NULL);
+	__SET_PARENT(node, NULL);
 }
 
 /* === undefine macros ===================================================== */
@@ -392,9 +489,12 @@ void __METHOD_ARGS(__TREE_DECL, remove, __NODE_T *node)
 #undef __LEFT
 #undef __RIGHT
 #undef __PARENT
+#undef __SET_ROOT
+#undef __SET_LEFT
+#undef __SET_RIGHT
+#undef __SET_PARENT
 #undef __KEY
 #undef __LOCK
-#undef __LOCK_ATTR
 #undef __KEY_LT
 #undef __KEY_EQ
 
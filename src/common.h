@@ -13,8 +13,8 @@ typedef enum { DONTLOCK, LOCK } locking_t;
 
 extern bool verbose;
 
-#define ALIGN_UP(data, size)	(((uint32_t)(data) + ((size) - 1)) & ~((size) - 1))
-#define ALIGN_DOWN(data, size)	((uint32_t)(data) & ~((size) - 1))
+#define ALIGN_UP(data, size)	(((uintptr_t)(data) + ((size) - 1)) & ~((uintptr_t)(size) - 1))
+#define ALIGN_DOWN(data, size)	((uintptr_t)(data) & ~((uintptr_t)(size) - 1))
 #define ALIGN(data, size)		ALIGN_UP((data), (size))
 
 #if VERBOSE == 1
@@ -27,6 +27,17 @@ extern bool verbose;
 
 #define offsetof(type, member)	__builtin_offsetof(type, member)
 
+/*
+ * Minimal alignment of blocks returned to the user - twice the size of
+ * a pointer, as on most platforms.
+ */
+
+#ifdef __LP64__
+#define MIN_ALIGNMENT	16
+#else
+#define MIN_ALIGNMENT	8
+#endif
+
 /*
  * A few constants meaningful for Pentium 4 cache facts.
  */
@@ -38,12 +49,78 @@ extern bool verbose;
 #define L3_LINE_SIZE	128
 
 /*
- * Simple algorithm for calculating checksum.
+ * Checksums of internal structures. Mode is selected at compile time:
+ *
+ *  CHECKSUM_NONE	- structures are neither checksummed nor checked,
+ *  CHECKSUM_VERIFY	- checksums are kept up to date, but checked only while
+ *					  verifying memory manager,
+ *  CHECKSUM_FULL	- checksums are checked whenever a structure is accessed,
+ *  CHECKSUM_KEYED	- as above, but checksum is a hash of the structure keyed
+ *					  with a per-process random key and its address.
+ *
+ * Keyed checksums are inherited by forked children. Memory shared with
+ * unrelated processes has to be checksummed with a key of its own, kept along
+ * with it.
  */
 
-static inline uint16_t checksum(uint16_t *data, uint32_t words)
+#define CHECKSUM_NONE	0
+#define CHECKSUM_VERIFY	1
+#define CHECKSUM_FULL	2
+#define CHECKSUM_KEYED	3
+
+#ifndef CHECKSUM
+#define CHECKSUM		CHECKSUM_FULL
+#endif
+
+#if CHECKSUM == CHECKSUM_KEYED
+extern uint32_t checksum_key;
+
+uint32_t checksum_new_key(void);
+#else
+#define checksum_key 0
+#define checksum_new_key() 0
+#endif
+
+/*
+ * Initial value of checksum for structure at given address, keyed with given
+ * key (ignored unless checksums are keyed).
+ */
+
+static inline uint32_t checksum_seed(void *addr, uint32_t key)
 {
-	uint16_t sum = 0;
+	uint32_t seed = (uint32_t)((uint64_t)(uintptr_t)addr >> 32) ^ (uint32_t)(uintptr_t)addr;
+
+#if CHECKSUM == CHECKSUM_KEYED
+	return (seed ^ key) * 0x9E3779B1;
+#else
+	return seed;
+#endif
+}
+
+/*
+ * Algorithm for calculating checksum. Words are simply xored together with
+ * the seed. Keyed checksum mixes each word into the state by multiplication
+ * and shift instead, so it is not linear in the words - knowing checksum of
+ * some contents does not tell the checksum of other ones without the key.
+ */
+
+static inline uint16_t checksum(uint32_t seed, uint16_t *data, uint32_t words)
+{
+#if CHECKSUM == CHECKSUM_KEYED
+	uint32_t sum = seed;
+
+	while (words > 0) {
+		sum  = (sum ^ *data++) * 0x85EBCA6B;
+		sum ^= sum >> 13;
+		words--;
+	}
+
+	sum  = (sum ^ seed) * 0xC2B2AE35;
+	sum ^= sum >> 16;
+
+	return (uint16_t)sum;
+#else
+	uint16_t sum = (uint16_t)(seed >> 16) ^ (uint16_t)(seed & 0xFFFF);
 
 	while (words > 0) {
 		sum	^= *data++;
@@ -51,13 +128,14 @@ static inline uint16_t checksum(uint16_t *data, uint32_t words)
 	}
 
 	return sum;
+#endif
 }
 
-static inline void hexdump(void *data, uint32_t size)
+static inline void hexdump(void *data, size_t size)
 {
-	uint32_t i;
+	size_t i;
 
-	fprintf(stderr, "Dumping %u bytes at %.8x:", size, (uint32_t)data);
+	fprintf(stderr, "Dumping %zu bytes at %p:", size, data);
 
 	for (i = 0; i < size; i++) {
 		if (i % 32 == 0)
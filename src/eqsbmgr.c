@@ -13,15 +13,40 @@
 #define SB_COUNT_MAX	32764
 #define AREA_MAX_SIZE 	SB_COUNT_MAX * SB_SIZE
 
+/*
+ * Blocks are taken from and returned to superblocks without holding manager's
+ * lock exclusively. Control word is updated with compare-and-swap, bitmap
+ * with atomic operations. A block is first reserved by decrementing free
+ * blocks' counter, then its bit is claimed, so a reservation always finds
+ * a free bit. Freeing sets the bit before incrementing the counter.
+ *
+ * Superblocks are moved between lists only with manager's lock held
+ * exclusively - whoever observes that a superblock became full, nonempty
+ * or empty settles it afterwards.
+ */
+
+/* Super-block's control word */
+
+union sb_control
+{
+	struct {
+		uint16_t	fblkcnt:7;			/* if fblkcnt == 127 then block is free */
+		uint16_t	size:7;
+		uint16_t	blksize:2;
+	};
+
+	uint16_t control;
+};
+
 /* Super-block structure */
 
 struct sb
 {
+	/* set if superblock is on list of full superblocks */
+	uint16_t	full;
+
 	/* superblock's control field */
-	uint16_t 	checksum;
-	uint16_t	fblkcnt:7;				/* if fblkcnt == 127 then block is free */
-	uint16_t	size:7;
-	uint16_t	blksize:2;
+	union sb_control;
 
 	/* superblocks' list pointers */
 	int16_t	prev;
@@ -82,6 +107,8 @@ typedef struct sb_mgr sb_mgr_t;
 
 static bool sb_mgr_verify(sb_mgr_t *self, bool verbose);
 
+static void eqsbmgr_settle(eqsbmgr_t *self, sb_t *sb, bool *print_at_exit);
+
 /* Declaration of superblocks' list */
 
 static inline sb_t *sb_get_prev(sb_t *self)/*{{{*/
@@ -91,7 +118,7 @@ static inline sb_t *sb_get_prev(sb_t *self)/*{{{*/
 
 static inline void sb_set_prev(sb_t *self, sb_t *prev)/*{{{*/
 {
-	self->prev = (prev == NULL) ? 0 : ((int32_t)prev / SB_SIZE) - ((int32_t)self / SB_SIZE);
+	self->prev = (prev == NULL) ? 0 : ((intptr_t)prev / SB_SIZE) - ((intptr_t)self / SB_SIZE);
 }/*}}}*/
 
 static inline sb_t *sb_get_next(sb_t *self)/*{{{*/
@@ -101,7 +128,7 @@ static inline sb_t *sb_get_next(sb_t *self)/*{{{*/
 
 static inline void sb_set_next(sb_t *self, sb_t *next)/*{{{*/
 {
-	self->next = (next == NULL) ? 0 : ((int32_t)next / SB_SIZE) - ((int32_t)self / SB_SIZE);
+	self->next = (next == NULL) ? 0 : ((intptr_t)next / SB_SIZE) - ((intptr_t)self / SB_SIZE);
 }/*}}}*/
 
 #define __LIST				sb_list
@@ -153,7 +180,7 @@ static uint8_t sb_get_blocks(sb_t *self)/*{{{*/
 
 static inline sb_t *sb_get_from_address(void *address)/*{{{*/
 {
-	return (sb_t *)((uint32_t)address & 0xFFFFFC00);
+	return (sb_t *)((uintptr_t)address & ~(uintptr_t)(SB_SIZE - 1));
 }/*}}}*/
 
 /**
@@ -188,6 +215,7 @@ static void sb_prepare(sb_t *self, uint8_t blksize)/*{{{*/
 	I(blksize < 4);
 
 	self->blksize = blksize;
+	self->full	  = FALSE;
 
 	/* initialize bitmap */
 	int32_t blocks = sb_get_blocks(self);
@@ -203,37 +231,72 @@ static void sb_prepare(sb_t *self, uint8_t blksize)/*{{{*/
 		self->bitmap[i] = ~((1 << (32 - blocks)) - 1);
 }/*}}}*/
 
+/**
+ * Reserve a block within given superblock by decrementing free blocks'
+ * counter.
+ *
+ * @param self
+ * @param left		number of free blocks that remained
+ * @return			TRUE if a block was reserved
+ */
+
+static bool sb_reserve(sb_t *self, uint32_t *left)/*{{{*/
+{
+	union sb_control old, new;
+
+	do {
+		old.control = *(volatile uint16_t *)&self->control;
+
+		I(old.fblkcnt != 127);
+
+		if (old.fblkcnt == 0)
+			return FALSE;
+
+		new = old;
+		new.fblkcnt--;
+	} while (!__sync_bool_compare_and_swap(&self->control, old.control, new.control));
+
+	*left = new.fblkcnt;
+
+	return TRUE;
+}/*}}}*/
+
 /**
  * Allocate a block within given superblock and return its' index.
  *
  * @param self
+ * @param exhausted	set if the last free block was taken
  * @return
  */
 
-static int16_t sb_alloc(sb_t *self)/*{{{*/
+static int16_t sb_alloc(sb_t *self, bool *exhausted)/*{{{*/
 {
-	if (self->fblkcnt == 0)
+	uint32_t left;
+
+	if (!sb_reserve(self, &left))
 		return -1;
 
-	uint32_t i = 0, j = 0, lastblk = sb_get_blocks(self);
+	*exhausted = (left == 0);
 
-	while (i < lastblk) {
-		uint32_t data = self->bitmap[i >> 5];
+	uint32_t i, lastblk = sb_get_blocks(self);
 
-		j = (data == 0) ? 0 : __builtin_clz(data) + 1;
-		
-		if (j > 0)
-			break;
+	/* reservation guarantees that a free bit will be found */
+	while (TRUE) {
+		for (i = 0; i < lastblk; i += 32) {
+			volatile uint32_t *word = &self->bitmap[i >> 5];
 
-		i += 32;
-	}
+			uint32_t data = *word;
 
-	I(j > 0);
+			while (data != 0) {
+				uint32_t j = __builtin_clz(data);
 
-	self->fblkcnt--;
-	self->bitmap[i >> 5] &= ~(1 << (32 - j));
+				if (__sync_bool_compare_and_swap(word, data, data & ~(0x80000000U >> j)))
+					return (i + j);
 
-	return (i + j - 1);
+				data = *word;
+			}
+		}
+	}
 }/*}}}*/
 
 /**
@@ -269,19 +332,30 @@ static uint16_t sb_alloc_indexed(sb_t *self, uint32_t index)/*{{{*/
  *
  * @param self
  * @param index
+ * @return		number of free blocks in superblock
  */
 
-static void sb_free(sb_t *self, uint32_t index)/*{{{*/
+static uint32_t sb_free(sb_t *self, uint32_t index)/*{{{*/
 {
-	DEBUG("Free block of index %u in SB at $%.8x\n", index, (uint32_t)self);
+	DEBUG("Free block of index %u in SB at %p\n", index, (void *)self);
 
 	uint32_t i = index >> 5, j = 31 - (index & 0x1F), lastblk = sb_get_blocks(self);
 
 	I(index < lastblk);
-	I((self->bitmap[i] & (1 << j)) == 0);
+	I((self->bitmap[i] & (1U << j)) == 0);
+
+	__sync_fetch_and_or(&self->bitmap[i], 1U << j);
 
-	self->fblkcnt++;
-	self->bitmap[i] |= (1 << j);
+	union sb_control old, new;
+
+	do {
+		old.control = *(volatile uint16_t *)&self->control;
+
+		new = old;
+		new.fblkcnt++;
+	} while (!__sync_bool_compare_and_swap(&self->control, old.control, new.control));
+
+	return new.fblkcnt;
 }/*}}}*/
 
 /**
@@ -293,7 +367,7 @@ static void sb_free(sb_t *self, uint32_t index)/*{{{*/
  */
 
 static inline sb_t *sb_grp_nth(sb_t *self, uint16_t i) {/*{{{*/
-	return (sb_t *)(((uint32_t)self & 0xFFFFF000) + i * SB_SIZE);
+	return (sb_t *)(((uintptr_t)self & ~(uintptr_t)(PAGE_SIZE - 1)) + i * SB_SIZE);
 }/*}}}*/
 
 /**
@@ -304,7 +378,7 @@ static inline sb_t *sb_grp_nth(sb_t *self, uint16_t i) {/*{{{*/
  */
 
 static inline uint16_t sb_grp_index(sb_t *self) {/*{{{*/
-	return ((uint32_t)self - ((uint32_t)self & 0xFFFFF000)) / SB_SIZE;
+	return ((uintptr_t)self - ((uintptr_t)self & ~(uintptr_t)(PAGE_SIZE - 1))) / SB_SIZE;
 }/*}}}*/
 
 /**
@@ -315,7 +389,7 @@ static inline uint16_t sb_grp_index(sb_t *self) {/*{{{*/
  */
 
 static inline sb_mgr_t *sb_mgr_from_area(area_t *self) {/*{{{*/
-	return (sb_mgr_t *)((uint32_t)self - sizeof(sb_mgr_t));
+	return (sb_mgr_t *)((uintptr_t)area_end(self) - sizeof(sb_mgr_t));
 }/*}}}*/
 
 /**
@@ -326,7 +400,7 @@ static inline sb_mgr_t *sb_mgr_from_area(area_t *self) {/*{{{*/
 
 static void sb_mgr_init(sb_mgr_t *self)/*{{{*/
 {
-	DEBUG("Initialize SBs' manager at $%.8x.\n", (uint32_t)self);
+	DEBUG("Initialize SBs' manager at %p.\n", (void *)self);
 
 	uint32_t i;
 
@@ -350,7 +424,7 @@ static void sb_mgr_init(sb_mgr_t *self)/*{{{*/
 
 static sb_t *sb_mgr_alloc(sb_mgr_t *self, uint16_t blksize)/*{{{*/
 {
-	DEBUG("Allocate new SB from SBs' manager at $%.8x.\n", (uint32_t)self);
+	DEBUG("Allocate new SB from SBs' manager at %p.\n", (void *)self);
 
 	sb_t *sb = NULL;
 
@@ -393,12 +467,13 @@ static sb_t *sb_mgr_alloc(sb_mgr_t *self, uint16_t blksize)/*{{{*/
 
 static void sb_mgr_free(sb_mgr_t *self, sb_t *sb)/*{{{*/
 {
-	DEBUG("Return SB at $%.8x to SBs' manager at $%.8x.\n", (uint32_t)sb, (uint32_t)self);
+	DEBUG("Return SB at %p to SBs' manager at %p.\n", (void *)sb, (void *)self);
 
 	int32_t i = sb_grp_index(sb);
 
 	sb->blksize = 0;
 	sb->fblkcnt = 127;
+	sb->full	= FALSE;
 
 	if (i < 3) {
 		sb_t *next = sb_grp_nth(sb, i + 1);
@@ -436,20 +511,49 @@ static void sb_mgr_free(sb_mgr_t *self, sb_t *sb)/*{{{*/
 	self->free++;
 }/*}}}*/
 
+/**
+ * Move superblock to the list that matches number of its free blocks. If all
+ * blocks are free then superblock is returned to superblocks' manager.
+ *
+ * @param self
+ * @param sb
+ */
+
+static void sb_mgr_settle(sb_mgr_t *self, sb_t *sb)/*{{{*/
+{
+	if (sb->fblkcnt == 127)
+		return;
+
+	if ((sb->fblkcnt == 0) && !sb->full) {
+		sb_list_remove(&self->nonempty[sb->blksize], sb);
+		sb_list_push(&self->full, sb);
+		sb->full = TRUE;
+	} else if ((sb->fblkcnt > 0) && sb->full) {
+		sb_list_remove(&self->full, sb);
+		sb_list_push(&self->nonempty[sb->blksize], sb);
+		sb->full = FALSE;
+	}
+
+	if (sb->fblkcnt == sb_get_blocks(sb)) {
+		sb_list_remove(&self->nonempty[sb->blksize], sb);
+		sb_mgr_free(self, sb);
+	}
+}/*}}}*/
+
 /**
  * Add memory pages to superblocks' manager and initialize them.
  */
 
 static void sb_mgr_add(sb_mgr_t *self, void *memory, uint16_t superblocks)/*{{{*/
 {
-	DEBUG("Add %u SBs starting at $%.8x to SBs' manager at $%.8x.\n",
-		  (uint32_t)superblocks, (uint32_t)memory, (uint32_t)self);
+	DEBUG("Add %u SBs starting at %p to SBs' manager at %p.\n",
+		  (uint32_t)superblocks, (void *)memory, (void *)self);
 
 	uint16_t i;
 	sb_t *sb = NULL;
 
 	for (i = 0; i < superblocks; i++) {
-		sb = (sb_t *)((uint32_t)memory + i * SB_SIZE);
+		sb = (sb_t *)((uintptr_t)memory + i * SB_SIZE);
 
 		sb->size = (SB_SIZE - 1) >> 3;
 		sb->fblkcnt = 127;
@@ -457,6 +561,7 @@ static void sb_mgr_add(sb_mgr_t *self, void *memory, uint16_t superblocks)/*{{{*
 
 		sb->prev = 0;
 		sb->next = 0;
+		sb->full = FALSE;
 
 		if ((i & 3) == 0)
 			sb_list_push(&self->groups[sb->blksize], sb);
@@ -467,9 +572,9 @@ static void sb_mgr_add(sb_mgr_t *self, void *memory, uint16_t superblocks)/*{{{*
 
 	/* if added memory overlaps superblocks' manager then shorten last superblock */
 	if (sb == sb_get_from_address(self)) {
-		sb->size = (((uint32_t)self - (uint32_t)sb) >> 3) - 1;
+		sb->size = (((uintptr_t)self - (uintptr_t)sb) >> 3) - 1;
 
-		sb_t *prev = (sb_t *)((uint32_t)sb_get_from_address(memory) - SB_SIZE);
+		sb_t *prev = (sb_t *)((uintptr_t)sb_get_from_address(memory) - SB_SIZE);
 
 		/* check if first block before added pages exists */
 		if (self->free > superblocks) {
@@ -500,20 +605,20 @@ static bool sb_mgr_verify(sb_mgr_t *self, bool verbose)/*{{{*/
 	bool error = FALSE;
 
 	if (verbose) {
-		fprintf(stderr, "\033[1;34m   sbmgr at $%.8x [all: %u; free: %u]\033[0m\n",
-				(uint32_t)self, self->all, self->free);
+		fprintf(stderr, "\033[1;34m   sbmgr at %p [all: %u; free: %u]\033[0m\n",
+				(void *)self, self->all, self->free);
 
-		sb_t *base = (sb_t *)((uint32_t)sb_get_from_address(self) - (uint32_t)(self->all - 1) * SB_SIZE);
+		sb_t *base = (sb_t *)((uintptr_t)sb_get_from_address(self) - (self->all - 1) * SB_SIZE);
 
 		for (i = 0; i < self->all; i++) {
-			sb_t *sb = (sb_t *)((uint32_t)base + SB_SIZE * i);
+			sb_t *sb = (sb_t *)((uintptr_t)base + SB_SIZE * i);
 
 			if (sb->fblkcnt == 127) {
-				fprintf(stderr, "\033[1;32m   $%.8x: %4d\033[0m\n",
-						(uint32_t)sb, (sb->size + 1) << 3);
+				fprintf(stderr, "\033[1;32m   %p: %4d\033[0m\n",
+						(void *)sb, (sb->size + 1) << 3);
 			} else {
-				fprintf(stderr, "\033[1;31m   $%.8x: %4d : %4d : %4d : ",
-						(uint32_t)sb, (sb->size + 1) << 3, (sb->blksize + 1) << 3, sb->fblkcnt);
+				fprintf(stderr, "\033[1;31m   %p: %4d : %4d : %4d : ",
+						(void *)sb, (sb->size + 1) << 3, (sb->blksize + 1) << 3, sb->fblkcnt);
 
 				uint32_t *data = (uint32_t *)sb->bitmap;
 				uint32_t j;
@@ -534,8 +639,8 @@ static bool sb_mgr_verify(sb_mgr_t *self, bool verbose)/*{{{*/
 
 	for (i = 0; i < 4; i++) { 
 		if (verbose)
-			fprintf(stderr, "($%.8x:$%.8x:%u)", (uint32_t)self->nonempty[i].first,
-					(uint32_t)self->nonempty[i].last, self->nonempty[i].sbcnt);
+			fprintf(stderr, "(%p:%p:%u)", (void *)self->nonempty[i].first,
+					(void *)self->nonempty[i].last, self->nonempty[i].sbcnt);
 
 		usedcnt += self->nonempty[i].sbcnt;
 	}
@@ -551,8 +656,8 @@ static bool sb_mgr_verify(sb_mgr_t *self, bool verbose)/*{{{*/
 
 	for (i = 0; i < 4; i++) {
 		if (verbose)
-			fprintf(stderr, "($%.8x:$%.8x:%u)", (uint32_t)self->groups[i].first,
-					(uint32_t)self->groups[i].last, self->groups[i].sbcnt);
+			fprintf(stderr, "(%p:%p:%u)", (void *)self->groups[i].first,
+					(void *)self->groups[i].last, self->groups[i].sbcnt);
 
 		freecnt += self->groups[i].sbcnt * (i + 1);
 	}
@@ -560,8 +665,8 @@ static bool sb_mgr_verify(sb_mgr_t *self, bool verbose)/*{{{*/
 	if (verbose) {
 		fprintf(stderr, "\033[0m\n");
 
-		fprintf(stderr, "\033[0;35m   full     : ($%.8x:$%.8x:%u)\033[0m\n", (uint32_t)self->full.first,
-				(uint32_t)self->full.last, self->full.sbcnt);
+		fprintf(stderr, "\033[0;35m   full     : (%p:%p:%u)\033[0m\n", (void *)self->full.first,
+				(void *)self->full.last, self->full.sbcnt);
 
 		fprintf(stderr, "\033[0;35m   free: %d, used: %d, all: %d\033[0m\n", freecnt, usedcnt, freecnt + usedcnt);
 	}
@@ -578,8 +683,8 @@ static bool sb_mgr_verify(sb_mgr_t *self, bool verbose)/*{{{*/
 
 sb_mgr_t *sb_mgr_expand(sb_mgr_t *mgr, uint32_t newsbs, direction_t side)/*{{{*/
 {
-	DEBUG("Will expand SB's manager at $%.8x by %u SBs from %s side.\n",
-		  (uint32_t)mgr, newsbs, (side == LEFT) ? "left" : "right");
+	DEBUG("Will expand SB's manager at %p by %u SBs from %s side.\n",
+		  (void *)mgr, newsbs, (side == LEFT) ? "left" : "right");
 
 	I(newsbs > 0);
 	I(mgr->all <= SB_COUNT_MAX - newsbs);
@@ -588,17 +693,17 @@ sb_mgr_t *sb_mgr_expand(sb_mgr_t *mgr, uint32_t newsbs, direction_t side)/*{{{*/
 	sb_t     *oldsb  = sb_get_from_address(mgr);
 
 	if (side == LEFT) {
-		sb_mgr_add(mgr, (void *)((uint32_t)oldsb - (newsbs + mgr->all - 1) * SB_SIZE), newsbs);
+		sb_mgr_add(mgr, (void *)((uintptr_t)oldsb - (newsbs + mgr->all - 1) * SB_SIZE), newsbs);
 	} else {
 		/* copy old superblocks' manager to new location */
-		mgr = (sb_mgr_t *)((uint32_t)mgr + newsbs * SB_SIZE);
+		mgr = (sb_mgr_t *)((uintptr_t)mgr + newsbs * SB_SIZE);
 
 		memcpy(mgr, oldmgr, sizeof(sb_mgr_t));
 
-		DEBUG("Moved SB's manager to $%.8x [%u/%u].\n", (uint32_t)mgr, mgr->free, mgr->all);
+		DEBUG("Moved SB's manager to %p [%u/%u].\n", (void *)mgr, mgr->free, mgr->all);
 
 		/* add newly allocated pages to superblocks' manager */
-		sb_mgr_add(mgr, (void *)((uint32_t)oldsb + SB_SIZE), newsbs);
+		sb_mgr_add(mgr, (void *)((uintptr_t)oldsb + SB_SIZE), newsbs);
 
 		/* free some unused blocks */
 		uint32_t old_blocks = sb_get_blocks(oldsb);
@@ -607,17 +712,12 @@ sb_mgr_t *sb_mgr_expand(sb_mgr_t *mgr, uint32_t newsbs, direction_t side)/*{{{*/
 
 		uint32_t blocks = sb_get_blocks(oldsb);
 
-		DEBUG("Freeing %u unused blocks in SB at $%.8x\n", blocks - old_blocks, (uint32_t)oldsb);
-
-		uint32_t freeblocks = oldsb->fblkcnt;
+		DEBUG("Freeing %u unused blocks in SB at %p\n", blocks - old_blocks, (void *)oldsb);
 
 		while (blocks > old_blocks)
 			sb_free(oldsb, --blocks);
 
-		if (freeblocks == 0) {
-			sb_list_remove(&mgr->full, oldsb);
-			sb_list_push(&mgr->nonempty[oldsb->blksize], oldsb);
-		}
+		sb_mgr_settle(mgr, oldsb);
 	}
 
 	DEBUG("Expanded.\n");
@@ -630,46 +730,31 @@ sb_mgr_t *sb_mgr_expand(sb_mgr_t *mgr, uint32_t newsbs, direction_t side)/*{{{*/
  *
  * @param self		equally-sized blocks' manager structure
  * @param areamgr	address of global area manager
+ * @param cpu		index of the instance
  */
 
-void eqsbmgr_init(eqsbmgr_t *self, areamgr_t *areamgr)/*{{{*/
+void eqsbmgr_init(eqsbmgr_t *self, areamgr_t *areamgr, uint8_t cpu)/*{{{*/
 {
 	arealst_init(&self->arealst);
 
 	self->areamgr = areamgr;
+	self->cpu     = cpu;
 }/*}}}*/
 
 /**
- * Allocate a block from equally-sized blocks' manager.
- * Manager does not support alignment!
+ * Allocate a block of given class. Manager must be locked for writing.
  *
  * @param self		equally-sized blocks' manager structure
- * @param size		{i: i \in [1; 32] }
- * @param alignment {i: i = 2^k, k \in [0, 3] }
+ * @param blksize	{i: i \in [0; 3] }
  * @return			address of allocated block
  */
 
-void *eqsbmgr_alloc(eqsbmgr_t *self, uint32_t size, uint32_t alignment)/*{{{*/
+static void *eqsbmgr_alloc_internal(eqsbmgr_t *self, uint8_t blksize)/*{{{*/
 {
-	if (alignment) {
-		DEBUG("\033[37;1mRequested block of size %u aligned to %u bytes boundary.\033[0m\n", size, alignment);
-	} else {
-		DEBUG("\033[37;1mRequested block of size %u.\033[0m\n", size);
-	}
-
-	uint8_t blksize = (size - 1) >> 3;
-
-	I(blksize < 4);
-
-	/* alignment is not supported due to much more complex implementation */
-	I(alignment <= 8);
-
 	sb_t     *sb   = NULL;
     sb_mgr_t *mgr  = NULL;
 	area_t   *area = NULL;
 
-	arealst_wrlock(&self->arealst);
-
 	{
 		DEBUG("Try to find superblock with free blocks.\n");
 
@@ -678,8 +763,11 @@ void *eqsbmgr_alloc(eqsbmgr_t *self, uint32_t size, uint32_t alignment)/*{{{*/
 		while (!area_is_guard(area)) {
 			mgr = sb_mgr_from_area(area);
 
-			/* get first superblock from nonempty sbs stack */
-			if ((sb = mgr->nonempty[blksize].first))
+			/* get first superblock from nonempty sbs stack, settling exhausted ones */
+			while ((sb = mgr->nonempty[blksize].first) && (sb->fblkcnt == 0))
+				sb_mgr_settle(mgr, sb);
+
+			if (sb != NULL)
 				break;
 
 			area = area->local.next;
@@ -742,8 +830,8 @@ void *eqsbmgr_alloc(eqsbmgr_t *self, uint32_t size, uint32_t alignment)/*{{{*/
 				}
 
 				if (area_end(area) == area_begining(area->local.next)) {
-					DEBUG("Area %.8x should be merged with area %.8x\n",
-						  (uint32_t)area_begining(area), (uint32_t)area_begining(area->local.next));
+					DEBUG("Area %p should be merged with area %p\n",
+						  (void *)area_begining(area), (void *)area_begining(area->local.next));
 
 					sb_mgr_t *oldmgr = mgr;
 					sb_mgr_t *newmgr = sb_mgr_from_area(area->local.next);
@@ -785,7 +873,7 @@ void *eqsbmgr_alloc(eqsbmgr_t *self, uint32_t size, uint32_t alignment)/*{{{*/
 			area_t *newarea = areamgr_alloc_area(self->areamgr, 1);
 
 			if (newarea) {
-				newarea->manager = AREA_MGR_EQSBMGR;
+				areamgr_assign_area(self->areamgr, newarea, AREA_MGR_EQSBMGR, self->cpu, FALSE);
 
 				arealst_insert_area_by_addr(&self->arealst, (void *)newarea, DONTLOCK);
 
@@ -804,72 +892,232 @@ void *eqsbmgr_alloc(eqsbmgr_t *self, uint32_t size, uint32_t alignment)/*{{{*/
 	void *memory = NULL;
 
 	if (sb != NULL) {
-		int32_t index = sb_alloc(sb);
+		bool exhausted = FALSE;
+
+		int32_t index = sb_alloc(sb, &exhausted);
 
 		if (index >= 0)
-			memory = (void *)((uint32_t)sb_get_data(sb) + index * ((blksize + 1) << 3));
+			memory = (void *)((uintptr_t)sb_get_data(sb) + index * ((blksize + 1) << 3));
+
+		if (exhausted)
+			sb_mgr_settle(mgr, sb);
+	}
+
+	return memory;
+}/*}}}*/
 
-		if (sb->fblkcnt == 0) {
-			sb_list_remove(&mgr->nonempty[sb->blksize], sb);
-			sb_list_push(&mgr->full, sb);
+/**
+ * Allocate a block from nonempty superblocks. Manager must be locked for
+ * reading.
+ *
+ * @param self		equally-sized blocks' manager structure
+ * @param blksize	{i: i \in [0; 3] }
+ * @param exhausted	set to superblock whose last free block was taken
+ * @return			address of allocated block or NULL
+ */
+
+static void *eqsbmgr_alloc_shared(eqsbmgr_t *self, uint8_t blksize, sb_t **exhausted)/*{{{*/
+{
+	area_t *area = (area_t *)self->arealst.local.next;
+
+	while (!area_is_guard(area)) {
+		sb_mgr_t *mgr = sb_mgr_from_area(area);
+
+		sb_t *sb;
+
+		for (sb = mgr->nonempty[blksize].first; sb != NULL; sb = sb_get_next(sb)) {
+			bool last = FALSE;
+
+			int32_t index = sb_alloc(sb, &last);
+
+			if (index >= 0) {
+				if (last)
+					*exhausted = sb;
+
+				return (void *)((uintptr_t)sb_get_data(sb) + index * ((blksize + 1) << 3));
+			}
 		}
+
+		area = area->local.next;
 	}
 
+	return NULL;
+}/*}}}*/
+
+/**
+ * Allocate a block from equally-sized blocks' manager.
+ * Manager does not support alignment!
+ *
+ * @param self		equally-sized blocks' manager structure
+ * @param size		{i: i \in [1; 32] }
+ * @param alignment {i: i = 2^k, k \in [0, 3] }
+ * @return			address of allocated block
+ */
+
+void *eqsbmgr_alloc(eqsbmgr_t *self, uint32_t size, uint32_t alignment)/*{{{*/
+{
+	if (alignment) {
+		DEBUG("\033[37;1mRequested block of size %u aligned to %u bytes boundary.\033[0m\n", size, alignment);
+	} else {
+		DEBUG("\033[37;1mRequested block of size %u.\033[0m\n", size);
+	}
+
+	uint8_t blksize = eqsbmgr_class(size);
+
+	I(blksize < 4);
+
+	/* alignment is not supported due to much more complex implementation */
+	I(alignment <= MIN_ALIGNMENT);
+
+	sb_t *exhausted = NULL;
+
+	arealst_rdlock(&self->arealst);
+
+	void *memory = eqsbmgr_alloc_shared(self, blksize, &exhausted);
+
 	arealst_unlock(&self->arealst);
 
+	if ((memory == NULL) || (exhausted != NULL)) {
+		bool print_at_exit = FALSE;
+
+		arealst_wrlock(&self->arealst);
+
+		if (exhausted != NULL)
+			eqsbmgr_settle(self, exhausted, &print_at_exit);
+
+		if (memory == NULL)
+			memory = eqsbmgr_alloc_internal(self, blksize);
+
+		arealst_unlock(&self->arealst);
+
+		if (print_at_exit)
+			eqsbmgr_verify(self, TRUE);
+	}
+
 	return memory;
 }/*}}}*/
 
 /**
- * Return a block to equally-sized blocks' manager.
+ * Allocate a number of blocks of the same size. Manager's lock is taken for
+ * writing only when new superblocks are needed.
  *
  * @param self		equally-sized blocks' manager structure
- * @param memory	address of blocks to be freed
- * @return			TRUE if block was managed by this manager
+ * @param size		{i: i \in [1; 32] }
+ * @param blocks	array to be filled with addresses of allocated blocks
+ * @param count		number of requested blocks
+ * @return			number of allocated blocks
  */
 
-bool eqsbmgr_free(eqsbmgr_t *self, void *memory)/*{{{*/
+uint32_t eqsbmgr_alloc_batch(eqsbmgr_t *self, uint32_t size, void **blocks, uint32_t count)/*{{{*/
 {
-	bool print_at_exit = FALSE;
+	DEBUG("\033[37;1mRequested %u blocks of size %u.\033[0m\n", count, size);
 
-	DEBUG("\033[37;1mRequested to free block at $%.8x.\033[0m\n", (uint32_t)memory);
+	uint8_t blksize = eqsbmgr_class(size);
 
-	sb_mgr_t *mgr = NULL;
+	I(blksize < 4);
 
-	/* browse list of managed areas */
-	arealst_wrlock(&self->arealst);
+	uint32_t n = 0;
 
-	area_t *area = (area_t *)self->arealst.local.next;
+	sb_t *exhausted = NULL;
 
-	while (!area_is_guard(area)) {
-		if ((area_begining(area) <= memory) && (memory <= area_end(area))) {
-			mgr = sb_mgr_from_area(area);
+	arealst_rdlock(&self->arealst);
+
+	while (n < count) {
+		void *memory = eqsbmgr_alloc_shared(self, blksize, &exhausted);
+
+		if (memory == NULL)
 			break;
-		}
 
-		area = area->local.next;
+		blocks[n++] = memory;
 	}
 
-	/* SBs' manager found - free block */
-	if (mgr != NULL) {
-		sb_t *sb = sb_get_from_address(memory);
+	arealst_unlock(&self->arealst);
 
-		uint8_t i = (uint32_t)(memory - sb_get_data(sb)) / ((sb->blksize + 1) << 3);
+	/* exhausted superblocks other than the last one are settled lazily */
+	if ((n < count) || (exhausted != NULL)) {
+		bool print_at_exit = FALSE;
 
-		sb_free(sb, i);
+		arealst_wrlock(&self->arealst);
 
-		uint8_t blocks = sb_get_blocks(sb);
+		if (exhausted != NULL)
+			eqsbmgr_settle(self, exhausted, &print_at_exit);
 
-		if (blocks == sb->fblkcnt) {
-			sb_list_remove(&mgr->nonempty[sb->blksize], sb);
-			sb_mgr_free(mgr, sb);
-		}
+		while (n < count) {
+			void *memory = eqsbmgr_alloc_internal(self, blksize);
+
+			if (memory == NULL)
+				break;
 
-		if (sb->fblkcnt == 1) { 
-			sb_list_remove(&mgr->full, sb);
-			sb_list_push(&mgr->nonempty[sb->blksize], sb);
+			blocks[n++] = memory;
 		}
 
+		arealst_unlock(&self->arealst);
+
+		if (print_at_exit)
+			eqsbmgr_verify(self, TRUE);
+	}
+
+	return n;
+}/*}}}*/
+
+/**
+ * Return a block to equally-sized blocks' manager. Manager must be locked for
+ * reading.
+ *
+ * @param self		equally-sized blocks' manager structure
+ * @param memory	address of blocks to be freed
+ * @param settle	set to superblock that must be settled afterwards
+ * @return			TRUE if block was managed by this manager
+ */
+
+static bool eqsbmgr_free_shared(eqsbmgr_t *self, void *memory, sb_t **settle)/*{{{*/
+{
+	DEBUG("\033[37;1mRequested to free block at %p.\033[0m\n", (void *)memory);
+
+	/* find managed area that contains the block */
+	area_t *area = areamgr_find_area(self->areamgr, memory);
+
+	if ((area == NULL) || (area->manager != AREA_MGR_EQSBMGR) || (area->cpu != self->cpu))
+		return FALSE;
+
+	sb_t *sb = sb_get_from_address(memory);
+
+	uint8_t i = (uint32_t)(memory - sb_get_data(sb)) / ((sb->blksize + 1) << 3);
+
+	uint32_t left = sb_free(sb, i);
+
+	/* superblock stopped being full or became empty */
+	if ((left == 1) || (left == sb_get_blocks(sb)))
+		*settle = sb;
+
+	return TRUE;
+}/*}}}*/
+
+/**
+ * Move superblock to proper list after its blocks were taken or returned
+ * and give unused pages back to area manager. Manager must be locked for
+ * writing.
+ *
+ * @param self			equally-sized blocks' manager structure
+ * @param sb			superblock to be settled
+ * @param print_at_exit	set if manager's structures should be printed
+ */
+
+static void eqsbmgr_settle(eqsbmgr_t *self, sb_t *sb, bool *print_at_exit)/*{{{*/
+{
+	sb_mgr_t *mgr = NULL;
+
+	/* superblock could be settled by someone else and its area given back */
+	area_t *area = areamgr_find_area(self->areamgr, sb);
+
+	if ((area != NULL) && (area->manager == AREA_MGR_EQSBMGR) && (area->cpu == self->cpu))
+		mgr = sb_mgr_from_area(area);
+
+	if (mgr != NULL) {
+		uint32_t i;
+
+		sb_mgr_settle(mgr, sb);
+
 		if (mgr->all == mgr->free) {
 			arealst_remove_area(&self->arealst, area, DONTLOCK);
 			areamgr_free_area(self->areamgr, area);
@@ -879,7 +1127,7 @@ bool eqsbmgr_free(eqsbmgr_t *self, void *memory)/*{{{*/
 				if ((mgr->free > 4) && (mgr->groups[3].sbcnt > 0)) {
 					sb_t *to_free = (sb_t *)area_begining(area);
 
-					DEBUG("Try to remove from the begining of area. Check starting from superblock at $%.8x.\n", (uint32_t)to_free);
+					DEBUG("Try to remove from the begining of area. Check starting from superblock at %p.\n", (void *)to_free);
 
 					uint32_t pages = 0;
 
@@ -887,7 +1135,7 @@ bool eqsbmgr_free(eqsbmgr_t *self, void *memory)/*{{{*/
 						sb_list_remove(&mgr->groups[3], to_free);
 						pages++;
 
-						to_free = (sb_t *)((uint32_t)to_free + PAGE_SIZE);
+						to_free = (sb_t *)((uintptr_t)to_free + PAGE_SIZE);
 					}
 
 					if (pages > 0) {
@@ -901,14 +1149,14 @@ bool eqsbmgr_free(eqsbmgr_t *self, void *memory)/*{{{*/
 				}
 
 				if ((mgr->free > 4) && (mgr->groups[3].sbcnt > 0)) {
-					sb_t *to_free = (sb_t *)((uint32_t)area_end(area) - PAGE_SIZE);
+					sb_t *to_free = (sb_t *)((uintptr_t)area_end(area) - PAGE_SIZE);
 
-					DEBUG("Try to remove from the end of area. Check starting from superblock at $%.8x.\n", (uint32_t)to_free);
+					DEBUG("Try to remove from the end of area. Check starting from superblock at %p.\n", (void *)to_free);
 
 					uint32_t pages = 0;
 
 					while ((to_free->fblkcnt == 127) && (to_free->blksize == 3)) {
-						sb_t *prev = (sb_t *)((uint32_t)to_free - SB_SIZE);
+						sb_t *prev = (sb_t *)((uintptr_t)to_free - SB_SIZE);
 
 						if (prev->fblkcnt != 127)
 							break;
@@ -916,13 +1164,13 @@ bool eqsbmgr_free(eqsbmgr_t *self, void *memory)/*{{{*/
 						sb_list_remove(&mgr->groups[3], to_free);
 						pages++;
 
-						to_free = (sb_t *)((uint32_t)to_free - PAGE_SIZE);
+						to_free = (sb_t *)((uintptr_t)to_free - PAGE_SIZE);
 					}
 
 					if (pages > 0) {
 						DEBUG("Will remove %u superblocks from the end.\n", pages * 4);
 
-						sb_mgr_t *new_mgr    = (sb_mgr_t *)((uint32_t)to_free + PAGE_SIZE - (sizeof(area_t) + sizeof(sb_mgr_t)));
+						sb_mgr_t *new_mgr    = (sb_mgr_t *)((uintptr_t)to_free + PAGE_SIZE - sizeof(sb_mgr_t));
 						sb_t     *new_lastsb = sb_get_from_address(new_mgr);
 						sb_t     *lastsb	 = sb_get_from_address(mgr);
 
@@ -943,15 +1191,15 @@ bool eqsbmgr_free(eqsbmgr_t *self, void *memory)/*{{{*/
 					sb_t *to_split = sb_list_pop(&mgr->groups[3]);
 
 					if (to_split != NULL) {
-						sb_t *prev = (sb_t *)((uint32_t)to_split - SB_SIZE);
+						sb_t *prev = (sb_t *)((uintptr_t)to_split - SB_SIZE);
 
 						if (prev->fblkcnt == 127) {
 							area_t   *newarea = NULL;
 							sb_mgr_t *newmgr  = NULL;
 
-							fprintf(stderr, "prev: $%.8x to_split: $%.8x\n", (uint32_t)prev, (uint32_t)to_split);
+							fprintf(stderr, "prev: %p to_split: %p\n", (void *)prev, (void *)to_split);
 
-							arealst_split_area(&self->areamgr->global, &area, &newarea, SIZE_IN_PAGES((uint32_t)to_split - (uint32_t)area_begining(area)), LOCK);
+							arealst_split_area(&self->areamgr->global, &area, &newarea, SIZE_IN_PAGES((uintptr_t)to_split - (uintptr_t)area_begining(area)), LOCK);
 							areamgr_shrink_area(self->areamgr, &newarea, SIZE_IN_PAGES(newarea->size) - 1, LEFT);
 							arealst_insert_area_by_addr(&self->arealst, newarea, DONTLOCK);
 
@@ -964,7 +1212,7 @@ bool eqsbmgr_free(eqsbmgr_t *self, void *memory)/*{{{*/
 							newmgr->all  = newarea->size / SB_SIZE;
 							newmgr->free -= 4;
 
-							prev->size = ((SB_SIZE - sizeof(area_t) - sizeof(sb_mgr_t)) >> 3) - 1;
+							prev->size = ((SB_SIZE - sizeof(sb_mgr_t)) >> 3) - 1;
 
 							sb_t *sb, *tmp;
 
@@ -1011,7 +1259,7 @@ bool eqsbmgr_free(eqsbmgr_t *self, void *memory)/*{{{*/
 								}
 							}
 
-							print_at_exit = TRUE;
+							*print_at_exit = TRUE;
 						} else {
 							sb_list_push(&mgr->groups[3], to_split);
 						}
@@ -1020,13 +1268,98 @@ bool eqsbmgr_free(eqsbmgr_t *self, void *memory)/*{{{*/
 			}
 		}
 	}
+}/*}}}*/
+
+/**
+ * Return a block to equally-sized blocks' manager.
+ *
+ * @param self		equally-sized blocks' manager structure
+ * @param memory	address of blocks to be freed
+ * @return			TRUE if block was managed by this manager
+ */
+
+bool eqsbmgr_free(eqsbmgr_t *self, void *memory)/*{{{*/
+{
+	bool print_at_exit = FALSE;
+
+	sb_t *settle = NULL;
+
+	arealst_rdlock(&self->arealst);
+
+	bool res = eqsbmgr_free_shared(self, memory, &settle);
 
 	arealst_unlock(&self->arealst);
 
+	if (settle != NULL) {
+		arealst_wrlock(&self->arealst);
+		eqsbmgr_settle(self, settle, &print_at_exit);
+		arealst_unlock(&self->arealst);
+	}
+
 	if (print_at_exit)
 		eqsbmgr_verify(self, TRUE);
 
-	return (mgr != NULL);
+	return res;
+}/*}}}*/
+
+/**
+ * Return a number of blocks to equally-sized blocks' manager. Manager's lock
+ * is taken for writing only when a superblock has to be settled.
+ *
+ * @param self		equally-sized blocks' manager structure
+ * @param blocks	addresses of blocks to be freed
+ * @param count		number of blocks
+ * @return			number of blocks that were managed by this manager
+ */
+
+uint32_t eqsbmgr_free_batch(eqsbmgr_t *self, void **blocks, uint32_t count)/*{{{*/
+{
+	DEBUG("\033[37;1mRequested to free %u blocks.\033[0m\n", count);
+
+	bool print_at_exit = FALSE;
+
+	uint32_t i, n = 0;
+
+	arealst_rdlock(&self->arealst);
+
+	for (i = 0; i < count; i++) {
+		sb_t *settle = NULL;
+
+		if (eqsbmgr_free_shared(self, blocks[i], &settle))
+			n++;
+
+		if (settle != NULL) {
+			arealst_unlock(&self->arealst);
+
+			arealst_wrlock(&self->arealst);
+			eqsbmgr_settle(self, settle, &print_at_exit);
+			arealst_unlock(&self->arealst);
+
+			arealst_rdlock(&self->arealst);
+		}
+	}
+
+	arealst_unlock(&self->arealst);
+
+	if (print_at_exit)
+		eqsbmgr_verify(self, TRUE);
+
+	return n;
+}/*}}}*/
+
+/**
+ * Get size of a block allocated by equally-sized blocks' manager. As long as
+ * the block is in use its superblock does not change, so no locking is needed.
+ *
+ * @param memory	address of allocated block
+ * @return			size of the block in bytes
+ */
+
+uint32_t eqsbmgr_get_size(void *memory)/*{{{*/
+{
+	sb_t *sb = sb_get_from_address(memory);
+
+	return (sb->blksize + 1) << 3;
 }/*}}}*/
 
 /**
@@ -1036,36 +1369,30 @@ bool eqsbmgr_free(eqsbmgr_t *self, void *memory)/*{{{*/
 
 bool eqsbmgr_realloc(eqsbmgr_t *self, void *memory, uint32_t new_size)/*{{{*/
 {
-	DEBUG("\033[37;1mResizing block at $%.8x to %u bytes.\033[0m\n", (uint32_t)memory, new_size);
+	DEBUG("\033[37;1mResizing block at %p to %u bytes.\033[0m\n", (void *)memory, new_size);
 
 	I(new_size <= 32);
 
-	uint8_t  new_blksize = (new_size - 1) >> 3;
+	uint8_t  new_blksize = eqsbmgr_class(new_size);
 	sb_mgr_t *mgr = NULL;
 
-	/* browse list of managed areas */
+	/* find managed area that contains the block */
 	arealst_rdlock(&self->arealst);
 
-	area_t *area = (area_t *)self->arealst.local.next;
+	area_t *area = areamgr_find_area(self->areamgr, memory);
 
-	while (!area_is_guard(area)) {
-		if ((area_begining(area) <= memory) && (memory <= area_end(area))) {
-			mgr = sb_mgr_from_area(area);
-			break;
-		}
-
-		area = area->local.next;
-	}
+	if ((area != NULL) && (area->manager == AREA_MGR_EQSBMGR) && (area->cpu == self->cpu))
+		mgr = sb_mgr_from_area(area);
 
 	bool res = FALSE;
 		
 	if (mgr != NULL) {
-		/* check if there is need to resize block */
+		/* block can be resized in place if it stays large enough */
 		sb_t *sb = sb_get_from_address(memory);
 
-		res = (sb->blksize == new_blksize);
+		res = (new_blksize <= sb->blksize);
 	} else {
-		DEBUG("Block at $%.8x not found!\n", (uint32_t)memory);
+		DEBUG("Block at %p not found!\n", (void *)memory);
 		abort();
 	}
 
@@ -1082,25 +1409,26 @@ bool eqsbmgr_realloc(eqsbmgr_t *self, void *memory, uint32_t new_size)/*{{{*/
 
 bool eqsbmgr_verify(eqsbmgr_t *self, bool verbose)/*{{{*/
 {
-	arealst_rdlock(&self->arealst);
+	/* blocks are allocated and freed under read lock */
+	arealst_wrlock(&self->arealst);
 
 	area_t *area = (area_t *)&self->arealst;
 
 	if (verbose)
-		fprintf(stderr, "\033[1;36m eqsbmgr at $%.8x [%d areas]:\033[0m\n",
-				(uint32_t)self, self->arealst.areacnt);
+		fprintf(stderr, "\033[1;36m eqsbmgr at %p [%d areas]:\033[0m\n",
+				(void *)self, self->arealst.areacnt);
 
 	bool error = FALSE;
 	uint32_t areacnt = 0;
 
 	while (TRUE) {
-		area_valid(area);
+		area_check(area);
 
 		if (!area_is_guard(area)) {
 			if (verbose)
-				fprintf(stderr, "\033[1;31m  $%.8x - $%.8x : %8d : $%.8x : $%.8x\033[0m\n",
-						(uint32_t)area_begining(area), (uint32_t)area_end(area), area->size,
-						(uint32_t)area->local.prev, (uint32_t)area->local.next);
+				fprintf(stderr, "\033[1;31m  %p - %p : %8zu : %p : %p\033[0m\n",
+						(void *)area_begining(area), (void *)area_end(area), area->size,
+						(void *)area->local.prev, (void *)area->local.next);
 
 			sb_mgr_t *mgr = sb_mgr_from_area(area);
 
@@ -1109,14 +1437,14 @@ bool eqsbmgr_verify(eqsbmgr_t *self, bool verbose)/*{{{*/
 			I(area->manager == AREA_MGR_EQSBMGR);
 		} else {
 			if (verbose)
-				fprintf(stderr, "\033[1;33m  $%.8x %11s : %8s : $%.8x : $%.8x\033[0m\n",
-						(uint32_t)area, "", "guard", (uint32_t)area->local.prev, (uint32_t)area->local.next);
+				fprintf(stderr, "\033[1;33m  %p %11s : %8s : %p : %p\033[0m\n",
+						(void *)area, "", "guard", (void *)area->local.prev, (void *)area->local.next);
 		}
 
 		if (area_is_guard(area->local.next))
 			break;
 
-		if (!area_is_guard(area) && (area >= area->local.next))
+		if (!area_is_guard(area) && (area_begining(area) >= area_begining(area->local.next)))
 			error = TRUE;
 
 		area = area->local.next;
@@ -13,15 +13,39 @@ struct eqsbmgr
 	arealst_t arealst;
 
 	areamgr_t *areamgr;
+
+	/* index of this instance - stored in managed areas */
+	uint8_t cpu;
 };
 
 typedef struct eqsbmgr eqsbmgr_t;
 
+/**
+ * Class of blocks (0: 8B; 1: 16B; 2: 24B; 3: 32B) used for given size. On
+ * 64-bit architectures 8B and 24B blocks would break minimal alignment, so
+ * only 16B and 32B classes are used.
+ *
+ * @param size	{i: i \in [1; 32] }
+ * @return
+ */
+
+static inline uint8_t eqsbmgr_class(uint32_t size)/*{{{*/
+{
+#ifdef __LP64__
+	return ((size - 1) >> 3) | 1;
+#else
+	return (size - 1) >> 3;
+#endif
+}/*}}}*/
+
 /* function prototypes */
-void eqsbmgr_init(eqsbmgr_t *self, areamgr_t *areamgr);
+void eqsbmgr_init(eqsbmgr_t *self, areamgr_t *areamgr, uint8_t cpu);
 void *eqsbmgr_alloc(eqsbmgr_t *self, uint32_t size, uint32_t alignment);
+uint32_t eqsbmgr_alloc_batch(eqsbmgr_t *self, uint32_t size, void **blocks, uint32_t count);
 bool eqsbmgr_realloc(eqsbmgr_t *self, void *memory, uint32_t new_size);
 bool eqsbmgr_free(eqsbmgr_t *self, void *memory);
+uint32_t eqsbmgr_free_batch(eqsbmgr_t *self, void **blocks, uint32_t count);
+uint32_t eqsbmgr_get_size(void *memory);
 bool eqsbmgr_verify(eqsbmgr_t *self, bool verbose);
 
 #endif
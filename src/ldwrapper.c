@@ -6,13 +6,21 @@
 #undef VERBOSE
 #define VERBOSE 0
 
+#ifndef TRACES
+#define TRACES 1
+#endif
+
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
 #include <semaphore.h>
 #include <errno.h>
 
 #include "memmgr.h"
+#include "sysmem.h"
 #include "ldwrapper.h"
 
 void (*__free_hook) (void *PTR, const void *CALLER) = NULL;
@@ -26,6 +34,189 @@ static struct memmgr *mm;
 
 bool verbose = FALSE;
 
+#if TRACES == 1
+/* === Binary traces of calls ============================================== */
+
+/*
+ * When MALLOC_TRACE_LOG environment variable names a file, each call is
+ * recorded in the format understood by traces/traces-analyze.py. Every
+ * thread fills its own buffer, so no locks are taken, and appends it to the
+ * log file with a single write when the buffer becomes full or the thread
+ * exits. Pointers and sizes are truncated to 32 bits on 64-bit platforms.
+ */
+
+#define OP_FREE			0
+#define OP_MALLOC		1
+#define OP_REALLOC		2
+#define OP_MEMALIGN		3
+
+struct traces_log
+{
+	/* miliseconds till start of tracing */
+	uint32_t msec;
+
+	/* operation code & flags */
+	uint16_t opcode;
+
+	/* process/thread identificators */
+	uint16_t pid;
+	uint32_t thrid;
+
+	/* result */
+	uint32_t result;
+
+	/* arguments */
+	uint32_t args[2];
+};
+
+typedef struct traces_log traces_log_t;
+
+#define TRACES_BUFFER_PAGES	4
+#define TRACES_BUFFER_LINES	((TRACES_BUFFER_PAGES * PAGE_SIZE - 3 * sizeof(uint32_t)) / sizeof(traces_log_t))
+
+struct traces_buffer
+{
+	uint32_t pid;
+	uint32_t thrid;
+	uint32_t lines;
+
+	traces_log_t logs[TRACES_BUFFER_LINES];
+};
+
+typedef struct traces_buffer traces_buffer_t;
+
+/* log file descriptor - negative if tracing is disabled */
+static int32_t traces_fd = -1;
+static struct timespec traces_start;
+
+static __thread traces_buffer_t *traces __attribute__((tls_model("initial-exec")));
+
+/* used to write out the buffer when a thread exits */
+static pthread_key_t traces_key;
+
+/**
+ * Appends all records of the buffer to the log file.
+ *
+ * @param buffer
+ */
+
+static void traces_write_out(traces_buffer_t *buffer)/*{{{*/
+{
+	if (buffer->lines > 0) {
+		if (write(traces_fd, buffer->logs, buffer->lines * sizeof(traces_log_t)) == -1)
+			perror("traces: writing out failed");
+
+		buffer->lines = 0;
+	}
+}/*}}}*/
+
+/**
+ * Writes out and releases the buffer of an exiting thread.
+ *
+ * @param data
+ */
+
+static void traces_destroy(void *data)/*{{{*/
+{
+	traces_buffer_t *buffer = data;
+
+	if (buffer != NULL) {
+		traces_write_out(buffer);
+
+		if (buffer == traces)
+			traces = NULL;
+
+		pm_mmap_free(buffer, TRACES_BUFFER_PAGES);
+	}
+}/*}}}*/
+
+/**
+ * Writes out the buffer of main thread at process exit.
+ */
+
+static void __attribute__((destructor)) traces_exit()/*{{{*/
+{
+	if ((traces_fd >= 0) && (traces != NULL))
+		traces_write_out(traces);
+}/*}}}*/
+
+/**
+ * Opens the log file if tracing was requested.
+ */
+
+static void traces_init()/*{{{*/
+{
+	char *logname = getenv("MALLOC_TRACE_LOG");
+
+	if (logname == NULL)
+		return;
+
+	int32_t fd = open(logname, O_WRONLY|O_APPEND|O_CREAT, 0600);
+
+	if (fd == -1) {
+		perror("traces: cannot open log file");
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &traces_start);
+	pthread_key_create(&traces_key, traces_destroy);
+
+	traces_fd = fd;
+}/*}}}*/
+
+/**
+ * Records a call in the buffer of calling thread.
+ *
+ * @param opcode
+ * @param result
+ * @param arg0
+ * @param arg1
+ */
+
+static void traces_log(uint16_t opcode, uintptr_t result, uintptr_t arg0, uintptr_t arg1)/*{{{*/
+{
+	traces_buffer_t *buffer = traces;
+
+	if (buffer == NULL) {
+		buffer = pm_mmap_alloc(NULL, TRACES_BUFFER_PAGES);
+
+		if (buffer == NULL)
+			return;
+
+		buffer->pid   = getpid();
+		buffer->thrid = (uintptr_t)pthread_self();
+		buffer->lines = 0;
+
+		traces = buffer;
+
+		pthread_setspecific(traces_key, buffer);
+	}
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	traces_log_t *logline = &buffer->logs[buffer->lines++];
+
+	logline->msec    = (now.tv_sec - traces_start.tv_sec) * 1000 + (now.tv_nsec - traces_start.tv_nsec) / 1000000;
+	logline->opcode  = opcode;
+	logline->pid     = buffer->pid;
+	logline->thrid   = buffer->thrid;
+	logline->result  = result;
+	logline->args[0] = arg0;
+	logline->args[1] = arg1;
+
+	if (buffer->lines == TRACES_BUFFER_LINES)
+		traces_write_out(buffer);
+}/*}}}*/
+
+#define TRACE(opcode, result, arg0, arg1) \
+	if (__builtin_expect(traces_fd >= 0, 0)) \
+		traces_log((opcode), (uintptr_t)(result), (uintptr_t)(arg0), (uintptr_t)(arg1))
+#else
+#define TRACE(opcode, result, arg0, arg1)
+#endif
+
 static void ldwrapper_exit()
 {
 	/* sem_destroy(&ma_sem); */
@@ -39,7 +230,17 @@ static void ldwrapper_init() {
 
 		atexit(&ldwrapper_exit);
 
+#if TRACES == 1
+		traces_init();
+#endif
+
 		mm = memmgr_init();
+
+		/* optionally give back free pages in background */
+		char *period = getenv("MALLOC_SCAVENGE_MS");
+
+		if ((period != NULL) && (atoi(period) > 0))
+			memmgr_scavenger_start(mm, atoi(period));
 	}
 
 	while (__sync_and_and_fetch(&ma_initialized, TRUE) == FALSE) {
@@ -57,27 +258,33 @@ void *malloc(size_t size)
 
 	/* sem_post(&ma_sem); */
 
-	fprintf(stderr, "alloc(%u) = %p\n", size, area);
+	TRACE(OP_MALLOC, area, size, 0);
 
 	return area;
 }
 
 void *calloc(size_t nmemb, size_t size)
 {
-	void *area = malloc(size * nmemb);
+	ldwrapper_init();
+
+	/* don't call malloc here - compiler would fold it with memset into
+	 * a recursive call to calloc */
+	void *area = memmgr_alloc(mm, size * nmemb, 0);
 	
 	if (area != NULL) {
 		memset(area, 0, size * nmemb);
 	}
 
+	TRACE(OP_MALLOC, area, size * nmemb, 0);
+
 	return area;
 }
 
 void free(void *ptr)
 {
-	I(ma_initialized == TRUE);
-
 	if (ptr != NULL) {
+		I(ma_initialized == TRUE);
+
 		/* sem_wait(&ma_sem); */
 
 		memmgr_free(mm, ptr);
@@ -85,7 +292,7 @@ void free(void *ptr)
 		/* sem_post(&ma_sem); */
 	}
 
-	fprintf(stderr, "free(%p)\n", ptr);
+	TRACE(OP_FREE, 0, ptr, 0);
 }
 
 void cfree(void *ptr)
@@ -95,11 +302,11 @@ void cfree(void *ptr)
 
 void *realloc(void *ptr, size_t size)
 {
-	I(ma_initialized == TRUE);
-
 	if (ptr == NULL)
 		return malloc(size);
 
+	I(ma_initialized == TRUE);
+
 	if (size == 0) {
 		free(ptr);
 		
@@ -114,19 +321,130 @@ void *realloc(void *ptr, size_t size)
 
 	void *newptr = ptr;
 
-	if (!res) {
-		newptr = malloc(size);
+	/* large blocks are moved without copying */
+	if (!res)
+		newptr = memmgr_remap(mm, ptr, size);
 
-		memcpy(newptr, ptr, sizeof(size));
+	if (!res && (newptr == NULL)) {
+		size_t oldsize = memmgr_usable_size(mm, ptr);
 
-		free(ptr);
+		newptr = memmgr_alloc(mm, size, 0);
+
+		if (newptr != NULL) {
+			memcpy(newptr, ptr, (oldsize < size) ? oldsize : size);
+
+			memmgr_free(mm, ptr);
+		}
 	}
 
-	fprintf(stderr, "realloc(%p, %u) = %p\n", ptr, size, newptr);
+	TRACE(OP_REALLOC, newptr, ptr, size);
 
 	return newptr;
 }
 
+/**
+ * Allocates a number of blocks taking sizes from consecutive runs of equal
+ * values at once. Blocks can be freed independently. On failure all blocks
+ * that were already allocated are given back.
+ *
+ * @param n_elements
+ * @param sizes			sizes of blocks or NULL if all are equal
+ * @param elem_size		size of each block if <i>sizes</i> is NULL
+ * @param chunks		array to fill with addresses of blocks, if NULL it's
+ * 						allocated with malloc
+ * @return				the array or NULL
+ */
+
+static void **independent_alloc(size_t n_elements, size_t *sizes, size_t elem_size, void *chunks[])/*{{{*/
+{
+	ldwrapper_init();
+
+	void **array = chunks;
+
+	if ((array == NULL) && (n_elements > 0)) {
+		if ((array = memmgr_alloc(mm, n_elements * sizeof(void *), 0)) == NULL)
+			return NULL;
+
+		TRACE(OP_MALLOC, array, n_elements * sizeof(void *), 0);
+	}
+
+	size_t i = 0;
+
+	while (i < n_elements) {
+		size_t size = (sizes != NULL) ? sizes[i] : elem_size;
+		size_t j = i + 1;
+
+		if (sizes != NULL)
+			while ((j < n_elements) && (sizes[j] == size))
+				j++;
+		else
+			j = n_elements;
+
+		uint32_t count = (j - i > UINT32_MAX) ? UINT32_MAX : (j - i);
+		uint32_t got = memmgr_alloc_batch(mm, size, count, &array[i]);
+
+		if (got < count) {
+			memmgr_free_batch(mm, array, i + got);
+
+			if (chunks == NULL)
+				memmgr_free(mm, array);
+
+			return NULL;
+		}
+
+		for (; count > 0; count--, i++)
+			TRACE(OP_MALLOC, array[i], size, 0);
+	}
+
+	return array;
+}/*}}}*/
+
+void **independent_calloc(size_t n_elements, size_t elem_size, void *chunks[])
+{
+	void **array = independent_alloc(n_elements, NULL, elem_size, chunks);
+
+	if (array != NULL) {
+		size_t i;
+
+		for (i = 0; i < n_elements; i++)
+			memset(array[i], 0, elem_size);
+	}
+
+	return array;
+}
+
+void **independent_comalloc(size_t n_elements, size_t sizes[], void *chunks[])
+{
+	return independent_alloc(n_elements, sizes, 0, chunks);
+}
+
+size_t bulk_free(void *array[], size_t n_elements)
+{
+	size_t i, freed = 0, nulls = 0;
+
+	I((n_elements == 0) || (ma_initialized == TRUE));
+
+	for (i = 0; i < n_elements; i++) {
+		if (array[i] == NULL)
+			nulls++;
+
+		TRACE(OP_FREE, 0, array[i], 0);
+	}
+
+	/* NULL pointers are skipped by memmgr, as they belong to no area */
+	for (i = 0; i < n_elements; i += UINT32_MAX)
+		freed += memmgr_free_batch(mm, &array[i], (n_elements - i > UINT32_MAX) ? UINT32_MAX : (n_elements - i));
+
+	return n_elements - nulls - freed;
+}
+
+size_t malloc_usable_size(void *ptr)
+{
+	ldwrapper_init();
+
+	return (ptr != NULL) ? memmgr_usable_size(mm, ptr) : 0;
+}
+
 void *memalign(size_t boundary, size_t size)
 {
 	ldwrapper_init();
@@ -137,7 +455,7 @@ void *memalign(size_t boundary, size_t size)
 
 	/* sem_post(&ma_sem); */
 
-	fprintf(stderr, "memalign(%u, %u) = %p\n", boundary, size, area);
+	TRACE(OP_MEMALIGN, area, boundary, size);
 
 	return area;
 }
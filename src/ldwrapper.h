@@ -26,6 +26,10 @@ void *calloc(size_t nmemb, size_t size);
 void free(void *ptr);
 void cfree(void *ptr);
 void *realloc(void *ptr, size_t size);
+void **independent_calloc(size_t n_elements, size_t elem_size, void *chunks[]);
+void **independent_comalloc(size_t n_elements, size_t sizes[], void *chunks[]);
+size_t bulk_free(void *array[], size_t n_elements);
+size_t malloc_usable_size(void *ptr);
 void *memalign(size_t boundary, size_t size);
 void *valloc(size_t size);
 int posix_memalign(void **memptr, size_t alignment, size_t size);
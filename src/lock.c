@@ -0,0 +1,134 @@
+/*
+ * Author:	Krystian Bacławski <name.surname@gmail.com>
+ * Desc:	Lightweight lock - spinning first, then sleeping on futex
+ */
+
+#include "lock.h"
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static inline void cpu_relax()/*{{{*/
+{
+#if defined(__i386__) || defined(__x86_64__)
+	__asm__ __volatile__("pause" ::: "memory");
+#else
+	__asm__ __volatile__("" ::: "memory");
+#endif
+}/*}}}*/
+
+static inline void futex_wait(uint32_t *word, uint32_t value)/*{{{*/
+{
+	syscall(SYS_futex, word, FUTEX_WAIT, value, NULL, NULL, 0);
+}/*}}}*/
+
+static inline void futex_wake(uint32_t *word, uint32_t count)/*{{{*/
+{
+	syscall(SYS_futex, word, FUTEX_WAKE, count, NULL, NULL, 0);
+}/*}}}*/
+
+/**
+ * Try to take the lock once.
+ *
+ * @param lock
+ * @param shared	for reading or for writing
+ * @return
+ */
+
+static inline bool lock_try(lock_t *lock, bool shared)/*{{{*/
+{
+	uint32_t word = lock->word;
+
+	if (shared)
+		return !(word & (LOCK_WRITER | LOCK_PENDING)) &&
+			   __sync_bool_compare_and_swap(&lock->word, word, word + LOCK_READER);
+
+	/* writer taking the lock is no longer pending */
+	return !(word & (LOCK_WRITER | LOCK_READERS)) &&
+		   __sync_bool_compare_and_swap(&lock->word, word, (word & LOCK_WAITING) | LOCK_WRITER);
+}/*}}}*/
+
+/**
+ * Take the lock held by someone else in conflicting mode. Spin waiting for it
+ * to be released, and if it takes too long, announce there are waiters and
+ * go asleep. A writer also makes new readers wait until it gets the lock.
+ *
+ * @param lock
+ * @param shared	for reading or for writing
+ */
+
+void lock_acquire_contended(lock_t *lock, bool shared)/*{{{*/
+{
+#if LOCK_STATS
+	__sync_fetch_and_add(&lock->contended, 1);
+#endif
+
+	uint32_t spin  = lock->spin;
+	uint32_t limit = (2 * spin < LOCK_SPIN_MAX) ? 2 * spin : LOCK_SPIN_MAX;
+	uint32_t count;
+
+	for (count = 0; count < limit; count++) {
+		cpu_relax();
+
+		if (lock_try(lock, shared)) {
+			/* move estimate towards number of spins it actually took */
+			int32_t estimate = spin + ((int32_t)(count - spin) / 8);
+
+			if (estimate < LOCK_SPIN_MIN)
+				estimate = LOCK_SPIN_MIN;
+			if (estimate > LOCK_SPIN_MAX)
+				estimate = LOCK_SPIN_MAX;
+
+			lock->spin = estimate;
+			return;
+		}
+	}
+
+	/* spinning did not pay off - try less next time */
+	lock->spin = (spin - spin / 8 > LOCK_SPIN_MIN) ? spin - spin / 8 : LOCK_SPIN_MIN;
+
+	uint32_t conflict = shared ? (LOCK_WRITER | LOCK_PENDING) : (LOCK_WRITER | LOCK_READERS);
+	uint32_t announce = shared ? LOCK_WAITING : (LOCK_WAITING | LOCK_PENDING);
+
+	while (!lock_try(lock, shared)) {
+		uint32_t word = lock->word;
+
+		if (!(word & conflict))
+			continue;
+
+		/* mark the lock as contended, so the owner wakes us up on release */
+		uint32_t wait = word | announce;
+
+		if ((word == wait) || __sync_bool_compare_and_swap(&lock->word, word, wait)) {
+#if LOCK_STATS
+			__sync_fetch_and_add(&lock->slept, 1);
+#endif
+
+			futex_wait(&lock->word, wait);
+		}
+	}
+}/*}}}*/
+
+/**
+ * Wake up threads sleeping on the lock once it's released. The writer
+ * cleared the waiting bit already, the last reader has to clear it.
+ *
+ * @param lock
+ * @param word		value of lock word before it was released
+ */
+
+void lock_release_contended(lock_t *lock, uint32_t word)/*{{{*/
+{
+	if (!(word & LOCK_WRITER)) {
+		/* other readers still hold the lock */
+		if ((word & LOCK_READERS) != LOCK_READER)
+			return;
+
+		if (!(__sync_fetch_and_and(&lock->word, ~LOCK_WAITING) & LOCK_WAITING))
+			return;
+	}
+
+	/* both readers and writers may sleep, so all of them must check the lock */
+	futex_wake(&lock->word, INT32_MAX);
+}/*}}}*/
@@ -0,0 +1,96 @@
+#ifndef __LOCK_H
+#define __LOCK_H
+
+#include "common.h"
+
+/* === Lightweight lock ==================================================== */
+
+/*
+ * Lock can be held by a single writer or shared by many readers. Lock word
+ * holds number of readers, a bit for the writer, a bit telling that a writer
+ * waits (so new readers hold back and let it in), and a bit telling that
+ * some threads may sleep waiting for the lock. Taking a lock that is not held
+ * in a conflicting mode and releasing one nobody waits for is a single atomic
+ * operation. Otherwise the thread spins for a while, then sleeps on a futex.
+ * Number of spins adapts to how long the lock was held recently, so spinning
+ * stops when it does not pay off. Futex is not process-private, hence a lock
+ * can be placed in memory shared between processes.
+ */
+
+#define LOCK_WRITER		0x1
+#define LOCK_PENDING	0x2
+#define LOCK_WAITING	0x4
+#define LOCK_READER		0x8
+#define LOCK_READERS	(~(uint32_t)(LOCK_READER - 1))
+
+#define LOCK_SPIN_MIN	16
+#define LOCK_SPIN_MAX	1024
+
+/* count how often locks are contended */
+#ifndef LOCK_STATS
+#define LOCK_STATS		0
+#endif
+
+struct lock
+{
+	uint32_t word;
+
+	/* estimated number of spins after which the lock is released */
+	uint16_t spin;
+	uint16_t unused;
+
+#if LOCK_STATS
+	/* number of times the lock was found taken, and the thread went asleep */
+	uint32_t contended;
+	uint32_t slept;
+#endif
+};
+
+typedef struct lock lock_t;
+
+void lock_acquire_contended(lock_t *lock, bool shared);
+void lock_release_contended(lock_t *lock, uint32_t word);
+
+static inline void lock_init(lock_t *lock)
+{
+	lock->word	 = 0;
+	lock->spin	 = LOCK_SPIN_MIN;
+	lock->unused = 0;
+
+#if LOCK_STATS
+	lock->contended = 0;
+	lock->slept		= 0;
+#endif
+}
+
+/* Take the lock for writing */
+
+static inline void lock_acquire(lock_t *lock)
+{
+	if (!__sync_bool_compare_and_swap(&lock->word, 0, LOCK_WRITER))
+		lock_acquire_contended(lock, FALSE);
+}
+
+/* Take the lock for reading */
+
+static inline void lock_acquire_shared(lock_t *lock)
+{
+	uint32_t word = lock->word;
+
+	if ((word & (LOCK_WRITER | LOCK_PENDING)) || !__sync_bool_compare_and_swap(&lock->word, word, word + LOCK_READER))
+		lock_acquire_contended(lock, TRUE);
+}
+
+/* Release the lock taken in either mode */
+
+static inline void lock_release(lock_t *lock)
+{
+	uint32_t word = (lock->word & LOCK_WRITER)
+				  ? __sync_fetch_and_and(&lock->word, ~(LOCK_WRITER | LOCK_WAITING))
+				  : __sync_fetch_and_sub(&lock->word, LOCK_READER);
+
+	if (word & LOCK_WAITING)
+		lock_release_contended(lock, word);
+}
+
+#endif
@@ -1,9 +1,389 @@
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <unistd.h>
+#include <string.h>
+
 #include "blkmgr.h"
 #include "eqsbmgr.h"
 #include "mmapmgr.h"
 #include "memmgr.h"
+#include "tcache.h"
+
+/* thread-local cache of small blocks */
+static __thread tcache_t tcache __attribute__((tls_model("initial-exec")));
+
+/* used to flush the cache when a thread exits */
+static pthread_key_t  tcache_key;
+static pthread_once_t tcache_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Calculate number of sub-allocators' instances. Unless overriden with PROCNUM
+ * at compile time it equals number of online processors.
+ *
+ * @return
+ */
+
+static uint32_t memmgr_procnum()/*{{{*/
+{
+#ifdef PROCNUM
+	long procnum = PROCNUM;
+#else
+	long procnum = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	if (procnum < 1)
+		procnum = 1;
+
+	if (procnum > PROCNUM_MAX)
+		procnum = PROCNUM_MAX;
+
+	return procnum;
+}/*}}}*/
+
+/**
+ * Choose sub-allocators' instance for calling thread. Processor the thread is
+ * running on is preferred, if it cannot be determined then thread identifier
+ * is used.
+ *
+ * @param self
+ * @return
+ */
+
+static inline percpumgr_t *memmgr_percpumgr(memmgr_t *self)/*{{{*/
+{
+	if (self->procnum == 1)
+		return &self->percpumgr[0];
+
+	int cpu = sched_getcpu();
+
+	uint32_t n = (cpu >= 0) ? (uint32_t)cpu : (uint32_t)((uintptr_t)pthread_self() >> 12);
+
+	return &self->percpumgr[n % self->procnum];
+}/*}}}*/
+
+/**
+ * Find instance that owns given area.
+ *
+ * @param self
+ * @param area
+ * @return
+ */
+
+static inline percpumgr_t *memmgr_owner(memmgr_t *self, area_t *area)/*{{{*/
+{
+	return (area->cpu < self->procnum) ? &self->percpumgr[area->cpu] : NULL;
+}/*}}}*/
+
+/**
+ * Find area that given block belongs to, sub-allocator that manages it and
+ * instance that owns it. Page map is read without locking, so the area can
+ * be split meanwhile and its structure can start to describe other pages.
+ * Sub-allocator's type and owner are taken only if the area still covers the
+ * block afterwards. They do not change as long as the block is in use.
+ *
+ * @param self
+ * @param memory
+ * @param cpumgr	owner of the area or NULL if there is no such
+ * @param found		if not NULL, area covering the block is stored here
+ * @return			sub-allocator's type or -1 if the area does not exist
+ */
+
+static int8_t memmgr_find_area(memmgr_t *self, void *memory, percpumgr_t **cpumgr, area_t **found)/*{{{*/
+{
+	area_t *area;
+	int8_t  mgrtype;
+
+	do {
+		area = areamgr_find_area(&self->areamgr, memory);
 
-#define PROCNUM	1
+		if (area == NULL) {
+			*cpumgr = NULL;
+
+			if (found != NULL)
+				*found = NULL;
+
+			return -1;
+		}
+
+		*cpumgr = memmgr_owner(self, area);
+		mgrtype = (*cpumgr != NULL) ? area->manager : -1;
+
+		__sync_synchronize();
+	} while ((pagemap_get(memory) != area) || (memory < area_begining(area)) || (memory >= area_end(area)));
+
+	if (found != NULL)
+		*found = area;
+
+	return mgrtype;
+}/*}}}*/
+
+/**
+ * Find shared heap given block was allocated from.
+ *
+ * @param self
+ * @param memory
+ * @return			NULL if the block does not belong to any shared heap
+ */
+
+static shmmgr_t *memmgr_shm_find(memmgr_t *self, void *memory)/*{{{*/
+{
+	int i;
+
+	for (i = 0; i < MEMMGR_SHM_MAX; i++) {
+		shmmgr_t *shm = self->shm[i];
+
+		if ((shm != NULL) && shmmgr_contains(shm, memory))
+			return shm;
+	}
+
+	return NULL;
+}/*}}}*/
+
+/**
+ * Remember that the process is attached to shared heap, so blocks allocated
+ * there can be freed by memmgr_free.
+ *
+ * @param self
+ * @param shm
+ * @return			NULL if too many heaps are attached already
+ */
+
+static shmmgr_t *memmgr_shm_register(memmgr_t *self, shmmgr_t *shm)/*{{{*/
+{
+	int i;
+
+	if (shm == NULL)
+		return NULL;
+
+	for (i = 0; i < MEMMGR_SHM_MAX; i++)
+		if (__sync_bool_compare_and_swap(&self->shm[i], NULL, shm))
+			return shm;
+
+	DEBUG("Too many shared heaps attached.\n");
+
+	shmmgr_detach(shm);
+
+	return NULL;
+}/*}}}*/
+
+/**
+ * Give back free areas to the OS if there are too many of them.
+ *
+ * @param self
+ */
+
+static void memmgr_trim(memmgr_t *self)/*{{{*/
+{
+	areamgr_trim(&self->areamgr);
+}/*}}}*/
+
+/**
+ * Free blocks grouped by sub-allocator and instance that own them, so each of
+ * them is entered only once.
+ *
+ * @param self
+ * @param blocks
+ * @param count	{i: i \in [0; MEMMGR_BATCH] }
+ * @return		number of freed blocks
+ */
+
+static uint32_t memmgr_free_group(memmgr_t *self, void **blocks, uint32_t count)/*{{{*/
+{
+	void    *sorted[MEMMGR_BATCH];
+	uint16_t owner[MEMMGR_BATCH];
+	uint32_t i, j, k, n = 0, res = 0;
+
+	I(count <= MEMMGR_BATCH);
+
+	/* sort blocks by sub-allocator's type and instance */
+	for (k = 0; k < count; k++) {
+		percpumgr_t *cpumgr;
+
+		int8_t mgrtype = memmgr_find_area(self, blocks[k], &cpumgr, NULL);
+
+		if ((mgrtype < AREA_MGR_EQSBMGR) || (mgrtype > AREA_MGR_MMAPMGR)) {
+			DEBUG("Block at %p does not belong to any sub-allocator!\n", blocks[k]);
+			continue;
+		}
+
+		uint16_t key = (mgrtype << 8) | (cpumgr - self->percpumgr);
+
+		for (i = n; (i > 0) && (owner[i - 1] > key); i--) {
+			sorted[i] = sorted[i - 1];
+			owner[i]  = owner[i - 1];
+		}
+
+		sorted[i] = blocks[k];
+		owner[i]  = key;
+
+		n++;
+	}
+
+	for (i = 0; i < n; i = j) {
+		for (j = i + 1; (j < n) && (owner[j] == owner[i]); j++);
+
+		percpumgr_t *cpumgr = &self->percpumgr[owner[i] & 0xff];
+
+		switch (owner[i] >> 8)
+		{
+			case AREA_MGR_EQSBMGR:
+				res += eqsbmgr_free_batch(&cpumgr->eqsbmgr, &sorted[i], j - i);
+				break;
+
+			case AREA_MGR_BLKMGR:
+				if (cpumgr != memmgr_percpumgr(self)) {
+					for (k = i; k < j; k++)
+						res += blkmgr_free_remote(&cpumgr->blkmgr, sorted[k]);
+				} else {
+					res += blkmgr_free_batch(&cpumgr->blkmgr, &sorted[i], j - i);
+				}
+				break;
+
+			case AREA_MGR_MMAPMGR:
+				for (k = i; k < j; k++)
+					res += mmapmgr_free(&cpumgr->mmapmgr, sorted[k]);
+				break;
+		}
+	}
+
+	return res;
+}/*}}}*/
+
+/**
+ * Return some blocks from thread-local cache to their owners.
+ *
+ * @param self
+ * @param bin
+ * @param count	{i: i \in [1; TCACHE_SIZE] }
+ */
+
+static void memmgr_tcache_drain(memmgr_t *self, tcache_bin_t *bin, uint32_t count)/*{{{*/
+{
+	void    *blocks[TCACHE_SIZE];
+	uint32_t n = 0;
+
+	I(count <= TCACHE_SIZE);
+
+	while (n < count) {
+		void *memory = tcache_pop(bin);
+
+		if (memory == NULL)
+			break;
+
+		blocks[n++] = memory;
+	}
+
+	DEBUG("Draining %u blocks from thread-local cache.\n", n);
+
+	memmgr_free_batch(self, blocks, n);
+}/*}}}*/
+
+/**
+ * Return all blocks cached by exiting thread.
+ *
+ * @param data	thread-local cache
+ */
+
+static void memmgr_tcache_destroy(void *data)/*{{{*/
+{
+	tcache_t *cache = data;
+	uint32_t i;
+
+	for (i = 0; i < TCACHE_CLASSES; i++)
+		while (cache->bin[i].count > 0)
+			memmgr_tcache_drain(cache->owner, &cache->bin[i], TCACHE_BATCH);
+
+	cache->owner = NULL;
+}/*}}}*/
+
+static void memmgr_tcache_key_create()/*{{{*/
+{
+	pthread_key_create(&tcache_key, memmgr_tcache_destroy);
+}/*}}}*/
+
+/**
+ * Get thread-local cache bound to given memory manager. Cache is bound to the
+ * first manager that uses it.
+ *
+ * @param self
+ * @return		the cache or NULL if it is bound to other manager
+ */
+
+static inline tcache_t *memmgr_tcache(memmgr_t *self)/*{{{*/
+{
+	if (__builtin_expect(tcache.owner == self, TRUE))
+		return &tcache;
+
+	if (tcache.owner != NULL)
+		return NULL;
+
+	pthread_once(&tcache_once, memmgr_tcache_key_create);
+	pthread_setspecific(tcache_key, &tcache);
+
+	tcache.owner = self;
+
+	return &tcache;
+}/*}}}*/
+
+/**
+ * Allocate small block using thread-local cache. If the cache is empty then
+ * it's refilled with a batch of blocks from eqsbmgr.
+ *
+ * @param self
+ * @param size	{i: i \in [1; 32] }
+ * @return
+ */
+
+static void *memmgr_alloc_small(memmgr_t *self, uint32_t size)/*{{{*/
+{
+	tcache_t *cache = memmgr_tcache(self);
+
+	if (cache == NULL)
+		return eqsbmgr_alloc(&memmgr_percpumgr(self)->eqsbmgr, size, 0);
+
+	uint8_t blksize = eqsbmgr_class(size);
+
+	tcache_bin_t *bin = &cache->bin[blksize];
+
+	if (bin->count == 0) {
+		void    *blocks[TCACHE_BATCH];
+		uint32_t n;
+
+		n = eqsbmgr_alloc_batch(&memmgr_percpumgr(self)->eqsbmgr, (blksize + 1) << 3, blocks, TCACHE_BATCH);
+
+		while (n > 0)
+			tcache_push(bin, blocks[--n]);
+	}
+
+	return tcache_pop(bin);
+}/*}}}*/
+
+/**
+ * Free small block into thread-local cache. If the cache overflows then a batch
+ * of blocks is returned to their owners.
+ *
+ * @param self
+ * @param memory
+ * @return			TRUE if block was put into the cache
+ */
+
+static bool memmgr_free_small(memmgr_t *self, void *memory)/*{{{*/
+{
+	tcache_t *cache = memmgr_tcache(self);
+
+	if (cache == NULL)
+		return FALSE;
+
+	tcache_bin_t *bin = &cache->bin[(eqsbmgr_get_size(memory) >> 3) - 1];
+
+	tcache_push(bin, memory);
+
+	if (bin->count > TCACHE_SIZE)
+		memmgr_tcache_drain(self, bin, TCACHE_BATCH);
+
+	return TRUE;
+}/*}}}*/
 
 /**
  * Memory manager initialization.
@@ -11,18 +391,26 @@
 
 memmgr_t *memmgr_init()/*{{{*/
 {
-	uint32_t memmgr_size = sizeof(memmgr_t) + sizeof(percpumgr_t) * PROCNUM;
+	uint32_t procnum = memmgr_procnum();
+
+	size_t memmgr_size = sizeof(memmgr_t) + sizeof(percpumgr_t) * procnum;
 
 	memmgr_t *memmgr = (memmgr_t *)areamgr_init(area_new(PM_MMAP, SIZE_IN_PAGES(memmgr_size)));
 
+	memmgr->procnum = procnum;
+
+	memset(memmgr->shm, 0, sizeof(memmgr->shm));
+
 	int i;
 	
-	for (i = 0; i < PROCNUM; i++) {
-		mmapmgr_init(&memmgr->percpumgr[0].mmapmgr, &memmgr->areamgr);
-		blkmgr_init(&memmgr->percpumgr[0].blkmgr, &memmgr->areamgr);
-		eqsbmgr_init(&memmgr->percpumgr[0].eqsbmgr, &memmgr->areamgr);
+	for (i = 0; i < procnum; i++) {
+		mmapmgr_init(&memmgr->percpumgr[i].mmapmgr, &memmgr->areamgr, i);
+		blkmgr_init(&memmgr->percpumgr[i].blkmgr, &memmgr->areamgr, i);
+		eqsbmgr_init(&memmgr->percpumgr[i].eqsbmgr, &memmgr->areamgr, i);
 	}
 
+	DEBUG("Memory manager at %p with %u sub-allocators' instances.\n", (void *)memmgr, procnum);
+
 	return memmgr;
 }/*}}}*/
 
@@ -30,27 +418,27 @@ memmgr_t *memmgr_init()/*{{{*/
  * Allocate memory block.
  */
 
-void *memmgr_alloc(memmgr_t *memmgr, uint32_t size, uint32_t alignment)/*{{{*/
+void *memmgr_alloc(memmgr_t *memmgr, size_t size, uint32_t alignment)/*{{{*/
 {
 	if (alignment) {
-		DEBUG("\033[37;1mRequested block of size %u aligned to %u bytes boundary.\033[0m\n", size, alignment);
+		DEBUG("\033[37;1mRequested block of size %zu aligned to %u bytes boundary.\033[0m\n", size, alignment);
 	} else {
-		DEBUG("\033[37;1mRequested block of size %u.\033[0m\n", size);
+		DEBUG("\033[37;1mRequested block of size %zu.\033[0m\n", size);
 	}
 
 	void *memory;
 
 	if (size == 0)
 		memory = NULL;
-	else if ((size <= 32) && (alignment <= 8))
-		memory = eqsbmgr_alloc(&memmgr->percpumgr[0].eqsbmgr, size, 0);
+	else if ((size <= 32) && (alignment <= MIN_ALIGNMENT))
+		memory = memmgr_alloc_small(memmgr, size);
 	else if (size <= 32760)
-		memory = blkmgr_alloc(&memmgr->percpumgr[0].blkmgr, size, alignment);
+		memory = blkmgr_alloc(&memmgr_percpumgr(memmgr)->blkmgr, size, alignment);
 	else
-		memory = mmapmgr_alloc(&memmgr->percpumgr[0].mmapmgr, size, alignment);
+		memory = mmapmgr_alloc(&memmgr_percpumgr(memmgr)->mmapmgr, size, alignment);
 
 	if (memory) {
-		DEBUG("\033[37;1mBlock found at $%.8x.\033[0m\n", (uint32_t)memory);
+		DEBUG("\033[37;1mBlock found at %p.\033[0m\n", (void *)memory);
 	} else {
 		DEBUG("\033[37;1mBlock not found!.\033[0m\n");
 	}
@@ -59,28 +447,56 @@ void *memmgr_alloc(memmgr_t *memmgr, uint32_t size, uint32_t alignment)/*{{{*/
 }/*}}}*/
 
 /**
- * Reallocate memory block.
+ * Allocate a number of blocks of the same size. Sub-allocator is entered
+ * only once per each run of blocks it can provide.
+ *
+ * @param self
+ * @param size
+ * @param count		number of requested blocks
+ * @param blocks	array to be filled with addresses of allocated blocks
+ * @return			number of allocated blocks
  */
 
-bool memmgr_realloc(memmgr_t *self, void *memory, uint32_t new_size)/*{{{*/
+uint32_t memmgr_alloc_batch(memmgr_t *self, size_t size, uint32_t count, void **blocks)/*{{{*/
 {
-	int8_t mgrtype = 0;
+	DEBUG("\033[37;1mRequested %u blocks of size %zu.\033[0m\n", count, size);
+
+	percpumgr_t *cpumgr = memmgr_percpumgr(self);
 
-	/* find to which area the block belongs */
-	arealst_rdlock(&self->areamgr.global);
+	uint32_t n = 0, res;
 
-	area_t *area = (area_t *)self->areamgr.global.global.next;
+	if (size == 0)
+		return 0;
+
+	while (n < count) {
+		if (size <= 32)
+			res = eqsbmgr_alloc_batch(&cpumgr->eqsbmgr, size, &blocks[n], count - n);
+		else if (size <= 32760)
+			res = blkmgr_alloc_batch(&cpumgr->blkmgr, size, &blocks[n], count - n);
+		else
+			res = ((blocks[n] = mmapmgr_alloc(&cpumgr->mmapmgr, size, 0)) != NULL);
 
-	while (!area->global_guard) {
-		if ((area_begining(area) <= memory) && (memory < area_end(area)))
+		if (res == 0)
 			break;
 
-		area = area->global.next;
+		n += res;
 	}
 
-	mgrtype = (area != NULL) ? area->manager : -1;
+	DEBUG("\033[37;1mGot %u blocks.\033[0m\n", n);
 
-	arealst_unlock(&self->areamgr.global);
+	return n;
+}/*}}}*/
+
+/**
+ * Reallocate memory block.
+ */
+
+bool memmgr_realloc(memmgr_t *self, void *memory, size_t new_size)/*{{{*/
+{
+	/* find to which area the block belongs and the instance that owns it */
+	percpumgr_t *cpumgr;
+
+	int8_t mgrtype = memmgr_find_area(self, memory, &cpumgr, NULL);
 
 	/* redirect free request to proper manager */
 	bool res = FALSE;
@@ -89,19 +505,20 @@ bool memmgr_realloc(memmgr_t *self, void *memory, uint32_t new_size)/*{{{*/
 	{
 		case AREA_MGR_EQSBMGR:
 			if (new_size <= 32)
-				res = eqsbmgr_realloc(&self->percpumgr[0].eqsbmgr, memory, new_size);
+				res = eqsbmgr_realloc(&cpumgr->eqsbmgr, memory, new_size);
 			break;
 
 		case AREA_MGR_BLKMGR:
-			res = blkmgr_realloc(&self->percpumgr[0].blkmgr, memory, new_size);
+			if (new_size <= 32760)
+				res = blkmgr_realloc(&cpumgr->blkmgr, memory, new_size);
 			break;
 
 		case AREA_MGR_MMAPMGR:
-			res = mmapmgr_realloc(&self->percpumgr[0].mmapmgr, memory, new_size);
+			res = mmapmgr_realloc(&cpumgr->mmapmgr, memory, new_size);
 			break;
 
 		case AREA_MGR_UNMANAGED:
-			DEBUG("Area is not managed by any sub-allocator (id: %u)!\n", area->manager);
+			DEBUG("Area is not managed by any sub-allocator!\n");
 			break;
 
 		default:
@@ -113,30 +530,83 @@ bool memmgr_realloc(memmgr_t *self, void *memory, uint32_t new_size)/*{{{*/
 }/*}}}*/
 
 /**
- * Free memory block.
+ * Move large block to a place where it can be resized. Its contents are not
+ * copied - pages of the block are remapped.
+ *
+ * @return		new address of the block or NULL if it cannot be moved
  */
 
-bool memmgr_free(memmgr_t *self, void *memory)/*{{{*/
+void *memmgr_remap(memmgr_t *self, void *memory, size_t new_size)/*{{{*/
 {
-	DEBUG("\033[37;1mRequested to free block at $%.8x.\033[0m\n", (uint32_t)memory);
+	percpumgr_t *cpumgr;
 
-	int8_t mgrtype = 0;
+	if ((memmgr_find_area(self, memory, &cpumgr, NULL) != AREA_MGR_MMAPMGR) || (new_size <= 32760))
+		return NULL;
 
-	/* find to which area the block belongs */
-	arealst_rdlock(&self->areamgr.global);
+	return mmapmgr_remap(&cpumgr->mmapmgr, memory, new_size);
+}/*}}}*/
+
+/**
+ * Get number of bytes that can be used in allocated block.
+ *
+ * @return		size of the block or 0 if the block is not known
+ */
 
-	area_t *area = (area_t *)self->areamgr.global.global.next;
+size_t memmgr_usable_size(memmgr_t *self, void *memory)/*{{{*/
+{
+	percpumgr_t *cpumgr;
+	area_t		*area;
+
+	int8_t mgrtype = memmgr_find_area(self, memory, &cpumgr, &area);
 
-	while (!area->global_guard) {
-		if ((area_begining(area) <= memory) && (memory < area_end(area)))
+	size_t size = 0;
+
+	switch (mgrtype)
+	{
+		case AREA_MGR_EQSBMGR:
+			size = eqsbmgr_get_size(memory);
 			break;
 
-		area = area->global.next;
+		case AREA_MGR_BLKMGR:
+			size = blkmgr_get_size(memory);
+			break;
+
+		case AREA_MGR_MMAPMGR:
+			/* block spans from its address to the end of the area */
+			size = (uintptr_t)area_end(area) - (uintptr_t)memory;
+			break;
+
+		default:
+			{
+				shmmgr_t *shm = memmgr_shm_find(self, memory);
+
+				if (shm != NULL)
+					size = shmmgr_get_size(shm, memory);
+				else
+					DEBUG("Area does not exists ?!\n");
+			}
+			break;
 	}
 
-	mgrtype = (area != NULL) ? area->manager : -1;
+	return size;
+}/*}}}*/
+
+/**
+ * Free memory block.
+ */
+
+bool memmgr_free(memmgr_t *self, void *memory)/*{{{*/
+{
+	DEBUG("\033[37;1mRequested to free block at %p.\033[0m\n", (void *)memory);
 
-	arealst_unlock(&self->areamgr.global);
+	/* find to which area the block belongs and the instance that owns it */
+	percpumgr_t *cpumgr;
+
+	int8_t mgrtype = memmgr_find_area(self, memory, &cpumgr, NULL);
+
+	/* small blocks go to thread-local cache first */
+	if ((mgrtype == AREA_MGR_EQSBMGR) && memmgr_free_small(self, memory))
+		return TRUE;
 
 	/* redirect free request to proper manager */
 	bool res = FALSE;
@@ -144,66 +614,155 @@ bool memmgr_free(memmgr_t *self, void *memory)/*{{{*/
 	switch (mgrtype)
 	{
 		case AREA_MGR_EQSBMGR:
-			res = eqsbmgr_free(&self->percpumgr[0].eqsbmgr, memory);
+			res = eqsbmgr_free(&cpumgr->eqsbmgr, memory);
 			break;
 
 		case AREA_MGR_BLKMGR:
-			res = blkmgr_free(&self->percpumgr[0].blkmgr, memory);
+			/* do not contend for lock of other processor's instance */
+			if (cpumgr != memmgr_percpumgr(self))
+				res = blkmgr_free_remote(&cpumgr->blkmgr, memory);
+			else
+				res = blkmgr_free(&cpumgr->blkmgr, memory);
 			break;
 
 		case AREA_MGR_MMAPMGR:
-			res = mmapmgr_free(&self->percpumgr[0].mmapmgr, memory);
+			res = mmapmgr_free(&cpumgr->mmapmgr, memory);
 			break;
 
 		case AREA_MGR_UNMANAGED:
-			DEBUG("Area is not managed by any sub-allocator (id: %u)!\n", area->manager);
+			DEBUG("Area is not managed by any sub-allocator!\n");
 			break;
 
 		default:
+			{
+				shmmgr_t *shm = memmgr_shm_find(self, memory);
+
+				if (shm != NULL)
+					return shmmgr_free(shm, memory);
+			}
+
 			DEBUG("Area does not exists ?!\n");
 			break;
 	}
 
-	if (self->areamgr.freecnt > 64) {
-		int32_t n = AREAMGR_LIST_COUNT - 1;
+	memmgr_trim(self);
 
-		while ((n >= 0) && (self->areamgr.freecnt > 64)) {
-			arealst_t *arealst = &self->areamgr.list[n];
+	return res;
+}/*}}}*/
 
-			while (arealst->areacnt > 0) {
-				arealst_rdlock(&self->areamgr.global);
-				arealst_wrlock(arealst);
+/**
+ * Free a number of blocks. Blocks are grouped by their owners, so each
+ * sub-allocator is entered once per group.
+ *
+ * @param self
+ * @param blocks	addresses of blocks to be freed
+ * @param count		number of blocks
+ * @return			number of freed blocks
+ */
 
-				area_t *area = arealst->local.next;
+uint32_t memmgr_free_batch(memmgr_t *self, void **blocks, uint32_t count)/*{{{*/
+{
+	DEBUG("\033[37;1mRequested to free %u blocks.\033[0m\n", count);
 
-				if (!area_is_guard(area)) {
-					arealst_remove_area(arealst, area, DONTLOCK);
+	uint32_t i, res = 0;
 
-					area->used = TRUE;
-					area_touch(area);
+	for (i = 0; i < count; i += MEMMGR_BATCH)
+		res += memmgr_free_group(self, &blocks[i], (count - i < MEMMGR_BATCH) ? (count - i) : MEMMGR_BATCH);
 
-					self->areamgr.freecnt -= SIZE_IN_PAGES(area->size);
-				} else {
-					area = NULL;
-				}
+	memmgr_trim(self);
 
-				arealst_unlock(arealst);
-				arealst_unlock(&self->areamgr.global);
+	return res;
+}/*}}}*/
 
-				if (area != NULL) {
-					areamgr_remove_area(&self->areamgr, area);
+/**
+ * Create named shared heap and attach to it.
+ *
+ * @param self
+ * @param name		name of the heap (as for shm_open)
+ * @param size		initial size of the heap in bytes
+ * @param max_size	size the heap can grow to
+ * @return			NULL on failure
+ */
 
-					I(area_delete(area)); 
-				} else
-					break;
-			}
+shmmgr_t *memmgr_shm_create(memmgr_t *self, const char *name, size_t size, size_t max_size)/*{{{*/
+{
+	if (SIZE_IN_PAGES(max_size) > SHMMGR_PAGES_MAX)
+		return NULL;
 
+	return memmgr_shm_register(self, shmmgr_create(name, SIZE_IN_PAGES(size), SIZE_IN_PAGES(max_size)));
+}/*}}}*/
 
-			n--;
-		}
-	}
+/**
+ * Attach to shared heap created by another process.
+ *
+ * @param self
+ * @param name
+ * @return			NULL on failure
+ */
 
-	return res;
+shmmgr_t *memmgr_shm_attach(memmgr_t *self, const char *name)/*{{{*/
+{
+	return memmgr_shm_register(self, shmmgr_attach(name));
+}/*}}}*/
+
+/**
+ * Detach from shared heap. Blocks allocated there must not be used by the
+ * process afterwards.
+ *
+ * @param self
+ * @param shm
+ */
+
+void memmgr_shm_detach(memmgr_t *self, shmmgr_t *shm)/*{{{*/
+{
+	int i;
+
+	for (i = 0; i < MEMMGR_SHM_MAX; i++)
+		if (__sync_bool_compare_and_swap(&self->shm[i], shm, NULL))
+			shmmgr_detach(shm);
+}/*}}}*/
+
+/**
+ * Allocate block in shared heap. It can be freed by any process attached to
+ * the heap with memmgr_free.
+ *
+ * @param self
+ * @param shm
+ * @param size
+ * @param alignment
+ * @return
+ */
+
+void *memmgr_shm_alloc(memmgr_t *self, shmmgr_t *shm, size_t size, uint32_t alignment)/*{{{*/
+{
+	if ((size == 0) || (size > shm->max_pages * PAGE_SIZE))
+		return NULL;
+
+	return shmmgr_alloc(shm, size, alignment);
+}/*}}}*/
+
+/**
+ * Start giving back free pages to the OS in background.
+ *
+ * @param self
+ * @param period	maximal time between scavenger's passes (in miliseconds)
+ * @return			TRUE if scavenger is running
+ */
+
+bool memmgr_scavenger_start(memmgr_t *self, uint32_t period)/*{{{*/
+{
+	return areamgr_scavenger_start(&self->areamgr, period);
+}/*}}}*/
+
+/**
+ * Stop scavenger - free pages are given back to the OS synchronously again.
+ *
+ * @param self
+ */
+
+void memmgr_scavenger_stop(memmgr_t *self)/*{{{*/
+{
+	areamgr_scavenger_stop(&self->areamgr);
 }/*}}}*/
 
 /**
@@ -214,15 +773,34 @@ void memmgr_verify(memmgr_t *memmgr, bool verbose)/*{{{*/
 {
 	bool error = FALSE;
 
-	arealst_rdlock(&memmgr->areamgr.global);
+	/* areas are taken out of free lists under read lock */
+	arealst_wrlock(&memmgr->areamgr.global);
 
 	if (verbose) {
 		fprintf(stderr, "\033[1;37mPrinting memory manager structures:\033[0m\n");
 
-		fprintf(stderr, "\033[1;35m areamgr at $%.8x [%d areas, %d / %d pages (%dkB / %dkB bytes) free]:\033[0m\n",
-				(uint32_t)&memmgr->areamgr, memmgr->areamgr.global.areacnt,
+		fprintf(stderr, "\033[1;35m areamgr at %p [%d areas, %d / %d pages (%zukB / %zukB bytes) free]:\033[0m\n",
+				(void *)&memmgr->areamgr, memmgr->areamgr.global.areacnt,
 				memmgr->areamgr.freecnt, memmgr->areamgr.pagecnt,
 				memmgr->areamgr.freecnt * PAGE_SIZE / 1024, memmgr->areamgr.pagecnt * PAGE_SIZE / 1024);
+
+		fprintf(stderr, "\033[0;35m   keep: %u, unmapped: %u, purged: %u pages, scavenger: %s\033[0m\n",
+				memmgr->areamgr.keep, memmgr->areamgr.unmapcnt, memmgr->areamgr.purgecnt,
+				memmgr->areamgr.scavenging ? "running" : "stopped");
+
+#if LOCK_STATS
+		uint32_t contended = 0, slept = 0;
+		int j;
+
+		for (j = 0; j < AREAMGR_LIST_COUNT; j++) {
+			contended += memmgr->areamgr.list[j].lock.contended;
+			slept	  += memmgr->areamgr.list[j].lock.slept;
+		}
+
+		fprintf(stderr, "\033[0;35m   contended / slept: global %u / %u, lists %u / %u, tree %u / %u\033[0m\n",
+				memmgr->areamgr.global.lock.contended, memmgr->areamgr.global.lock.slept, contended, slept,
+				memmgr->areamgr.tree.lock.contended, memmgr->areamgr.tree.lock.slept);
+#endif
 	}
 
 	area_t *area = (area_t *)&memmgr->areamgr.global;
@@ -232,26 +810,29 @@ void memmgr_verify(memmgr_t *memmgr, bool verbose)/*{{{*/
 	uint32_t pagecnt = 0;
 
 	while (TRUE) {
-		area_valid(area);
+		area_check(area);
 
 		if (!area->guard) {
 			if (verbose)
-				fprintf(stderr, "\033[1;3%cm  $%.8x - $%.8x : %8d : %d\033[0m\n", area->used ? '1' : '2',
-						(uint32_t)area_begining(area), (uint32_t)area_end(area), area->size, area->manager);
+				fprintf(stderr, "\033[1;3%cm  %p - %p : %8zu : %d : %d\033[0m\n", area->used ? '1' : '2',
+						(void *)area_begining(area), (void *)area_end(area), area->size, area->manager, area->cpu);
 
 			if (!area->used)
 				freecnt += SIZE_IN_PAGES(area->size);
 
 			pagecnt += SIZE_IN_PAGES(area->size);
+
+			/* area must be reachable thru index */
+			error |= (arealst_global_find_area(&memmgr->areamgr.global, area_begining(area), DONTLOCK) != area);
 		} else {
 			if (verbose)
-				fprintf(stderr, "\033[1;33m  $%.8x %11s : %8s\033[0m\n", (uint32_t)area, "", "guard");
+				fprintf(stderr, "\033[1;33m  %p %11s : %8s\033[0m\n", (void *)area, "", "guard");
 		}
 
 		if (area->global.next->global_guard)
 			break;
 
-		error |= (!area->global_guard && (area >= area->global.next));
+		error |= (!area->global_guard && (area_begining(area) >= area_begining(area->global.next)));
 
 		area = area->global.next;
 
@@ -267,9 +848,17 @@ void memmgr_verify(memmgr_t *memmgr, bool verbose)/*{{{*/
 	if (error && verbose)
 		fprintf(stderr, "\033[7m  Invalid!\033[0m\n");
 
-	error |= mmapmgr_verify(&memmgr->percpumgr[0].mmapmgr, verbose);
-	error |= blkmgr_verify(&memmgr->percpumgr[0].blkmgr, verbose);
-	error |= eqsbmgr_verify(&memmgr->percpumgr[0].eqsbmgr, verbose);
+	int i;
+
+	for (i = 0; i < memmgr->procnum; i++) {
+		error |= mmapmgr_verify(&memmgr->percpumgr[i].mmapmgr, verbose);
+		error |= blkmgr_verify(&memmgr->percpumgr[i].blkmgr, verbose);
+		error |= eqsbmgr_verify(&memmgr->percpumgr[i].eqsbmgr, verbose);
+	}
+
+	for (i = 0; i < MEMMGR_SHM_MAX; i++)
+		if (memmgr->shm[i] != NULL)
+			error |= shmmgr_verify(memmgr->shm[i], verbose);
 
 	if (error)
 		PANIC("Verification failed!");
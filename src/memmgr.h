@@ -6,6 +6,19 @@
 #include "eqsbmgr.h"
 #include "blkmgr.h"
 #include "mmapmgr.h"
+#include "shmmgr.h"
+
+/* Maximum number of sub-allocators' instances (area_t::cpu is 8-bit wide) */
+
+#define PROCNUM_MAX	256
+
+/* Maximum number of blocks sorted by owner at once while freeing a batch */
+
+#define MEMMGR_BATCH	64
+
+/* Maximum number of shared heaps a process can be attached to at once */
+
+#define MEMMGR_SHM_MAX	8
 
 /* */
 
@@ -13,7 +26,7 @@ struct percpumgr {
 	eqsbmgr_t  eqsbmgr;
 	blkmgr_t  blkmgr;
 	mmapmgr_t mmapmgr;
-};
+} __attribute__((aligned(L2_LINE_SIZE)));
 
 typedef struct percpumgr percpumgr_t;
 
@@ -22,6 +35,12 @@ typedef struct percpumgr percpumgr_t;
 struct memmgr {
 	areamgr_t areamgr;
 
+	/* number of sub-allocators' instances */
+	uint32_t procnum;
+
+	/* shared heaps this process is attached to */
+	shmmgr_t *shm[MEMMGR_SHM_MAX];
+
 	percpumgr_t percpumgr[0];
 };
 
@@ -29,9 +48,19 @@ typedef struct memmgr memmgr_t;
 
 /* function prototypes */
 memmgr_t *memmgr_init();
-void *memmgr_alloc(memmgr_t *memmgr, uint32_t size, uint32_t alignment);
-bool memmgr_realloc(memmgr_t *memmgr, void *memory, uint32_t new_size);
+void *memmgr_alloc(memmgr_t *memmgr, size_t size, uint32_t alignment);
+uint32_t memmgr_alloc_batch(memmgr_t *memmgr, size_t size, uint32_t count, void **blocks);
+bool memmgr_realloc(memmgr_t *memmgr, void *memory, size_t new_size);
+void *memmgr_remap(memmgr_t *memmgr, void *memory, size_t new_size);
+size_t memmgr_usable_size(memmgr_t *memmgr, void *memory);
 bool memmgr_free(memmgr_t *memmgr, void *memory);
+uint32_t memmgr_free_batch(memmgr_t *memmgr, void **blocks, uint32_t count);
+bool memmgr_scavenger_start(memmgr_t *memmgr, uint32_t period);
+void memmgr_scavenger_stop(memmgr_t *memmgr);
+shmmgr_t *memmgr_shm_create(memmgr_t *memmgr, const char *name, size_t size, size_t max_size);
+shmmgr_t *memmgr_shm_attach(memmgr_t *memmgr, const char *name);
+void memmgr_shm_detach(memmgr_t *memmgr, shmmgr_t *shm);
+void *memmgr_shm_alloc(memmgr_t *memmgr, shmmgr_t *shm, size_t size, uint32_t alignment);
 void memmgr_verify(memmgr_t *memmgr, bool verbose);
 
 #endif
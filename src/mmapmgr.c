@@ -11,13 +11,15 @@
  *
  * @param mmapmgr
  * @param areamgr
+ * @param cpu
  */
 
-void mmapmgr_init(mmapmgr_t *mmapmgr, areamgr_t *areamgr)/*{{{*/
+void mmapmgr_init(mmapmgr_t *mmapmgr, areamgr_t *areamgr, uint8_t cpu)/*{{{*/
 {
 	arealst_init(&mmapmgr->blklst);
 
 	mmapmgr->areamgr = areamgr;
+	mmapmgr->cpu     = cpu;
 }/*}}}*/
 
 /**
@@ -28,29 +30,50 @@ void mmapmgr_init(mmapmgr_t *mmapmgr, areamgr_t *areamgr)/*{{{*/
  * @return
  */
 
-void *mmapmgr_alloc(mmapmgr_t *mmapmgr, uint32_t size, uint32_t alignment)/*{{{*/
+void *mmapmgr_alloc(mmapmgr_t *mmapmgr, size_t size, uint32_t alignment)/*{{{*/
 {
-	DEBUG("Requested to allocate block of size %u with alignment $%x\n", size, alignment);
-
-	size += sizeof(area_t);
+	DEBUG("Requested to allocate block of size %zu with alignment $%x\n", size, alignment);
 
 	if (alignment <= PAGE_SIZE)
 		alignment = 0;
 
-	area_t *area = areamgr_alloc_area(mmapmgr->areamgr, SIZE_IN_PAGES(size) + SIZE_IN_PAGES(alignment));
+	area_t *area = NULL;
+
+#if HUGE_PAGES
+	/* large block begins at huge page boundary, so it can be backed by huge
+	 * pages from the start */
+	if ((size >= HUGE_PAGE_SIZE) && (alignment < HUGE_PAGE_SIZE)) {
+		alignment = HUGE_PAGE_SIZE;
+
+		/* area of exact size is often aligned already, so padding the
+		 * request is left for when it is not */
+		area = areamgr_alloc_area(mmapmgr->areamgr, SIZE_IN_PAGES(size));
+
+		if ((area != NULL) && ((uintptr_t)area_begining(area) & (HUGE_PAGE_SIZE - 1))) {
+			DEBUG("Block at %p is not aligned to huge page, will retry\n", (void *)area_begining(area));
+
+			areamgr_free_area(mmapmgr->areamgr, area);
+
+			area = NULL;
+		}
+	}
+#endif
+
+	if (area == NULL)
+		area = areamgr_alloc_area(mmapmgr->areamgr, SIZE_IN_PAGES(size) + SIZE_IN_PAGES(alignment));
 
 	if (area != NULL) {
-		DEBUG("Found block at $%.8x\n", (uint32_t)area_begining(area));
+		DEBUG("Found block at %p\n", (void *)area_begining(area));
 
 		if (alignment > 0) {
 			area_t *leftover = NULL;
 
-			uint32_t excess = ((uint32_t)area_begining(area) & (alignment - 1));
+			uintptr_t excess = ((uintptr_t)area_begining(area) & (alignment - 1));
 
 			if (excess > 0) {
 				excess = alignment - excess;
 
-				DEBUG("Will cut %u pages from front\n", SIZE_IN_PAGES(excess));
+				DEBUG("Will cut %zu pages from front\n", SIZE_IN_PAGES(excess));
 
 				arealst_split_area(&mmapmgr->areamgr->global, &area, &leftover, SIZE_IN_PAGES(excess), LOCK);
 
@@ -59,10 +82,10 @@ void *mmapmgr_alloc(mmapmgr_t *mmapmgr, uint32_t size, uint32_t alignment)/*{{{*
 				area = leftover;
 			}
 
-			I(((uint32_t)area_begining(area) & (alignment-1)) == 0);
+			I(((uintptr_t)area_begining(area) & (alignment-1)) == 0);
 
 			if (SIZE_IN_PAGES(area->size) > SIZE_IN_PAGES(size)) {
-				DEBUG("Will cut %u pages from back\n", area->size - SIZE_IN_PAGES(size));
+				DEBUG("Will cut %zu pages from back\n", area->size - SIZE_IN_PAGES(size));
 
 				arealst_split_area(&mmapmgr->areamgr->global, &area, &leftover, SIZE_IN_PAGES(size), LOCK);
 
@@ -72,16 +95,15 @@ void *mmapmgr_alloc(mmapmgr_t *mmapmgr, uint32_t size, uint32_t alignment)/*{{{*
 			I(SIZE_IN_PAGES(area->size) == SIZE_IN_PAGES(size));
 		}
 
-		arealst_wrlock(&mmapmgr->blklst);
+		areamgr_assign_area(mmapmgr->areamgr, area, AREA_MGR_MMAPMGR, mmapmgr->cpu, FALSE);
 
-		area->manager = AREA_MGR_MMAPMGR;
-		area_touch(area);
+		arealst_wrlock(&mmapmgr->blklst);
 
 		arealst_insert_area_by_addr(&mmapmgr->blklst, (void *)area, DONTLOCK);
 
 		arealst_unlock(&mmapmgr->blklst);
 
-		DEBUG("Will use block [$%.8x; %u; $%.2x]\n", (uint32_t)area_begining(area), area->size, area->flags0);
+		DEBUG("Will use block [%p; %zu; $%.2x]\n", (void *)area_begining(area), area->size, area->flags0);
 	}
 
 	return area ? area_begining(area) : NULL;
@@ -95,18 +117,21 @@ void *mmapmgr_alloc(mmapmgr_t *mmapmgr, uint32_t size, uint32_t alignment)/*{{{*
  * @return
  */
 
-bool mmapmgr_realloc(mmapmgr_t *mmapmgr, void *memory, uint32_t size)/*{{{*/
+bool mmapmgr_realloc(mmapmgr_t *mmapmgr, void *memory, size_t size)/*{{{*/
 {
-	DEBUG("Requested to resize block at $%.8x to size %u\n", (uint32_t)memory, size);
+	DEBUG("Requested to resize block at %p to size %zu\n", (void *)memory, size);
 
 	arealst_wrlock(&mmapmgr->blklst);
 
-	area_t *area = arealst_find_area_by_addr(&mmapmgr->blklst, memory, DONTLOCK);
+	area_t *area = areamgr_find_area(mmapmgr->areamgr, memory);
+
+	if ((area != NULL) && ((area->manager != AREA_MGR_MMAPMGR) || (area->cpu != mmapmgr->cpu)))
+		area = NULL;
 
 	bool res = FALSE;
 
 	if (area != NULL) {
-		uint32_t newsize = SIZE_IN_PAGES(size + sizeof(area_t));
+		uint32_t newsize = SIZE_IN_PAGES(size);
 		uint32_t oldsize = SIZE_IN_PAGES(area->size);
 
 		if (newsize == oldsize) {
@@ -126,11 +151,18 @@ bool mmapmgr_realloc(mmapmgr_t *mmapmgr, void *memory, uint32_t size)/*{{{*/
 					area_touch(area);
 
 					res = TRUE;
+				} else if (area_is_mmap(area)) {
+					/* no free area on the right - try to extend the mapping */
+					arealst_remove_area(&mmapmgr->blklst, area, DONTLOCK);
+
+					res = areamgr_remap_area(mmapmgr->areamgr, &area, newsize, FALSE);
+
+					arealst_insert_area_by_addr(&mmapmgr->blklst, (void *)area, DONTLOCK);
 				}
 			}
 
 			if (res) {
-				DEBUG("Resized block [$%.8x; %u; $%.2x]\n", (uint32_t)area_begining(area), area->size, area->flags0);
+				DEBUG("Resized block [%p; %zu; $%.2x]\n", (void *)area_begining(area), area->size, area->flags0);
 			} else {
 				DEBUG("Cannot resize!\n");
 			}
@@ -142,6 +174,46 @@ bool mmapmgr_realloc(mmapmgr_t *mmapmgr, void *memory, uint32_t size)/*{{{*/
 	return res;
 }/*}}}*/
 
+/**
+ * Moves the block to a place where it can have new size. Pages of the block
+ * are remapped, so its contents are not copied.
+ *
+ * @param mmapmgr
+ * @param memory
+ * @param size
+ * @return			new address of the block or NULL if it cannot be remapped
+ */
+
+void *mmapmgr_remap(mmapmgr_t *mmapmgr, void *memory, size_t size)/*{{{*/
+{
+	DEBUG("Requested to remap block at %p to size %zu\n", (void *)memory, size);
+
+	arealst_wrlock(&mmapmgr->blklst);
+
+	area_t *area = areamgr_find_area(mmapmgr->areamgr, memory);
+
+	if ((area != NULL) && ((area->manager != AREA_MGR_MMAPMGR) || (area->cpu != mmapmgr->cpu)))
+		area = NULL;
+
+	void *newmemory = NULL;
+
+	if ((area != NULL) && area_is_mmap(area)) {
+		arealst_remove_area(&mmapmgr->blklst, area, DONTLOCK);
+
+		if (areamgr_remap_area(mmapmgr->areamgr, &area, SIZE_IN_PAGES(size), TRUE))
+			newmemory = area_begining(area);
+
+		arealst_insert_area_by_addr(&mmapmgr->blklst, (void *)area, DONTLOCK);
+
+		DEBUG("Block at %p %sremapped to [%p; %zu; $%.2x]\n", (void *)memory, newmemory ? "" : "not ",
+			  (void *)area_begining(area), area->size, area->flags0);
+	}
+
+	arealst_unlock(&mmapmgr->blklst);
+
+	return newmemory;
+}/*}}}*/
+
 /**
  *
  * @param mmapmgr
@@ -151,11 +223,14 @@ bool mmapmgr_realloc(mmapmgr_t *mmapmgr, void *memory, uint32_t size)/*{{{*/
 
 bool mmapmgr_free(mmapmgr_t *mmapmgr, void *memory)/*{{{*/
 {
-	DEBUG("Requested to free block at $%.8x\n", (uint32_t)memory);
+	DEBUG("Requested to free block at %p\n", (void *)memory);
 
 	arealst_wrlock(&mmapmgr->blklst);
 
-	area_t *area = arealst_find_area_by_addr(&mmapmgr->blklst, memory, DONTLOCK);
+	area_t *area = areamgr_find_area(mmapmgr->areamgr, memory);
+
+	if ((area != NULL) && ((area->manager != AREA_MGR_MMAPMGR) || (area->cpu != mmapmgr->cpu)))
+		area = NULL;
 
 	if (area != NULL) {
 		arealst_remove_area(&mmapmgr->blklst, area, DONTLOCK);
@@ -164,7 +239,7 @@ bool mmapmgr_free(mmapmgr_t *mmapmgr, void *memory)/*{{{*/
 
 	arealst_unlock(&mmapmgr->blklst);
 
-	DEBUG("Area at $%.8x %sfreed!\n", (uint32_t)memory, (area) ? "" : "not ");
+	DEBUG("Area at %p %sfreed!\n", (void *)memory, (area) ? "" : "not ");
 
 	return (area) ? TRUE : FALSE;
 }/*}}}*/
@@ -181,31 +256,31 @@ bool mmapmgr_verify(mmapmgr_t *mmapmgr, bool verbose)/*{{{*/
 	arealst_rdlock(&mmapmgr->blklst);
 
 	if (verbose)
-		fprintf(stderr, "\033[1;36m mmapmgr at $%.8x [%d areas]:\033[0m\n",
-				(uint32_t)mmapmgr, mmapmgr->blklst.areacnt);
+		fprintf(stderr, "\033[1;36m mmapmgr at %p [%d areas]:\033[0m\n",
+				(void *)mmapmgr, mmapmgr->blklst.areacnt);
 
 	area_t *blk = (area_t *)&mmapmgr->blklst;
 
 	uint32_t blkcnt = 0;
 
 	while (TRUE) {
-		area_valid(blk);
+		area_check(blk);
 
 		if (verbose) {
 			if (!area_is_guard(blk))
-				fprintf(stderr, "\033[1;3%dm  $%.8x - $%.8x: %8d : $%.8x : $%.8x\033[0m\n",
+				fprintf(stderr, "\033[1;3%dm  %p - %p: %8zu : %p : %p\033[0m\n",
 						(blk->manager == AREA_MGR_MMAPMGR),
-						(uint32_t)area_begining(blk), (uint32_t)area_end(blk), blk->size,
-						(uint32_t)blk->local.prev, (uint32_t)blk->local.next);
+						(void *)area_begining(blk), (void *)area_end(blk), blk->size,
+						(void *)blk->local.prev, (void *)blk->local.next);
 			else
-				fprintf(stderr, "\033[1;33m  $%.8x %11s: %8s : $%.8x : $%.8x\033[0m\n",
-						(uint32_t)blk, "", "guard", (uint32_t)blk->local.prev, (uint32_t)blk->local.next);
+				fprintf(stderr, "\033[1;33m  %p %11s: %8s : %p : %p\033[0m\n",
+						(void *)blk, "", "guard", (void *)blk->local.prev, (void *)blk->local.next);
 		}
 
 		if (area_is_guard(blk->local.next))
 			break;
 
-		error |= (!area_is_guard(blk) && (blk >= blk->local.next));
+		error |= (!area_is_guard(blk) && (area_begining(blk) >= area_begining(blk->local.next)));
 
 		blk = blk->local.next;
 
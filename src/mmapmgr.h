@@ -11,15 +11,19 @@ struct mmapmgr
 	arealst_t blklst;
 
 	areamgr_t *areamgr;
+
+	/* index of this instance - stored in managed areas */
+	uint8_t cpu;
 };
 
 typedef struct mmapmgr mmapmgr_t;
 
 /* */
 
-void mmapmgr_init(mmapmgr_t *mmapmgr, areamgr_t *areamgr);
-void *mmapmgr_alloc(mmapmgr_t *mmapmgr, uint32_t size, uint32_t alignment);
-bool mmapmgr_realloc(mmapmgr_t *mmapmgr, void *memory, uint32_t new_size);
+void mmapmgr_init(mmapmgr_t *mmapmgr, areamgr_t *areamgr, uint8_t cpu);
+void *mmapmgr_alloc(mmapmgr_t *mmapmgr, size_t size, uint32_t alignment);
+bool mmapmgr_realloc(mmapmgr_t *mmapmgr, void *memory, size_t new_size);
+void *mmapmgr_remap(mmapmgr_t *mmapmgr, void *memory, size_t new_size);
 bool mmapmgr_free(mmapmgr_t *mmapmgr, void *memory);
 bool mmapmgr_verify(mmapmgr_t *mmapmgr, bool verbose);
 
@@ -0,0 +1,107 @@
+/*
+ * Author:	Krystian Bacławski <name.surname@gmail.com>
+ * Desc:	Page map - radix tree translating addresses to memory areas
+ */
+
+#include "pagemap.h"
+
+#ifdef __LP64__
+pagemap_node_t *pagemap[PAGEMAP_ROOT_SIZE];
+#else
+pagemap_leaf_t *pagemap[PAGEMAP_ROOT_SIZE];
+#endif
+
+/**
+ * Fills an empty slot of page map with zeroed memory taken from the OS.
+ *
+ * @param slot
+ * @param size	size of node to allocate
+ */
+
+static void pagemap_fill(void **slot, size_t size)/*{{{*/
+{
+	uint32_t pages = SIZE_IN_PAGES(size);
+
+	void *node = pm_mmap_alloc(NULL, pages);
+
+	if (node == NULL)
+		PANIC("Cannot allocate page map node!");
+
+	DEBUG("Created page map node at %p\n", node);
+
+	/* someone else could be faster - then give our node back */
+	if (!__sync_bool_compare_and_swap(slot, NULL, node))
+		pm_mmap_free(node, pages);
+}/*}}}*/
+
+/**
+ * Gets a leaf of page map that covers given page. If there is no such leaf
+ * and <i>create</i> is set then a new one is taken from the OS.
+ *
+ * @param page
+ * @param create
+ * @return
+ */
+
+static pagemap_leaf_t *pagemap_leaf(uintptr_t page, bool create)/*{{{*/
+{
+	I((page >> PAGEMAP_BITS) == 0);
+
+#ifdef __LP64__
+	pagemap_node_t **root = &pagemap[page >> (PAGEMAP_NODE_BITS + PAGEMAP_LEAF_BITS)];
+
+	if (*root == NULL) {
+		if (!create)
+			return NULL;
+
+		pagemap_fill((void **)root, sizeof(pagemap_node_t));
+	}
+
+	pagemap_leaf_t **slot = &(*root)->leaf[(page >> PAGEMAP_LEAF_BITS) & (PAGEMAP_NODE_SIZE - 1)];
+#else
+	pagemap_leaf_t **slot = &pagemap[page >> PAGEMAP_LEAF_BITS];
+#endif
+
+	if ((*slot == NULL) && create)
+		pagemap_fill((void **)slot, sizeof(pagemap_leaf_t));
+
+	return *slot;
+}/*}}}*/
+
+/**
+ * Makes all pages in given range point to the area. If <i>area</i> is NULL
+ * then pages are removed from the map.
+ *
+ * Caller must hold global list of areas locked for writing.
+ *
+ * @param begining
+ * @param pages
+ * @param area
+ */
+
+void pagemap_set(void *begining, uint32_t pages, struct area *area)/*{{{*/
+{
+	uintptr_t page = (uintptr_t)begining >> PAGE_BITS;
+	uintptr_t last = page + pages;
+
+	I(((uintptr_t)begining & (PAGE_SIZE - 1)) == 0);
+
+	while (page < last) {
+		pagemap_leaf_t *leaf = pagemap_leaf(page, (area != NULL));
+
+		uint32_t i = page & (PAGEMAP_LEAF_SIZE - 1);
+		uint32_t n = PAGEMAP_LEAF_SIZE - i;
+
+		if (n > last - page)
+			n = last - page;
+
+		if (leaf != NULL) {
+			while (n-- > 0) {
+				leaf->area[i++] = area;
+				page++;
+			}
+		} else {
+			page += n;
+		}
+	}
+}/*}}}*/
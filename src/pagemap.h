@@ -0,0 +1,92 @@
+#ifndef __PAGEMAP_H
+#define __PAGEMAP_H
+
+#include "common.h"
+#include "sysmem.h"
+
+/* === Page map - translation of page number to memory area ================ */
+
+/*
+ * Radix tree with two levels on 32-bit and three levels (covering 48 bits
+ * of virtual address space) on 64-bit architectures. Root is allocated
+ * statically, other nodes are taken from the OS on demand and never given
+ * back. Each page of an area linked into global list points to that area's
+ * structure.
+ */
+
+#ifdef __LP64__
+#define PAGEMAP_BITS		(48 - PAGE_BITS)
+#define PAGEMAP_LEAF_BITS	12
+#define PAGEMAP_NODE_BITS	12
+#else
+#define PAGEMAP_BITS		(32 - PAGE_BITS)
+#define PAGEMAP_LEAF_BITS	10
+#define PAGEMAP_NODE_BITS	0
+#endif
+
+#define PAGEMAP_ROOT_BITS	(PAGEMAP_BITS - PAGEMAP_NODE_BITS - PAGEMAP_LEAF_BITS)
+
+#define PAGEMAP_LEAF_SIZE	(1 << PAGEMAP_LEAF_BITS)
+#define PAGEMAP_NODE_SIZE	(1 << PAGEMAP_NODE_BITS)
+#define PAGEMAP_ROOT_SIZE	(1 << PAGEMAP_ROOT_BITS)
+
+struct area;
+
+struct pagemap_leaf
+{
+	struct area *area[PAGEMAP_LEAF_SIZE];
+};
+
+typedef struct pagemap_leaf pagemap_leaf_t;
+
+#ifdef __LP64__
+struct pagemap_node
+{
+	pagemap_leaf_t *leaf[PAGEMAP_NODE_SIZE];
+};
+
+typedef struct pagemap_node pagemap_node_t;
+
+extern pagemap_node_t *pagemap[PAGEMAP_ROOT_SIZE];
+#else
+extern pagemap_leaf_t *pagemap[PAGEMAP_ROOT_SIZE];
+#endif
+
+void pagemap_set(void *begining, uint32_t pages, struct area *area);
+
+/**
+ * Finds a leaf of page map that covers given page.
+ *
+ * @param page
+ * @return		the leaf or NULL if it does not exist yet
+ */
+
+static inline pagemap_leaf_t *pagemap_get_leaf(uintptr_t page)/*{{{*/
+{
+#ifdef __LP64__
+	pagemap_node_t *node = pagemap[page >> (PAGEMAP_NODE_BITS + PAGEMAP_LEAF_BITS)];
+
+	return (node != NULL) ? node->leaf[(page >> PAGEMAP_LEAF_BITS) & (PAGEMAP_NODE_SIZE - 1)] : NULL;
+#else
+	return pagemap[page >> PAGEMAP_LEAF_BITS];
+#endif
+}/*}}}*/
+
+/**
+ * Finds an area that given address belongs to. Does not take any locks, so
+ * the caller must validate the result if the area can be modified meanwhile.
+ *
+ * @param address
+ * @return
+ */
+
+static inline struct area *pagemap_get(void *address)/*{{{*/
+{
+	uintptr_t page = (uintptr_t)address >> PAGE_BITS;
+
+	pagemap_leaf_t *leaf = pagemap_get_leaf(page);
+
+	return (leaf != NULL) ? leaf->area[page & (PAGEMAP_LEAF_SIZE - 1)] : NULL;
+}/*}}}*/
+
+#endif
@@ -0,0 +1,328 @@
+/*
+ * Author:	Krystian Bacławski <name.surname@gmail.com>
+ * Desc:	Manager of heap kept in named shared memory segment.
+ */
+
+#include "shmmgr.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+/**
+ * Lock the heap. If a process died while holding the lock, the heap is
+ * taken over as it is.
+ *
+ * @param self
+ */
+
+static void shmmgr_lock(shmmgr_t *self)/*{{{*/
+{
+	if (pthread_mutex_lock(&self->lock) == EOWNERDEAD) {
+		DEBUG("Owner of shared heap at %p died - recovering lock.\n", (void *)self);
+
+		pthread_mutex_consistent(&self->lock);
+	}
+}/*}}}*/
+
+static inline void shmmgr_unlock(shmmgr_t *self)/*{{{*/
+{
+	pthread_mutex_unlock(&self->lock);
+}/*}}}*/
+
+/**
+ * Extend the heap by at least given number of pages. Called with the heap
+ * locked.
+ *
+ * @param self
+ * @param pages
+ * @return			FALSE if the heap reached its maximal size or the segment
+ * 					could not be extended
+ */
+
+static bool shmmgr_grow(shmmgr_t *self, uint32_t pages)/*{{{*/
+{
+	/* double the heap if possible, so it is not extended too often */
+	uint32_t grow = (pages > self->pages) ? pages : self->pages;
+
+	if (grow > self->max_pages - self->pages)
+		grow = self->max_pages - self->pages;
+
+	if (grow < pages)
+		return FALSE;
+
+	int fd = pm_shm_open(self->name, 0);
+
+	if (fd == -1)
+		return FALSE;
+
+	/* the name could have been reused by another segment */
+	struct stat st;
+
+	bool resized = (fstat(fd, &st) == 0) && ((uint64_t)st.st_ino == self->ino) &&
+				   pm_shm_resize(fd, self->pages + grow);
+
+	close(fd);
+
+	if (!resized)
+		return FALSE;
+
+	mb_list_expand(&self->list, grow);
+
+	/* other processes can access new pages as soon as they see new size */
+	__sync_synchronize();
+
+	self->pages += grow;
+
+	DEBUG("Shared heap at %p grown to %u pages.\n", (void *)self, self->pages);
+
+	return TRUE;
+}/*}}}*/
+
+/**
+ * Create named shared heap and attach to it.
+ *
+ * @param name		name of the segment (as for shm_open)
+ * @param pages		initial size of the heap in pages
+ * @param max_pages	size the heap can grow to
+ * @return			NULL if the segment exists or cannot be created
+ */
+
+shmmgr_t *shmmgr_create(const char *name, uint32_t pages, uint32_t max_pages)/*{{{*/
+{
+	if ((pages < SIZE_IN_PAGES(sizeof(shmmgr_t) + sizeof(mb_free_t))) || (pages > max_pages) || (max_pages > SHMMGR_PAGES_MAX))
+		return NULL;
+
+	if (strlen(name) >= SHMMGR_NAME_MAX)
+		return NULL;
+
+	int fd = pm_shm_open(name, pages);
+
+	if (fd == -1)
+		return NULL;
+
+	struct stat st;
+
+	shmmgr_t *self = (fstat(fd, &st) == 0) ? pm_shm_map(fd, max_pages) : NULL;
+
+	close(fd);
+
+	if (self == NULL) {
+		pm_shm_unlink(name);
+
+		return NULL;
+	}
+
+	self->pages		= pages;
+	self->max_pages	= max_pages;
+	self->attached	= 1;
+	self->ino		= st.st_ino;
+
+	strcpy(self->name, name);
+
+	pthread_mutexattr_init(&self->lock_attr);
+	pthread_mutexattr_setpshared(&self->lock_attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&self->lock_attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&self->lock, &self->lock_attr);
+
+	mb_init(&self->list, pages * PAGE_SIZE - offsetof(shmmgr_t, list), checksum_new_key());
+
+	/* the heap becomes visible to other processes once magic is set */
+	__sync_synchronize();
+
+	self->magic = SHMMGR_MAGIC;
+
+	DEBUG("Created shared heap '%s' at %p of %u pages (up to %u).\n", name, (void *)self, pages, max_pages);
+
+	return self;
+}/*}}}*/
+
+/**
+ * Attach to existing named shared heap.
+ *
+ * @param name
+ * @return			NULL if the heap does not exist, is not set up yet or
+ * 					cannot be mapped
+ */
+
+shmmgr_t *shmmgr_attach(const char *name)/*{{{*/
+{
+	int fd = pm_shm_open(name, 0);
+
+	if (fd == -1)
+		return NULL;
+
+	/* the creator may not have sized the segment yet - touching the header
+	 * beyond its end would raise SIGBUS */
+	struct stat st;
+
+	if ((fstat(fd, &st) == -1) || (st.st_size < sizeof(shmmgr_t))) {
+		close(fd);
+
+		DEBUG("Shared heap '%s' is not set up yet.\n", name);
+
+		return NULL;
+	}
+
+	/* read the header first to learn how large the heap can get */
+	shmmgr_t *header = pm_shm_map(fd, SIZE_IN_PAGES(sizeof(shmmgr_t)));
+	shmmgr_t *self   = NULL;
+
+	if (header != NULL) {
+		bool valid = (header->magic == SHMMGR_MAGIC);
+
+		uint32_t pages = header->max_pages;
+
+		pm_shm_unmap(header, SIZE_IN_PAGES(sizeof(shmmgr_t)));
+
+		if (valid)
+			self = pm_shm_map(fd, pages);
+	}
+
+	close(fd);
+
+	if (self == NULL) {
+		DEBUG("Could not attach to shared heap '%s'.\n", name);
+
+		return NULL;
+	}
+
+	shmmgr_lock(self);
+	self->attached++;
+	shmmgr_unlock(self);
+
+	DEBUG("Attached to shared heap '%s' at %p of %u pages.\n", name, (void *)self, self->pages);
+
+	return self;
+}/*}}}*/
+
+/**
+ * Detach from shared heap. Blocks allocated there stay valid for other
+ * processes.
+ *
+ * @param self
+ */
+
+void shmmgr_detach(shmmgr_t *self)/*{{{*/
+{
+	uint32_t pages = self->max_pages;
+
+	shmmgr_lock(self);
+	self->attached--;
+	shmmgr_unlock(self);
+
+	DEBUG("Detached from shared heap at %p.\n", (void *)self);
+
+	pm_shm_unmap(self, pages);
+}/*}}}*/
+
+/**
+ * Remove name of shared heap. The heap ceases to exist once all processes
+ * detach from it.
+ *
+ * @param name
+ * @return
+ */
+
+bool shmmgr_destroy(const char *name)/*{{{*/
+{
+	return pm_shm_unlink(name);
+}/*}}}*/
+
+/**
+ * Allocate block in shared heap. The heap is extended if there is no room
+ * left for the block.
+ *
+ * @param self
+ * @param size
+ * @param alignment
+ * @return
+ */
+
+void *shmmgr_alloc(shmmgr_t *self, uint32_t size, uint32_t alignment)/*{{{*/
+{
+	DEBUG("\033[37;1mRequested block of size %u in shared heap at %p.\033[0m\n", size, (void *)self);
+
+	shmmgr_lock(self);
+
+	void *memory = (alignment > 0) ? mb_alloc_aligned(&self->list, size, alignment) : mb_alloc(&self->list, size, FALSE);
+
+	if ((memory == NULL) && shmmgr_grow(self, SIZE_IN_PAGES((size_t)size + alignment + sizeof(mb_t) + sizeof(mb_free_t))))
+		memory = (alignment > 0) ? mb_alloc_aligned(&self->list, size, alignment) : mb_alloc(&self->list, size, FALSE);
+
+	shmmgr_unlock(self);
+
+	return memory;
+}/*}}}*/
+
+/**
+ * Free block allocated in shared heap by any of attached processes.
+ *
+ * @param self
+ * @param memory
+ * @return			FALSE if the block does not belong to the heap
+ */
+
+bool shmmgr_free(shmmgr_t *self, void *memory)/*{{{*/
+{
+	DEBUG("\033[37;1mRequested to free block at %p in shared heap at %p.\033[0m\n", (void *)memory, (void *)self);
+
+	if (!shmmgr_contains(self, memory))
+		return FALSE;
+
+	shmmgr_lock(self);
+
+	mb_free(&self->list, memory);
+
+	shmmgr_unlock(self);
+
+	return TRUE;
+}/*}}}*/
+
+/**
+ * Get number of bytes that can be used in allocated block.
+ *
+ * @param self
+ * @param memory
+ * @return
+ */
+
+uint32_t shmmgr_get_size(shmmgr_t *self, void *memory)/*{{{*/
+{
+	mb_t *blk = (mb_t *)((uintptr_t)memory - sizeof(mb_t));
+
+	mb_valid(&self->list, blk);
+	I(mb_is_used(blk));
+
+	return blk->size - sizeof(mb_t);
+}/*}}}*/
+
+/**
+ * Print contents of shared heap.
+ *
+ * @param self
+ * @param verbose
+ * @return
+ */
+
+bool shmmgr_verify(shmmgr_t *self, bool verbose)/*{{{*/
+{
+	shmmgr_lock(self);
+
+	if (verbose)
+		fprintf(stderr, "\033[1;36m shmmgr at %p [%u of %u pages, %u processes attached]:\033[0m\n",
+				(void *)self, self->pages, self->max_pages, self->attached);
+
+	bool error = (self->magic != SHMMGR_MAGIC) || (self->pages > self->max_pages);
+
+	error |= (offsetof(shmmgr_t, list) + self->list.size != self->pages * PAGE_SIZE);
+
+	error |= mb_verify(&self->list, verbose);
+
+	if (error && verbose)
+		fprintf(stderr, "\033[7m  Invalid!\033[0m\n");
+
+	shmmgr_unlock(self);
+
+	return error;
+}/*}}}*/
@@ -0,0 +1,72 @@
+#ifndef __SHMMGR_H
+#define __SHMMGR_H
+
+#include "common.h"
+#include "sysmem.h"
+#include "blklst-ao.h"
+#include <pthread.h>
+
+/*
+ * Heap kept in named shared memory segment. Unrelated processes can attach
+ * to it by name and exchange blocks allocated there. All of its structures
+ * live inside the segment, which begins with manager's header followed by a
+ * single list of memory blocks spanning the rest of it. Blocks are linked by
+ * offsets, so each process can map the segment at any address.
+ *
+ * Every process maps the segment up to its maximal size. The heap grows by
+ * extending the segment and publishing new size in the header, so processes
+ * attached to it never have to remap it.
+ */
+
+#define SHMMGR_MAGIC		0x4d4e5348
+
+/* blocks are linked by 32-bit signed offsets */
+#define SHMMGR_PAGES_MAX	((uint32_t)(0x7fffffffUL / PAGE_SIZE))
+
+/* name is needed to reopen the segment when the heap grows */
+#define SHMMGR_NAME_MAX		64
+
+struct shmmgr
+{
+	uint32_t magic;
+
+	/* current and maximal size of the segment */
+	uint32_t pages;
+	uint32_t max_pages;
+
+	/* number of processes attached to the segment */
+	uint32_t attached;
+
+	/* name and inode of the segment */
+	char	 name[SHMMGR_NAME_MAX];
+	uint64_t ino;
+
+	/* process-shared lock guarding memory blocks' list and segment's size */
+	pthread_mutex_t		lock;
+	pthread_mutexattr_t	lock_attr;
+
+	/* must be the last member - blocks follow it; blocks are checksummed with
+	 * key of the heap kept in the list, not with key of any process */
+	mb_list_t list;
+};
+
+typedef struct shmmgr shmmgr_t;
+
+/* Check if block was allocated from given shared heap */
+
+static inline bool shmmgr_contains(shmmgr_t *shmmgr, void *memory) {
+	return ((uintptr_t)memory > (uintptr_t)&shmmgr->list) &&
+		   ((uintptr_t)memory < (uintptr_t)shmmgr + shmmgr->pages * PAGE_SIZE);
+}
+
+/* function prototypes */
+shmmgr_t *shmmgr_create(const char *name, uint32_t pages, uint32_t max_pages);
+shmmgr_t *shmmgr_attach(const char *name);
+void shmmgr_detach(shmmgr_t *shmmgr);
+bool shmmgr_destroy(const char *name);
+void *shmmgr_alloc(shmmgr_t *shmmgr, uint32_t size, uint32_t alignment);
+bool shmmgr_free(shmmgr_t *shmmgr, void *memory);
+uint32_t shmmgr_get_size(shmmgr_t *shmmgr, void *memory);
+bool shmmgr_verify(shmmgr_t *shmmgr, bool verbose);
+
+#endif
@@ -7,6 +7,8 @@
 #define NDEBUG
 #endif
 
+#define _GNU_SOURCE
+
 #include "sysmem.h"
 
 #include <sys/mman.h>
@@ -16,8 +18,52 @@ void pm_mmap_init()
 {
 }
 
+#if HUGE_PAGES
+/* Map n pages beginning at huge page boundary */
+
+static void *pm_mmap_alloc_huge(uint32_t n)
+{
+	size_t size  = PAGE_SIZE * n;
+	size_t extra = HUGE_PAGE_SIZE - PAGE_SIZE;
+
+	uintptr_t area = (uintptr_t)mmap(NULL, size + extra, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, 0, 0);
+
+	if (area == (uintptr_t)-1)
+		return NULL;
+
+	uintptr_t begining = ALIGN(area, HUGE_PAGE_SIZE);
+
+	/* give back pages in front of and behind aligned part */
+	if (begining > area)
+		munmap((void *)area, begining - area);
+
+	if (area + extra > begining)
+		munmap((void *)(begining + size), area + extra - begining);
+
+	return (void *)begining;
+}
+
+static void pm_mmap_advise_huge(void *area, uint32_t n)
+{
+#ifdef MADV_HUGEPAGE
+	madvise(area, PAGE_SIZE * n, MADV_HUGEPAGE);
+#endif
+}
+#endif
+
 void *pm_mmap_alloc(void *hint, uint32_t n)
 {
+#if HUGE_PAGES
+	if ((hint == NULL) && (n >= HUGE_PAGE_PAGES)) {
+		void *area = pm_mmap_alloc_huge(n);
+
+		if (area != NULL)
+			pm_mmap_advise_huge(area, n);
+
+		return area;
+	}
+#endif
+
 	void *area = mmap(hint, PAGE_SIZE * n, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, 0, 0);
 
 	return (area != (void *)-1) ? (area) : (NULL);
@@ -27,3 +73,50 @@ bool pm_mmap_free(void *start, uint32_t n)
 {
 	return (munmap(start, PAGE_SIZE * n) == 0);
 }
+
+void *pm_mmap_remap(void *area, uint32_t n, uint32_t new_n, bool relocate)
+{
+#if HUGE_PAGES
+	if (relocate && (new_n >= HUGE_PAGE_PAGES)) {
+		void *newarea = mremap(area, PAGE_SIZE * n, PAGE_SIZE * new_n, 0);
+
+		/* area cannot grow in place - move it to huge page boundary */
+		if (newarea == (void *)-1) {
+			void *target = pm_mmap_alloc_huge(new_n);
+
+			if (target != NULL) {
+				newarea = mremap(area, PAGE_SIZE * n, PAGE_SIZE * new_n, MREMAP_MAYMOVE|MREMAP_FIXED, target);
+
+				if (newarea == (void *)-1)
+					munmap(target, PAGE_SIZE * new_n);
+			}
+		}
+
+		if (newarea != (void *)-1) {
+			pm_mmap_advise_huge(newarea, new_n);
+
+			return newarea;
+		}
+	}
+#endif
+
+	void *newarea = mremap(area, PAGE_SIZE * n, PAGE_SIZE * new_n, relocate ? MREMAP_MAYMOVE : 0);
+
+#if HUGE_PAGES
+	if ((newarea != (void *)-1) && (new_n >= HUGE_PAGE_PAGES))
+		pm_mmap_advise_huge(newarea, new_n);
+#endif
+
+	return (newarea != (void *)-1) ? (newarea) : (NULL);
+}
+
+bool pm_mmap_purge(void *area, uint32_t n)
+{
+#ifdef MADV_FREE
+	/* pages are reclaimed lazily, only if there is memory pressure */
+	if (madvise(area, PAGE_SIZE * n, MADV_FREE) == 0)
+		return TRUE;
+#endif
+
+	return (madvise(area, PAGE_SIZE * n, MADV_DONTNEED) == 0);
+}
@@ -15,16 +15,16 @@
 
 void pm_sbrk_init()
 {
-	DEBUG("segment end: $%.8x\n", (uint32_t)sbrk(0));
+	DEBUG("segment end: %p\n", (void *)sbrk(0));
 }
 
 void *pm_sbrk_alloc(void *hint, uint32_t n)
 {
-	DEBUG("segment end: $%.8x\n", (uint32_t)sbrk(0));
+	DEBUG("segment end: %p\n", (void *)sbrk(0));
 
 	void *area = sbrk(n * PAGE_SIZE);
 
-	DEBUG("segment extended to: $%.8x\n", (uint32_t)sbrk(0));
+	DEBUG("segment extended to: %p\n", (void *)sbrk(0));
 
 	return (area != (void *)-1) ? (area) : (NULL);
 }
@@ -33,11 +33,11 @@ bool pm_sbrk_free(void *area, uint32_t n)
 {
 	uint8_t *end = (uint8_t *) sbrk(0);
 
-	DEBUG("segment end: $%.8x\n", (uint32_t)sbrk(0));
+	DEBUG("segment end: %p\n", (void *)sbrk(0));
 
 	if ((uint8_t *)area + (PAGE_SIZE * n) == end) {
 		if (brk(area) == 0) {
-			DEBUG("segment shrinked to: $%.8x\n", (uint32_t)sbrk(0));
+			DEBUG("segment shrinked to: %p\n", (void *)sbrk(0));
 
 			return TRUE;
 		}
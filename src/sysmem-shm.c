@@ -1,7 +1,8 @@
 /*
  * Author:	Krystian Bacławski <name.surname@gmail.com>
  * Desc:	Page manager -- sbrk emulation through implementation in
- * 			constant-sized shared memory area.
+ * 			growable shared memory area, and named shared memory
+ * 			segments that unrelated processes can attach to.
  */
 
 #if !defined DBG_SYSMEM && !defined NDEBUG
@@ -11,25 +12,46 @@
 #include "sysmem.h"
 
 #include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <stdio.h>
 #include <unistd.h>
 
+/*
+ * Whole area is mapped up front, but its backing object is only as large as
+ * the part below the break. Pages above it consume no memory, and the area
+ * grows by extending the object, so it never has to be remapped.
+ */
+
 #ifndef PM_PAGES
-#define PM_PAGES	8192		/* 32 MiB */
+#define PM_PAGES	((sizeof(void *) == 8) ? 262144 : 16384)	/* 1 GiB or 64 MiB */
 #endif
 
 static struct {
 	uint8_t *start;
 	uint8_t *brk;
 	uint8_t *end;
+	int		 fd;
 } pages;
 
 void pm_shm_init()
 {
-	pages.start	= (uint8_t*) mmap(0, PAGE_SIZE * PM_PAGES, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, 0, 0);
+	char name[32];
+
+	snprintf(name, sizeof(name), "/mneme-%d", (int)getpid());
+
+	/* backing object is anonymous - it only needs a name to be created */
+	pages.fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+	I(pages.fd != -1);
+
+	shm_unlink(name);
+
+	pages.start	= (uint8_t*) mmap(0, PAGE_SIZE * PM_PAGES, PROT_READ | PROT_WRITE, MAP_SHARED, pages.fd, 0);
 	pages.brk	= pages.start;
 	pages.end	= pages.start + PAGE_SIZE * PM_PAGES;
 
-	I(pages.start != NULL);
+	I(pages.start != MAP_FAILED);
 }
 
 void *pm_shm_alloc(void *hint, uint32_t n)
@@ -39,6 +61,9 @@ void *pm_shm_alloc(void *hint, uint32_t n)
 	if (pages.brk + (n * PAGE_SIZE) > pages.end)
 		return NULL;
 
+	if (ftruncate(pages.fd, (pages.brk - pages.start) + n * PAGE_SIZE) == -1)
+		return NULL;
+
 	pages.brk += n * PAGE_SIZE;
 
 	return area;
@@ -47,6 +72,10 @@ void *pm_shm_alloc(void *hint, uint32_t n)
 bool pm_shm_free(void *area, uint32_t n)
 {
 	if ((uint8_t *)area + (PAGE_SIZE * n) == pages.brk) {
+		/* memory of pages cut off from the object is released */
+		if (ftruncate(pages.fd, (pages.brk - pages.start) - n * PAGE_SIZE) == -1)
+			return FALSE;
+
 		pages.brk -= PAGE_SIZE * n;
 
 		return TRUE;
@@ -54,3 +83,81 @@ bool pm_shm_free(void *area, uint32_t n)
 
 	return FALSE;
 }
+
+/**
+ * Open named shared memory segment.
+ *
+ * @param name	name of the segment (as for shm_open)
+ * @param n		size of the segment to be created in pages, 0 to open
+ * 				an existing one
+ * @return		file descriptor of the segment or -1
+ */
+
+int pm_shm_open(const char *name, uint32_t n)
+{
+	int fd;
+
+	if (n == 0)
+		return shm_open(name, O_RDWR, 0);
+
+	if ((fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600)) == -1)
+		return -1;
+
+	if (ftruncate(fd, (off_t)n * PAGE_SIZE) == -1) {
+		close(fd);
+		shm_unlink(name);
+
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * Change size of shared memory segment. Pages added to the segment are
+ * filled with zeros and take no memory until they are touched.
+ *
+ * @param fd	descriptor of the segment
+ * @param n		new size of the segment in pages
+ * @return
+ */
+
+bool pm_shm_resize(int fd, uint32_t n)
+{
+	return (ftruncate(fd, (off_t)n * PAGE_SIZE) == 0);
+}
+
+/**
+ * Map first pages of shared memory segment. Mapping can be larger than the
+ * segment - pages beyond its end are reserved for it to grow into.
+ *
+ * @param fd	descriptor of the segment
+ * @param n		number of pages
+ * @return		address of mapping or NULL
+ */
+
+void *pm_shm_map(int fd, uint32_t n)
+{
+	void *area = mmap(NULL, n * PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+	return (area == MAP_FAILED) ? NULL : area;
+}
+
+/**
+ * Unmap shared memory segment.
+ */
+
+bool pm_shm_unmap(void *area, uint32_t n)
+{
+	return (munmap(area, n * PAGE_SIZE) == 0);
+}
+
+/**
+ * Remove name of shared memory segment. The segment itself is destroyed once
+ * all processes unmap it.
+ */
+
+bool pm_shm_unlink(const char *name)
+{
+	return (shm_unlink(name) == 0);
+}
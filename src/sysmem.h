@@ -3,17 +3,41 @@
 
 #include "common.h"
 
+#ifndef PAGE_BITS
+#define PAGE_BITS	12
+#endif
+
 #ifndef PAGE_SIZE
-#define PAGE_SIZE	4096
+#define PAGE_SIZE	((size_t)1 << PAGE_BITS)
 #endif
 
 #define SIZE_IN_PAGES(size)		(ALIGN(size, PAGE_SIZE) / PAGE_SIZE)
 
+/*
+ * Mappings of at least one huge page begin at huge page boundary and are
+ * advised to be backed by transparent huge pages. Sizes are still counted in
+ * base pages, as the kernel splits huge pages if a part of mapping is purged
+ * or unmapped.
+ */
+
+#ifndef HUGE_PAGES
+#define HUGE_PAGES		1
+#endif
+
+#ifndef HUGE_PAGE_BITS
+#define HUGE_PAGE_BITS	21
+#endif
+
+#define HUGE_PAGE_SIZE	((size_t)1 << HUGE_PAGE_BITS)
+#define HUGE_PAGE_PAGES	((uint32_t)(HUGE_PAGE_SIZE / PAGE_SIZE))
+
 typedef enum { PM_SBRK, PM_MMAP, PM_SHM } pm_type_t;
 
 void pm_mmap_init();
 void *pm_mmap_alloc(void *hint, uint32_t n);
 bool pm_mmap_free(void *area, uint32_t n);
+void *pm_mmap_remap(void *area, uint32_t n, uint32_t new_n, bool relocate);
+bool pm_mmap_purge(void *area, uint32_t n);
 
 void pm_sbrk_init();
 void *pm_sbrk_alloc(void *hint, uint32_t n);
@@ -22,5 +46,10 @@ bool pm_sbrk_free(void *area, uint32_t n);
 void pm_shm_init();
 void *pm_shm_alloc(void *hint, uint32_t n);
 bool pm_shm_free(void *area, uint32_t n);
+int pm_shm_open(const char *name, uint32_t n);
+bool pm_shm_resize(int fd, uint32_t n);
+void *pm_shm_map(int fd, uint32_t n);
+bool pm_shm_unmap(void *area, uint32_t n);
+bool pm_shm_unlink(const char *name);
 
 #endif
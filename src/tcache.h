@@ -0,0 +1,83 @@
+#ifndef __TCACHE_H
+#define __TCACHE_H
+
+#include "common.h"
+
+/* === Thread-local cache of small blocks ================================== */
+
+/*
+ * Each thread keeps a stack of free blocks per each equally-sized blocks'
+ * class (8B, 16B, 24B, 32B). Free blocks are linked through their first word.
+ * Blocks are moved between the cache and eqsbmgr in batches.
+ */
+
+#define TCACHE_CLASSES	4
+
+#ifndef TCACHE_SIZE
+#define TCACHE_SIZE		64
+#endif
+
+#define TCACHE_BATCH	(TCACHE_SIZE / 2)
+
+struct tcache_block
+{
+	struct tcache_block *next;
+};
+
+typedef struct tcache_block tcache_block_t;
+
+struct tcache_bin
+{
+	tcache_block_t *first;
+
+	uint32_t count;
+};
+
+typedef struct tcache_bin tcache_bin_t;
+
+struct tcache
+{
+	/* memory manager the cache is bound to */
+	void *owner;
+
+	tcache_bin_t bin[TCACHE_CLASSES];
+};
+
+typedef struct tcache tcache_t;
+
+/**
+ * Take a block from the cache.
+ *
+ * @param bin
+ * @return		address of a block or NULL if the bin is empty
+ */
+
+static inline void *tcache_pop(tcache_bin_t *bin)/*{{{*/
+{
+	tcache_block_t *block = bin->first;
+
+	if (block != NULL) {
+		bin->first = block->next;
+		bin->count--;
+	}
+
+	return block;
+}/*}}}*/
+
+/**
+ * Put a block into the cache.
+ *
+ * @param bin
+ * @param memory
+ */
+
+static inline void tcache_push(tcache_bin_t *bin, void *memory)/*{{{*/
+{
+	tcache_block_t *block = memory;
+
+	block->next = bin->first;
+	bin->first  = block;
+	bin->count++;
+}/*}}}*/
+
+#endif
@@ -10,6 +10,7 @@
 #include <signal.h>
 #include <unistd.h>
 #include <math.h>
+#include <time.h>
 
 #define MAX_THREADS			1024
 
@@ -33,10 +34,67 @@ static struct {
 	double	align_pbb;
 	double  grow_pbb;
 	double  shrink_pbb;
-} test = { -1, 7, 0.5, 0.0, 0.0, 0.0 };
+} test = { -1, 0, 0.5, 0.0, 0.0, 0.0 };
 
 bool verbose = FALSE;
 bool verify  = FALSE;
+bool timing  = FALSE;
+
+/**
+ * Time spent in memory manager's procedures.
+ */
+
+#define TIMING_ALLOC	0
+#define TIMING_REALLOC	1
+#define TIMING_FREE		2
+#define TIMING_COUNT	3
+
+static struct {
+	const char *name;
+	uint64_t	nsec;
+	uint64_t	count;
+} timings[TIMING_COUNT] = { {"alloc", 0, 0}, {"realloc", 0, 0}, {"free", 0, 0} };
+
+static inline uint64_t timing_now()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline void timing_add(uint32_t op, uint64_t start)
+{
+	__sync_fetch_and_add(&timings[op].nsec, timing_now() - start);
+	__sync_fetch_and_add(&timings[op].count, 1);
+}
+
+/* Evaluate memory manager's call and measure its execution time if requested. */
+#define TIMED(op, call) ({							\
+	uint64_t __start = timing ? timing_now() : 0;	\
+	typeof(call) __result = (call);					\
+	if (timing) timing_add((op), __start);			\
+	__result; })
+
+static void timing_print()
+{
+	uint32_t i;
+	uint64_t nsec = 0, count = 0;
+
+	fprintf(stderr, "\033[1;37m%-10s %12s %12s %10s\033[0m\n", "operation", "count", "time [ms]", "ns / op");
+
+	for (i = 0; i < TIMING_COUNT; i++) {
+		fprintf(stderr, "%-10s %12llu %12.3f %10.1f\n", timings[i].name, (unsigned long long)timings[i].count,
+				timings[i].nsec / 1e6, (timings[i].count > 0) ? ((double)timings[i].nsec / timings[i].count) : 0.0);
+
+		nsec  += timings[i].nsec;
+		count += timings[i].count;
+	}
+
+	fprintf(stderr, "%-10s %12llu %12.3f %10.1f\n", "all", (unsigned long long)count,
+			nsec / 1e6, (count > 0) ? ((double)nsec / count) : 0.0);
+}
 
 /**
  * Generate two random numbers with normal distribution.
@@ -75,7 +133,10 @@ static void usage(char *progname)
 		   "  -G pbb     - pbb of malloc being replaced by realloc which will \033[4mgrow\033[0m block [default: 0.0, max: 0.5]\n"
 		   "  -S pbb     - pbb of free being replaced by realloc which will \033[4mshrink\033[0m block [default: 0.0, max: 0.5]\n"
 		   "  -A pbb     - pbb of malloc with \033[4malignment\033[0m contraint [default: 0.0, max: 0.5]\n"
-		   "  -i         - verify structures of memory allocator at each iteration [default: no]\n"
+		   "  -B period  - give back free pages in background thread every period miliseconds [default: no]\n"
+		   "  -i         - verify structures of memory allocator at each iteration, and all the time\n"
+		   "               in separate thread while pages are given back in background [default: no]\n"
+		   "  -T         - measure time spent per each operation [default: no]\n"
 		   "  -v         - be verbose [default: no]\n"
 		   "\n", progname);
 
@@ -160,8 +221,8 @@ static bool block_array_alloc(void *ptr, int32_t size)
 		blocks.last++;
 		blocks.usedmem += size;
 
-		DEBUG("Allocated block no. %u [$%.8x, %u]. Last block at %d. Used memory: %u.\n",
-			  blocks.last, (uint32_t)ptr, size, blocks.last, blocks.usedmem);
+		DEBUG("Allocated block no. %u [%p, %u]. Last block at %d. Used memory: %u.\n",
+			  blocks.last, (void *)ptr, size, blocks.last, blocks.usedmem);
 
 		result = TRUE;
 	}
@@ -192,8 +253,8 @@ static bool block_array_free(void **ptr, int32_t *size)
 		blocks.last--;
 		blocks.usedmem -= *size;
 
-		DEBUG("Freed block no. %u [$%.8x, %u]. Last block at %d. Used memory: %u.\n",
-			  i, (uint32_t)*ptr, *size, blocks.last, blocks.usedmem);
+		DEBUG("Freed block no. %u [%p, %u]. Last block at %d. Used memory: %u.\n",
+			  i, (void *)*ptr, *size, blocks.last, blocks.usedmem);
 
 		result = TRUE;
 	} else {
@@ -250,7 +311,7 @@ static void *memmgr_test(void *args)
 						if (size + delta > block_classes[2].max_size)
 							delta = block_classes[2].max_size - size;
 
-						if (memmgr_realloc(mm, ptr, size + delta)) {
+						if (TIMED(TIMING_REALLOC, memmgr_realloc(mm, ptr, size + delta))) {
 							size += delta;
 
 							DEBUG("realloc(%p, %u)\n", ptr, size);
@@ -258,7 +319,7 @@ static void *memmgr_test(void *args)
 						}
 
 						if (!block_array_alloc(ptr, size))
-							PANIC("realloc grow: cannot store block [$%.8x, %u].", (uint32_t)ptr, size);
+							PANIC("realloc grow: cannot store block [%p, %u].", (void *)ptr, size);
 					}
 				} else {
 					pbb -= test.grow_pbb;
@@ -318,9 +379,9 @@ static void *memmgr_test(void *args)
 						size = (uint32_t)(range * pbb) + block_classes[i].min_size;
 					}
 
-					if ((ptr = memmgr_alloc(mm, (size > 0) ? size : 1, alignment))) {
+					if ((ptr = TIMED(TIMING_ALLOC, memmgr_alloc(mm, (size > 0) ? size : 1, alignment)))) {
 						if (alignment > 0) {
-							I(((uint32_t)ptr & (alignment - 1)) == 0);
+							I(((uintptr_t)ptr & (alignment - 1)) == 0);
 							DEBUG("memalign(%d, %d) = %p\n", size, alignment, ptr);
 						} else {
 							DEBUG("malloc(%d) = %p\n", size, ptr);
@@ -330,7 +391,7 @@ static void *memmgr_test(void *args)
 						PANIC("alloc: out of memory!");
 
 					if (!block_array_alloc(ptr, size))
-						PANIC("alloc: cannot store block [$%.8x, %u].", (uint32_t)ptr, size);
+						PANIC("alloc: cannot store block [%p, %u].", (void *)ptr, size);
 				}
 			}
 			
@@ -347,25 +408,25 @@ static void *memmgr_test(void *args)
 						if (size <= delta)
 							delta = 0;
 
-						if (memmgr_realloc(mm, ptr, size - delta)) {
+						if (TIMED(TIMING_REALLOC, memmgr_realloc(mm, ptr, size - delta))) {
 							size -= delta;
 
 							DEBUG("realloc(%p, %u)\n", ptr, size);
 							opcnt++;
 						} else 
-							PANIC("realloc shrink: could not shrink block [$%.8x, %u]!", (uint32_t)ptr, size);
+							PANIC("realloc shrink: could not shrink block [%p, %u]!", (void *)ptr, size);
 
 						if (!block_array_alloc(ptr, size))
-							PANIC("realloc shrink: cannot store block [$%.8x, %u]!", (uint32_t)ptr, size);
+							PANIC("realloc shrink: cannot store block [%p, %u]!", (void *)ptr, size);
 					}
 				} else {
 					DEBUG("Case for free.\n");
 					if (block_array_free(&ptr, &size)) {
-						if (memmgr_free(mm, ptr)) {
+						if (TIMED(TIMING_FREE, memmgr_free(mm, ptr))) {
 							DEBUG("free(%p, %u)\n", ptr, size);
 							opcnt++;
 						} else
-							PANIC("free: could not free block [$%.8x, %u]!", (uint32_t)ptr, size);
+							PANIC("free: could not free block [%p, %u]!", (void *)ptr, size);
 					}
 				}
 			}
@@ -397,6 +458,21 @@ bool strtodouble(char *str, double *numptr)
 	return (*str != '\0' && *tmp == '\0');
 }
 
+/**
+ * Verifies structures of memory allocator until the test is finished, so
+ * that it's done concurrently with the scavenger and tester threads.
+ */
+
+static volatile bool finished = FALSE;
+
+static void *memmgr_checker(void *args)
+{
+	while (!finished)
+		memmgr_verify(mm, verbose);
+
+	return NULL;
+}
+
 /**
  * Abort handler.
  */
@@ -418,11 +494,12 @@ int main(int argc, char **argv)
 {
 	int32_t seed		= -1;
 	int32_t threads		= 1;
+	int32_t scavenge	= 0;
 	char c;
 
 	opterr = 0;
 
-	while ((c = getopt(argc, argv, "n:c:t:s:M:A:G:S:iv")) != -1) {
+	while ((c = getopt(argc, argv, "n:c:t:s:M:A:G:S:B:ivT")) != -1) {
 		switch (c) {
 			case 's':
 				if (!strtoint(optarg, &seed))
@@ -478,6 +555,13 @@ int main(int argc, char **argv)
 					usage(argv[0]);
 				break;
 
+			case 'B':
+				if (!strtoint(optarg, &scavenge))
+					usage(argv[0]);
+				if (scavenge < 1)
+					usage(argv[0]);
+				break;
+
 			case 'v':
 				verbose = TRUE;
 				break;
@@ -486,6 +570,10 @@ int main(int argc, char **argv)
 				verify = TRUE;
 				break;
 
+			case 'T':
+				timing = TRUE;
+				break;
+
 			default:
 				usage(argv[0]);
 				break;
@@ -509,9 +597,17 @@ int main(int argc, char **argv)
 	/* initialize memory manager */
 	mm = memmgr_init();
 
+	if ((scavenge > 0) && !memmgr_scavenger_start(mm, scavenge))
+		PANIC("Cannot start scavenger!");
+
 	/* initialize test */
 	block_array_init();
 
+	pthread_t checkerid;
+
+	if ((scavenge > 0) && verify)
+		pthread_create(&checkerid, NULL, memmgr_checker, NULL);
+
 	/* test allocators ! */
 	if (threads > 1)
 	{
@@ -521,18 +617,29 @@ int main(int argc, char **argv)
 
 		for (i = 0; i < threads; i++) {
 			pthread_create(&threadid[i], NULL, memmgr_test, NULL);
-			fprintf(stderr, "Started thread $%.8x.\n", (uint32_t)threadid[i]);
+			fprintf(stderr, "Started thread %p.\n", (void *)threadid[i]);
 		}
 
 		for (i = 0; i < threads; i++) {
 			pthread_join(threadid[i], NULL);
-			fprintf(stderr, "Finished thread $%.8x.\n", (uint32_t)threadid[i]);
+			fprintf(stderr, "Finished thread %p.\n", (void *)threadid[i]);
 		}
 	} else {
 		memmgr_test(NULL);
 	}
 
+	if ((scavenge > 0) && verify) {
+		finished = TRUE;
+		pthread_join(checkerid, NULL);
+	}
+
+	if (scavenge > 0)
+		memmgr_scavenger_stop(mm);
+
 	memmgr_verify(mm, TRUE);
 
+	if (timing)
+		timing_print();
+
 	return 0;
 }
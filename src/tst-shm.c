@@ -0,0 +1,238 @@
+/*
+ * Author:	Krystian Bacławski <name.surname@gmail.com>
+ * Desc:	Shared heap test - blocks allocated by one process are used and
+ * 			freed by another one
+ */
+
+#include "memmgr.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#define SHM_NAME			"/mneme-tst-shm"
+
+#define SHM_SIZE			(64 * PAGE_SIZE)
+#define SHM_MAX_SIZE		(1 << 24)		/* 16 MiB */
+
+#define BLOCK_NUM			1000
+#define LARGE_BLOCK_SIZE	(1 << 20)		/* forces the heap to grow */
+
+bool verbose = FALSE;
+
+static inline uint32_t block_size(uint32_t i)
+{
+	return 16 + (i * 37) % 4000;
+}
+
+/**
+ * Check if whole block is filled with given byte.
+ */
+
+static bool block_check(uint8_t *block, uint32_t size, uint8_t byte)
+{
+	uint32_t i;
+
+	for (i = 0; i < size; i++)
+		if (block[i] != byte)
+			return FALSE;
+
+	return TRUE;
+}
+
+/**
+ * Attach to the heap, check and free blocks allocated by the parent, then
+ * allocate and free own blocks.
+ *
+ * @param fd		pipe which offsets of parent's blocks are read from
+ * @return			number of errors
+ */
+
+static int child(int fd)
+{
+	uint32_t offsets[BLOCK_NUM];
+	size_t   done = 0;
+
+	while (done < sizeof(offsets)) {
+		ssize_t n = read(fd, (uint8_t *)offsets + done, sizeof(offsets) - done);
+
+		if (n <= 0) {
+			fprintf(stderr, "child: parent did not pass blocks\n");
+			return 1;
+		}
+
+		done += n;
+	}
+
+	close(fd);
+
+	memmgr_t *mm  = memmgr_init();
+	shmmgr_t *shm = memmgr_shm_attach(mm, SHM_NAME);
+
+	if (shm == NULL) {
+		fprintf(stderr, "child: cannot attach to shared heap\n");
+		return 1;
+	}
+
+	int errors = 0;
+	uint32_t i;
+
+	for (i = 0; i < BLOCK_NUM; i++) {
+		uint8_t *block = (uint8_t *)shm + offsets[i];
+
+		if (memmgr_usable_size(mm, block) < block_size(i))
+			errors++;
+
+		if (!block_check(block, block_size(i), i))
+			errors++;
+
+		if (!memmgr_free(mm, block))
+			errors++;
+	}
+
+	void *blocks[BLOCK_NUM];
+
+	for (i = 0; i < BLOCK_NUM; i++) {
+		blocks[i] = memmgr_shm_alloc(mm, shm, block_size(BLOCK_NUM - i), 0);
+
+		if (blocks[i] == NULL)
+			errors++;
+		else
+			memset(blocks[i], ~i, block_size(BLOCK_NUM - i));
+	}
+
+	void *large = memmgr_shm_alloc(mm, shm, LARGE_BLOCK_SIZE, 0);
+
+	if (large == NULL) {
+		errors++;
+	} else {
+		memset(large, 0xAA, LARGE_BLOCK_SIZE);
+
+		if (!block_check(large, LARGE_BLOCK_SIZE, 0xAA) || !memmgr_free(mm, large))
+			errors++;
+	}
+
+	for (i = 0; i < BLOCK_NUM; i++) {
+		if (blocks[i] == NULL)
+			continue;
+
+		if (!block_check(blocks[i], block_size(BLOCK_NUM - i), ~i) || !memmgr_free(mm, blocks[i]))
+			errors++;
+	}
+
+	if (shmmgr_verify(shm, verbose))
+		errors++;
+
+	memmgr_verify(mm, verbose);
+
+	memmgr_shm_detach(mm, shm);
+
+	if (verbose)
+		fprintf(stderr, "child: %d errors\n", errors);
+
+	return errors;
+}
+
+int main(int argc, char **argv)
+{
+	if ((argc > 1) && (strcmp(argv[1], "-v") == 0))
+		verbose = TRUE;
+
+	/* remove heap left by previous run */
+	shmmgr_destroy(SHM_NAME);
+
+	int fds[2];
+
+	if (pipe(fds) == -1) {
+		perror("pipe");
+		return EXIT_FAILURE;
+	}
+
+	pid_t pid = fork();
+
+	if (pid == -1) {
+		perror("fork");
+		return EXIT_FAILURE;
+	}
+
+	if (pid == 0) {
+		close(fds[1]);
+		exit(child(fds[0]) ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	close(fds[0]);
+
+	int errors = 0;
+
+	memmgr_t *mm = memmgr_init();
+
+	/* segment that was not sized by its creator yet cannot be attached */
+	int fd = shm_open(SHM_NAME, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+	if (fd != -1) {
+		if (memmgr_shm_attach(mm, SHM_NAME) != NULL)
+			errors++;
+
+		close(fd);
+		shm_unlink(SHM_NAME);
+	}
+
+	shmmgr_t *shm = memmgr_shm_create(mm, SHM_NAME, SHM_SIZE, SHM_MAX_SIZE);
+
+	if (shm == NULL) {
+		fprintf(stderr, "parent: cannot create shared heap\n");
+		return EXIT_FAILURE;
+	}
+
+	uint32_t offsets[BLOCK_NUM];
+	uint32_t i;
+
+	for (i = 0; i < BLOCK_NUM; i++) {
+		uint8_t *block = memmgr_shm_alloc(mm, shm, block_size(i), 0);
+
+		if (block == NULL) {
+			fprintf(stderr, "parent: cannot allocate block %u\n", i);
+			return EXIT_FAILURE;
+		}
+
+		memset(block, i, block_size(i));
+
+		offsets[i] = block - (uint8_t *)shm;
+	}
+
+	if (write(fds[1], offsets, sizeof(offsets)) != sizeof(offsets))
+		errors++;
+
+	close(fds[1]);
+
+	int status;
+
+	if ((waitpid(pid, &status, 0) == -1) || !WIFEXITED(status) || (WEXITSTATUS(status) != EXIT_SUCCESS))
+		errors++;
+
+	/* heap must be usable after child has grown it and detached */
+	if (shm->attached != 1)
+		errors++;
+
+	void *block = memmgr_shm_alloc(mm, shm, LARGE_BLOCK_SIZE, 0);
+
+	if ((block == NULL) || !memmgr_free(mm, block))
+		errors++;
+
+	if (shmmgr_verify(shm, verbose))
+		errors++;
+
+	memmgr_verify(mm, verbose);
+
+	memmgr_shm_detach(mm, shm);
+
+	if (!shmmgr_destroy(SHM_NAME))
+		errors++;
+
+	printf("%s: %d errors\n", argv[0], errors);
+
+	return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}